@@ -0,0 +1,359 @@
+/*
+ * AnalogX firmware
+ *
+ * Copyright (C) 2017 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "acquisition.h"
+#include "fixed_math.h"
+
+/* Scale 12 bits to 5.0v */
+#define ADC_SCALING 1.0 / 0.80688
+
+/*
+ * re-map a scan from conversion order to channel order; the ADC scans
+ * ascending channels and analog 1..4 are on channels 9, 7, 6 and 5
+ */
+void acquisition_remap_scan(const uint16_t *scan, uint16_t *samples)
+{
+        samples[0] = scan[3];
+        samples[1] = scan[2];
+        samples[2] = scan[1];
+        samples[3] = scan[0];
+}
+
+/*
+ * Bring a scan taken with another profile to what acquisition_remap_scan
+ * expects: ascending channel order and 12 bit values.
+ */
+void acquisition_normalize_scan(uint16_t *scan, uint8_t scan_order, uint8_t resolution)
+{
+        if (scan_order == ACQUISITION_SCAN_DESCENDING) {
+                for (size_t c = 0; c < ADC_CHANNELS / 2; c++) {
+                        uint16_t swap = scan[c];
+                        scan[c] = scan[ADC_CHANNELS - 1 - c];
+                        scan[ADC_CHANNELS - 1 - c] = swap;
+                }
+        }
+        for (size_t c = 0; c < ADC_CHANNELS; c++)
+                scan[c] <<= 2 * resolution;
+}
+
+/*
+ * Back to back conversions per second in continuous mode. Each takes the
+ * sample time plus 12.5, 10.5, 8.5 or 6.5 cycles for 12 .. 6 bits; times
+ * are in half cycles to keep them integer.
+ */
+uint32_t acquisition_conversion_rate(uint8_t sample_time, uint8_t resolution)
+{
+        static const uint16_t sample_half_cycles[ACQUISITION_SAMPLE_TIMES] = {
+                3, 15, 27, 57, 83, 111, 143, 479
+        };
+        static const uint16_t conversion_half_cycles[ACQUISITION_RESOLUTIONS] = {
+                25, 21, 17, 13
+        };
+
+        if (sample_time >= ACQUISITION_SAMPLE_TIMES || resolution >= ACQUISITION_RESOLUTIONS)
+                return 0;
+        uint32_t half_cycles = sample_half_cycles[sample_time] + conversion_half_cycles[resolution];
+        return 2 * ACQUISITION_ADC_CLOCK_HZ / half_cycles;
+}
+
+/* Back to back scans of all channels per second in continuous mode */
+uint32_t acquisition_max_scan_rate(uint8_t sample_time, uint8_t resolution)
+{
+        return acquisition_conversion_rate(sample_time, resolution) / ADC_CHANNELS;
+}
+
+uint16_t scale_0_to_5_volts(uint16_t raw_value)
+{
+    float scaled = raw_value * ADC_SCALING;
+    return (uint16_t)scaled;
+}
+
+/* Scale a scan in channel order to millivolts */
+void acquisition_scale_scan(const uint16_t *samples, uint16_t *scaled)
+{
+        for (size_t c = 0; c < ADC_CHANNELS; c++)
+                scaled[c] = scale_0_to_5_volts(samples[c]);
+}
+
+/*
+ * Oversample depth scans in conversion order: sum each group of 2^shift
+ * scans, keeping up to 16 bits. Returns the number of scans produced.
+ */
+size_t acquisition_oversample(const uint16_t *buffer, size_t depth, uint8_t shift,
+                              uint16_t (*scans)[ADC_CHANNELS])
+{
+        size_t group = 1 << shift;
+        uint8_t drop_bits = shift > 4 ? shift - 4 : 0;
+        size_t count = 0;
+
+        for (size_t first = 0; first + group <= depth; first += group) {
+                uint32_t sums[ADC_CHANNELS] = {0};
+                for (size_t i = first; i < first + group; i++) {
+                        uint16_t scan[ADC_CHANNELS];
+                        acquisition_remap_scan(buffer + i * ADC_CHANNELS, scan);
+                        for (size_t c = 0; c < ADC_CHANNELS; c++)
+                                sums[c] += scan[c];
+                }
+                for (size_t c = 0; c < ADC_CHANNELS; c++)
+                        scans[count][c] = sums[c] >> drop_bits;
+                count++;
+        }
+        return count;
+}
+
+/*
+ * Fill in steps scans at equal distances from one scan towards the next,
+ * starting with the first itself; both in channel order.
+ */
+void acquisition_interpolate(const uint16_t *from, const uint16_t *to, uint8_t steps,
+                             uint16_t (*scans)[ADC_CHANNELS])
+{
+        for (uint8_t s = 0; s < steps; s++) {
+                for (size_t c = 0; c < ADC_CHANNELS; c++) {
+                        int32_t delta = (int32_t)to[c] - from[c];
+                        scans[s][c] = from[c] + delta * s / steps;
+                }
+        }
+}
+
+/*
+ * The 16 bit broadcast value of a pulse measurement in the given channel
+ * mode, saturated. A period of 0 means no pulses: 0 Hz, an unbounded
+ * period and a duty cycle of 0.
+ */
+uint16_t acquisition_pulse_value(uint8_t mode, uint32_t period_us, uint32_t high_us)
+{
+        uint32_t value;
+        switch (mode) {
+        case CHANNEL_MODE_FREQUENCY:
+                value = period_us ? (10000000 + period_us / 2) / period_us : 0;
+                break;
+        case CHANNEL_MODE_PERIOD:
+                value = period_us ? period_us : UINT16_MAX;
+                break;
+        case CHANNEL_MODE_DUTY:
+                value = period_us ? ((uint64_t)high_us * 1000 + period_us / 2) / period_us : 0;
+                break;
+        default:
+                value = 0;
+        }
+        return value > UINT16_MAX ? UINT16_MAX : value;
+}
+
+/*
+ * Noise statistics per channel, in channel order, of depth scans in
+ * conversion order. The effective number of bits is that of an ideal
+ * 12 bit converter whose quantization noise (1 / sqrt(12) LSB rms)
+ * equals the measured standard deviation:
+ *   ENOB = 12 - log2(stddev * sqrt(12))
+ * so a perfectly steady input reads as the full 12 bits.
+ */
+void acquisition_noise(const uint16_t *buffer, size_t depth, struct NoiseStats *stats)
+{
+        uint32_t sums[ADC_CHANNELS] = {0};
+        uint64_t squares[ADC_CHANNELS] = {0};
+        uint16_t min[ADC_CHANNELS];
+        uint16_t max[ADC_CHANNELS] = {0};
+
+        for (size_t c = 0; c < ADC_CHANNELS; c++)
+                min[c] = UINT16_MAX;
+
+        for (size_t i = 0; i < depth; i++) {
+                uint16_t scan[ADC_CHANNELS];
+                acquisition_remap_scan(buffer + i * ADC_CHANNELS, scan);
+                for (size_t c = 0; c < ADC_CHANNELS; c++) {
+                        sums[c] += scan[c];
+                        squares[c] += (uint32_t)scan[c] * scan[c];
+                        if (scan[c] < min[c])
+                                min[c] = scan[c];
+                        if (scan[c] > max[c])
+                                max[c] = scan[c];
+                }
+        }
+
+        for (size_t c = 0; c < ADC_CHANNELS; c++) {
+                struct NoiseStats *s = &stats[c];
+                if (!depth) {
+                        s->mean_q4 = s->stddev_q4 = s->peak_to_peak = s->enob_q8 = 0;
+                        continue;
+                }
+
+                /* variance in LSB^2 / 256 */
+                uint64_t n = depth;
+                uint64_t spread = n * squares[c] - (uint64_t)sums[c] * sums[c];
+                uint64_t variance_q8 = (spread << 8) / (n * n);
+
+                s->mean_q4 = ((uint64_t)sums[c] * 16 + n / 2) / n;
+                s->stddev_q4 = fixed_isqrt(variance_q8);
+                s->peak_to_peak = max[c] - min[c];
+
+                /* stddev * sqrt(12) in LSB / 16 */
+                uint32_t noise_q4 = fixed_isqrt(variance_q8 * 12);
+                uint32_t full_scale_q8 = (12 + 4) << 8;
+                uint32_t log_noise = noise_q4 ? fixed_log2_q8(noise_q4) : 0;
+                if (log_noise < (4 << 8))
+                        s->enob_q8 = 12 << 8;
+                else
+                        s->enob_q8 = log_noise >= full_scale_q8 ? 0 : full_scale_q8 - log_noise;
+        }
+}
+
+/*
+ * Supply compensation. Readings are relative to the supply, VDDA, and
+ * VREFINT is a fixed voltage read as vrefint_cal at the calibration
+ * supply, so vrefint_cal / vrefint is the actual supply over the
+ * calibration supply: the factor that corrects a reading, as Q16.
+ */
+uint32_t acquisition_supply_ratio(uint16_t vrefint, uint16_t vrefint_cal)
+{
+        return vrefint ? ((uint32_t)vrefint_cal << 16) / vrefint : 0;
+}
+
+uint16_t acquisition_supply_mv(uint32_t ratio_q16)
+{
+        return ((uint64_t)ACQUISITION_CAL_SUPPLY_MV * ratio_q16 + 0x8000) >> 16;
+}
+
+/* Correct a scan in channel order, saturated to 16 bits */
+void acquisition_correct_scan(const uint16_t *samples, uint32_t ratio_q16, uint16_t *corrected)
+{
+        for (size_t c = 0; c < ADC_CHANNELS; c++) {
+                uint32_t value = ((uint64_t)samples[c] * ratio_q16 + 0x8000) >> 16;
+                corrected[c] = value > UINT16_MAX ? UINT16_MAX : value;
+        }
+}
+
+/* Correct a total from acquisition_integrate(), in halves to stay within 64 bits */
+int64_t acquisition_correct_total(int64_t total, uint32_t ratio_q16)
+{
+        return (total >> 16) * ratio_q16 + (int64_t)(((total & 0xFFFF) * ratio_q16) >> 16);
+}
+
+/*
+ * Die temperature in 0.1C from the sensor reading, corrected to the
+ * calibration supply, and the factory readings at 30C and 110C. Parts
+ * without the second point use the typical slope of -4.3mV/C.
+ */
+int16_t acquisition_die_temperature(uint16_t sensor, uint32_t ratio_q16, uint16_t ts_cal1, uint16_t ts_cal2)
+{
+        int32_t reading = ((uint64_t)sensor * ratio_q16 + 0x8000) >> 16;
+        int32_t delta = reading - ts_cal1;
+
+        if (ts_cal2 == ts_cal1 || ts_cal2 == UINT16_MAX) {
+                /* 4.3mV/C is 5.336 LSB/C at 3.3V */
+                return 300 - delta * 10000 / 5336;
+        }
+        return 300 + delta * 800 / ((int32_t)ts_cal2 - ts_cal1);
+}
+
+/* A virtual channel from the values of a sensor frame, in channel order */
+int16_t acquisition_virtual_value(const struct VirtualChannel *channel, const uint16_t *values)
+{
+        int32_t a = values[channel->a];
+        int32_t b = values[channel->b];
+        int32_t value;
+
+        switch (channel->op) {
+        case VIRTUAL_OP_SCALE:
+                value = a;
+                break;
+        case VIRTUAL_OP_SUM:
+                value = a + b;
+                break;
+        case VIRTUAL_OP_DIFFERENCE:
+                value = a - b;
+                break;
+        case VIRTUAL_OP_RATIO:
+                value = b ? a * 1000 / b : INT16_MAX;
+                break;
+        default:
+                return 0;
+        }
+
+        /* a ratio reaches 65535000, so scale in 64 bits */
+        int64_t scaled = (int64_t)value * channel->gain_q8 / 256 + channel->offset;
+        return scaled > INT16_MAX ? INT16_MAX : scaled < INT16_MIN ? INT16_MIN : scaled;
+}
+
+/*
+ * Add depth scans in conversion order, taken over the last ticks, to the
+ * totals of the enabled channels: the mean of the block times its
+ * duration. With blocks of up to 16 scans, 12 bit offsets, a Q16 gain and
+ * up to a second of 10kHz ticks the product stays within 64 bits.
+ */
+void acquisition_integrate(const uint16_t *buffer, size_t depth, uint32_t ticks,
+                           const struct TotalizerChannel *channels, int64_t *totals)
+{
+        int32_t sums[ADC_CHANNELS] = {0};
+
+        if (!depth)
+                return;
+        for (size_t i = 0; i < depth; i++) {
+                uint16_t scan[ADC_CHANNELS];
+                acquisition_remap_scan(buffer + i * ADC_CHANNELS, scan);
+                for (size_t c = 0; c < ADC_CHANNELS; c++)
+                        sums[c] += scan[c];
+        }
+        for (size_t c = 0; c < ADC_CHANNELS; c++) {
+                const struct TotalizerChannel *channel = &channels[c];
+                if (!channel->enabled)
+                        continue;
+                int64_t area = (int64_t)(sums[c] - (int32_t)channel->offset * (int32_t)depth) *
+                        channel->gain_q16 * ticks;
+                totals[c] += area / (int64_t)depth;
+        }
+}
+
+/* A total as whole units, rounded down and saturated, and 1/65536ths */
+void acquisition_total_split(int64_t total, uint32_t tick_hz, int32_t *whole, uint16_t *fraction)
+{
+        int64_t q16 = total / tick_hz;
+        if (total < 0 && q16 * (int64_t)tick_hz != total)
+                q16--;
+
+        int64_t units = q16 >> 16;
+        *whole = units > INT32_MAX ? INT32_MAX : units < INT32_MIN ? INT32_MIN : units;
+        *fraction = q16 & 0xFFFF;
+}
+
+/* The total that reads as whole units */
+int64_t acquisition_total_preset(int32_t whole, uint32_t tick_hz)
+{
+        return (int64_t)whole * 65536 * tick_hz;
+}
+
+/*
+ * Pack a scan of 12 bit samples, analog 1 first, into the 8 bytes of a
+ * CAN stream frame: the sequence number, little endian, then the samples
+ * as a little endian bit stream of 12 bits each.
+ */
+void acquisition_pack_scan(const uint16_t *samples, uint16_t sequence, uint8_t *data)
+{
+        data[0] = sequence & 0xFF;
+        data[1] = sequence >> 8;
+        for (size_t c = 0; c < ADC_CHANNELS; c += 2) {
+                uint16_t even = samples[c] & ADC_FULL_SCALE;
+                uint16_t odd = samples[c + 1] & ADC_FULL_SCALE;
+                uint8_t *p = data + 2 + c / 2 * 3;
+                p[0] = even & 0xFF;
+                p[1] = (even >> 8) | ((odd & 0xF) << 4);
+                p[2] = odd >> 4;
+        }
+}
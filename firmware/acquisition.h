@@ -0,0 +1,123 @@
+/*
+ * AnalogX firmware
+ *
+ * Copyright (C) 2017 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ACQUISITION_H_
+#define ACQUISITION_H_
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Sample processing between the ADC driver and the CAN / telemetry
+ * framing. Free of any RTOS or HAL dependency so it builds for the host,
+ * see test/.
+ */
+#define ADC_CHANNELS 4
+#define ADC_FULL_SCALE 4095
+
+/* The ADC runs from the dedicated 14MHz HSI14 oscillator */
+#define ACQUISITION_ADC_CLOCK_HZ        14000000
+
+/* VREFINT and the temperature sensor are calibrated at this supply */
+#define ACQUISITION_CAL_SUPPLY_MV       3300
+
+/* Acquisition profile settings, as the ADC_SMPR and ADC_CFGR1 fields */
+#define ACQUISITION_SAMPLE_TIMES        8       /* 1.5 .. 239.5 cycles */
+#define ACQUISITION_RESOLUTIONS         4       /* 12, 10, 8, 6 bits */
+#define ACQUISITION_SCAN_ASCENDING      0
+#define ACQUISITION_SCAN_DESCENDING     1
+
+/* What a channel reports: its voltage or a pulse measurement */
+#define CHANNEL_MODE_ANALOG             0
+#define CHANNEL_MODE_FREQUENCY          1       /* Hz / 10 */
+#define CHANNEL_MODE_PERIOD             2       /* us */
+#define CHANNEL_MODE_DUTY               3       /* permille */
+#define CHANNEL_MODES                   4
+
+/*
+ * Integration of a channel: (sample - offset) * gain over time. Totals
+ * are in units / 65536 times the time base of the caller.
+ */
+struct TotalizerChannel {
+        uint8_t enabled;
+        uint16_t offset;        /* LSB reading at zero */
+        int32_t gain_q16;       /* units/s per LSB, Q16 */
+};
+
+/*
+ * Virtual channels: a value derived from the broadcast values of the
+ * physical channels, (op(a, b) * gain) / 256 + offset, saturated to 16
+ * bits signed. A ratio is a * 1000 / b. They are evaluated once per
+ * sensor frame, in every mode that broadcasts one; the telemetry and CAN
+ * streams carry the physical channels' ADC counts only.
+ */
+#define VIRTUAL_CHANNELS                4
+#define VIRTUAL_OP_OFF                  0
+#define VIRTUAL_OP_SCALE                1       /* a */
+#define VIRTUAL_OP_SUM                  2       /* a + b */
+#define VIRTUAL_OP_DIFFERENCE           3       /* a - b */
+#define VIRTUAL_OP_RATIO                4       /* a / b, permille */
+#define VIRTUAL_OPS                     5
+
+/* Where a virtual channel is reported */
+#define VIRTUAL_OUTPUT_FRAME            0       /* the virtual channels frame */
+                                                /* 1..4: in place of that channel */
+struct VirtualChannel {
+        uint8_t op;
+        uint8_t a;              /* channel, 0..3 */
+        uint8_t b;
+        uint8_t output;
+        int16_t gain_q8;
+        int16_t offset;
+};
+
+/* Noise of one channel over a block of samples, in integer fixed point */
+struct NoiseStats {
+        uint16_t mean_q4;       /* LSB / 16 */
+        uint16_t stddev_q4;     /* LSB / 16 */
+        uint16_t peak_to_peak;  /* LSB */
+        uint16_t enob_q8;       /* bits / 256 */
+};
+
+void acquisition_remap_scan(const uint16_t *scan, uint16_t *samples);
+void acquisition_normalize_scan(uint16_t *scan, uint8_t scan_order, uint8_t resolution);
+uint32_t acquisition_conversion_rate(uint8_t sample_time, uint8_t resolution);
+uint32_t acquisition_max_scan_rate(uint8_t sample_time, uint8_t resolution);
+uint16_t scale_0_to_5_volts(uint16_t raw_value);
+void acquisition_scale_scan(const uint16_t *samples, uint16_t *scaled);
+size_t acquisition_oversample(const uint16_t *buffer, size_t depth, uint8_t shift,
+                              uint16_t (*scans)[ADC_CHANNELS]);
+void acquisition_interpolate(const uint16_t *from, const uint16_t *to, uint8_t steps,
+                             uint16_t (*scans)[ADC_CHANNELS]);
+uint16_t acquisition_pulse_value(uint8_t mode, uint32_t period_us, uint32_t high_us);
+void acquisition_noise(const uint16_t *buffer, size_t depth, struct NoiseStats *stats);
+uint32_t acquisition_supply_ratio(uint16_t vrefint, uint16_t vrefint_cal);
+uint16_t acquisition_supply_mv(uint32_t ratio_q16);
+void acquisition_correct_scan(const uint16_t *samples, uint32_t ratio_q16, uint16_t *corrected);
+int64_t acquisition_correct_total(int64_t total, uint32_t ratio_q16);
+int16_t acquisition_die_temperature(uint16_t sensor, uint32_t ratio_q16, uint16_t ts_cal1, uint16_t ts_cal2);
+int16_t acquisition_virtual_value(const struct VirtualChannel *channel, const uint16_t *values);
+void acquisition_integrate(const uint16_t *buffer, size_t depth, uint32_t ticks,
+                           const struct TotalizerChannel *channels, int64_t *totals);
+void acquisition_total_split(int64_t total, uint32_t tick_hz, int32_t *whole, uint16_t *fraction);
+int64_t acquisition_total_preset(int32_t whole, uint32_t tick_hz);
+void acquisition_pack_scan(const uint16_t *samples, uint16_t sequence, uint8_t *data);
+
+#endif /* ACQUISITION_H_ */
@@ -20,16 +20,29 @@
  */
 #include "analogx_api.h"
 
+#include "config_store.h"
+#include "acquisition.h"
+#if PULSE_CAPTURE
+#include "pulse_capture.h"
+#endif
 #include "logging.h"
 #include "settings.h"
 #include "ch.h"
 #include "hal.h"
+#include <string.h>
 #define _LOG_PFX "API:         "
 
-static struct ConfigGroup1 g_config_group_1 = {ANALOGX_DEFAULT_SAMPLE_RATE};
+static struct PersistentConfig g_config = {
+        .config_group_1 = {ANALOGX_DEFAULT_SAMPLE_RATE},
+        .config_group_2 = {DEFAULT_ADC_SAMPLE_TIME, DEFAULT_ADC_RESOLUTION, ACQUISITION_SCAN_ASCENDING}
+};
 
 static bool g_provisioned = false;
 
+/* The CAN worker changes the configuration and the main thread the totals;
+ * changes and the snapshot saved to flash are made under this lock */
+static MUTEX_DECL(g_config_lock);
+
 bool api_is_provisoned(void)
 {
         return g_provisioned;
@@ -40,30 +53,246 @@ void set_api_is_provisioned(bool provisioned)
         g_provisioned = provisioned;
 }
 
+static bool _virtual_channel_valid(const struct VirtualChannel *channel)
+{
+        return channel->op < VIRTUAL_OPS && channel->a < ADC_CHANNELS && channel->b < ADC_CHANNELS &&
+                channel->output <= ADC_CHANNELS;
+}
+
+/* Replace any out of range values restored from flash with defaults */
+static void _validate_config(void)
+{
+        if (g_config.config_group_1.update_rate_hz == 0)
+                g_config.config_group_1.update_rate_hz = ANALOGX_DEFAULT_SAMPLE_RATE;
+
+        struct ConfigGroup2 *profile = &g_config.config_group_2;
+        if (profile->sample_time >= ACQUISITION_SAMPLE_TIMES)
+                profile->sample_time = DEFAULT_ADC_SAMPLE_TIME;
+        if (profile->resolution >= ACQUISITION_RESOLUTIONS)
+                profile->resolution = DEFAULT_ADC_RESOLUTION;
+        if (profile->scan_order > ACQUISITION_SCAN_DESCENDING)
+                profile->scan_order = ACQUISITION_SCAN_ASCENDING;
+
+        for (uint8_t c = 0; c < ADC_CHANNELS; c++) {
+                if (g_config.config_group_3.channel_mode[c] >= CHANNEL_MODES)
+                        g_config.config_group_3.channel_mode[c] = CHANNEL_MODE_ANALOG;
+
+                struct TotalizerChannel *totalizer = &g_config.config_group_4.totalizer[c];
+                if (totalizer->enabled > 1 || totalizer->offset > ADC_FULL_SCALE)
+                        *totalizer = (struct TotalizerChannel){0};
+        }
+
+        for (uint8_t v = 0; v < VIRTUAL_CHANNELS; v++) {
+                if (!_virtual_channel_valid(&g_config.config_group_5.virtual_channel[v]))
+                        g_config.config_group_5.virtual_channel[v] = (struct VirtualChannel){0};
+        }
+}
+
+/*
+ * Restore the last known configuration from flash, so we resume
+ * operating immediately without waiting for the host to provision us.
+ */
 void api_initialize(void)
 {
-        /* NOOP */
+        uint16_t version;
+        if (!config_store_load(&version, &g_config, sizeof(g_config)))
+                return;
+
+        _validate_config();
+        set_api_is_provisioned(true);
+}
+
+/* Persist the current configuration */
+void api_save_config(void)
+{
+        chMtxLock(&g_config_lock);
+        config_store_save(API_CONFIG_VERSION, &g_config, sizeof(g_config));
+        chMtxUnlock(&g_config_lock);
+}
+
+/* Copy value over a field of g_config and persist it; returns whether it
+ * changed. Only touches flash if something actually changed. */
+static bool _update_config(void *field, const void *value, size_t size)
+{
+        chMtxLock(&g_config_lock);
+        bool changed = memcmp(field, value, size) != 0;
+        if (changed) {
+                memcpy(field, value, size);
+                config_store_save(API_CONFIG_VERSION, &g_config, sizeof(g_config));
+        }
+        chMtxUnlock(&g_config_lock);
+        return changed;
 }
 
 void api_set_config_group_1(CANRxFrame *rx_msg)
 {
-        if (rx_msg->DLC < 1) {
+        if (rx_msg->DLC < 1 || rx_msg->data8[0] == 0) {
                 log_info(_LOG_PFX "Invalid params for set config group 1\r\n");
                 return;
         }
         uint8_t sample_rate = rx_msg->data8[0];
 
-        set_sample_rate(sample_rate);
+        _update_config(&g_config.config_group_1.update_rate_hz, &sample_rate, sizeof(sample_rate));
+}
+
+/*
+ * Report the acquisition profile on API_ACQUISITION_PROFILE: sample time,
+ * resolution and scan order (data8[0..2]) and the maximum rate of back
+ * to back scans with it, in scans/s (data32[1]).
+ */
+static void _send_acquisition_profile(void)
+{
+        const struct ConfigGroup2 *profile = &g_config.config_group_2;
+        uint32_t max_rate = acquisition_max_scan_rate(profile->sample_time, profile->resolution);
+        CANTxFrame frame;
+        prepare_can_tx_message(&frame, CAN_IDE_EXT, get_can_base_id() + API_ACQUISITION_PROFILE);
+        frame.data8[0] = profile->sample_time;
+        frame.data8[1] = profile->resolution;
+        frame.data8[2] = profile->scan_order;
+        frame.data32[1] = max_rate;
+        canTransmit(&CAND1, CAN_ANY_MAILBOX, &frame, MS2ST(CAN_TRANSMIT_TIMEOUT));
+        log_info(_LOG_PFX "Acquisition SMPR %u resolution %u order %u, max %u scans/s\r\n",
+                 profile->sample_time, profile->resolution, profile->scan_order, max_rate);
+}
+
+/*
+ * Select the acquisition profile: sample time (ADC_SMPR 0..7), resolution
+ * (0..3 = 12, 10, 8, 6 bits) and scan order (0 ascending, 1 descending).
+ * Without data only reports the current profile.
+ */
+void api_set_config_group_2(CANRxFrame *rx_msg)
+{
+        if (rx_msg->DLC >= 3) {
+                struct ConfigGroup2 profile = {rx_msg->data8[0], rx_msg->data8[1], rx_msg->data8[2]};
+                if (profile.sample_time >= ACQUISITION_SAMPLE_TIMES ||
+                    profile.resolution >= ACQUISITION_RESOLUTIONS ||
+                    profile.scan_order > ACQUISITION_SCAN_DESCENDING) {
+                        log_info(_LOG_PFX "Invalid params for set config group 2\r\n");
+                        return;
+                }
+                _update_config(&g_config.config_group_2, &profile, sizeof(profile));
+        }
+        _send_acquisition_profile();
+}
+
+#if PULSE_CAPTURE
+/*
+ * Select what each channel reports (data8[0..3], CHANNEL_MODE_*): its
+ * voltage, or the frequency, period or duty cycle of a pulse input.
+ */
+void api_set_config_group_3(CANRxFrame *rx_msg)
+{
+        struct ConfigGroup3 modes;
+        for (uint8_t c = 0; c < ADC_CHANNELS; c++) {
+                modes.channel_mode[c] = rx_msg->data8[c];
+                if (modes.channel_mode[c] >= CHANNEL_MODES ||
+                    (modes.channel_mode[c] != CHANNEL_MODE_ANALOG && !pulse_capture_supported(c))) {
+                        log_info(_LOG_PFX "Invalid params for set config group 3\r\n");
+                        return;
+                }
+        }
+
+        if (_update_config(&g_config.config_group_3, &modes, sizeof(modes)))
+                pulse_capture_configure(modes.channel_mode);
+}
+#endif
+
+/*
+ * Set up the totalizer of a channel: data8[0] channel (0..3), data8[1]
+ * 1 to integrate it, data16[1] its reading at zero in LSB and data32[1]
+ * its gain in units/s per LSB, Q16 (signed).
+ */
+void api_set_config_group_4(CANRxFrame *rx_msg)
+{
+        uint8_t channel = rx_msg->data8[0];
+        struct TotalizerChannel totalizer;
+
+        /* compared and stored whole, so the padding after enabled must be zero */
+        memset(&totalizer, 0, sizeof(totalizer));
+        totalizer.enabled = rx_msg->data8[1];
+        totalizer.offset = rx_msg->data16[1];
+        totalizer.gain_q16 = (int32_t)rx_msg->data32[1];
+
+        if (channel >= ADC_CHANNELS || totalizer.enabled > 1 || totalizer.offset > ADC_FULL_SCALE) {
+                log_info(_LOG_PFX "Invalid params for set config group 4\r\n");
+                return;
+        }
+        _update_config(&g_config.config_group_4.totalizer[channel], &totalizer, sizeof(totalizer));
+}
+
+/*
+ * Define a virtual channel: data8[0] its index (0..3), data8[1] the
+ * operation (VIRTUAL_OP_*, 0 turns it off), data8[2] the channels a and
+ * b (0..3) in the low and high nibble, data8[3] where it is reported (0
+ * the virtual channels frame, 1..4 in place of that channel), data16[2]
+ * the gain / 256 and data16[3] the offset, both signed.
+ */
+void api_set_config_group_5(CANRxFrame *rx_msg)
+{
+        uint8_t index = rx_msg->data8[0];
+        struct VirtualChannel channel = {
+                rx_msg->data8[1], rx_msg->data8[2] & 0x0F, rx_msg->data8[2] >> 4, rx_msg->data8[3],
+                (int16_t)rx_msg->data16[2], (int16_t)rx_msg->data16[3]
+        };
+
+        if (index >= VIRTUAL_CHANNELS || !_virtual_channel_valid(&channel)) {
+                log_info(_LOG_PFX "Invalid params for set config group 5\r\n");
+                return;
+        }
+        _update_config(&g_config.config_group_5.virtual_channel[index], &channel, sizeof(channel));
+}
+
+/* Persist the totals, if they moved since they were last saved */
+void api_save_totals(const int64_t *totals)
+{
+        _update_config(g_config.totals, totals, sizeof(g_config.totals));
+}
+
+/*
+ * I-class: reset straight away from the dispatcher. Unlike reset_system()
+ * there is no wait for the log to drain.
+ */
+void api_reset_device_i(CANRxFrame *rx_msg)
+{
+        (void)rx_msg;
+        NVIC_SystemReset();
 }
 
 uint8_t get_sample_rate(void)
 {
-        return g_config_group_1.update_rate_hz;
+        return g_config.config_group_1.update_rate_hz;
 }
 
 void set_sample_rate(uint8_t sample_rate)
 {
-        g_config_group_1.update_rate_hz = sample_rate;
+        chMtxLock(&g_config_lock);
+        g_config.config_group_1.update_rate_hz = sample_rate;
+        chMtxUnlock(&g_config_lock);
+}
+
+const struct ConfigGroup2 *get_acquisition_profile(void)
+{
+        return &g_config.config_group_2;
+}
+
+const uint8_t *get_channel_modes(void)
+{
+        return g_config.config_group_3.channel_mode;
+}
+
+const struct TotalizerChannel *get_totalizer_config(void)
+{
+        return g_config.config_group_4.totalizer;
+}
+
+const int64_t *get_saved_totals(void)
+{
+        return g_config.totals;
+}
+
+const struct VirtualChannel *get_virtual_channels(void)
+{
+        return g_config.config_group_5.virtual_channel;
 }
 
 void api_send_announcement(void)
@@ -24,35 +24,70 @@
 #include "ch.h"
 #include "hal.h"
 #include "system_CAN.h"
+#include "api_protocol.h"
+#include "acquisition.h"
 
 struct ConfigGroup1 {
         uint8_t update_rate_hz;
 };
 
-/* API offsets */
-#define ANALOGX_CAN_BASE_ID                 0xE4600
-#define ANALOGX_CAN_API_RANGE               256
-#define ANALOGx_CAN_FILTER_MASK             0x1FFFFF00
+/* Acquisition profile, see acquisition.h */
+struct ConfigGroup2 {
+        uint8_t sample_time;
+        uint8_t resolution;
+        uint8_t scan_order;
+};
 
-#define ANALOGX_DEFAULT_SAMPLE_RATE         DEFAULT_SAMPLE_RATE
+/* Channel modes, CHANNEL_MODE_* in acquisition.h */
+struct ConfigGroup3 {
+        uint8_t channel_mode[ADC_CHANNELS];
+};
+
+/* Totalizer of each channel, see acquisition.h */
+struct ConfigGroup4 {
+        struct TotalizerChannel totalizer[ADC_CHANNELS];
+};
 
-/* Configuration and Runtime */
+/* Virtual channels, see acquisition.h */
+struct ConfigGroup5 {
+        struct VirtualChannel virtual_channel[VIRTUAL_CHANNELS];
+};
 
-#define API_ANNOUNCEMENT                    0
-#define API_RESET_DEVICE                    1
-#define API_STATS                           2
-#define API_SET_CONFIG_GROUP_1              3
+/* Configuration persisted to flash. Only append new fields, so
+ * records written by older firmware still restore their prefix */
+#define API_CONFIG_VERSION                  5
+struct PersistentConfig {
+        struct ConfigGroup1 config_group_1;
+        struct ConfigGroup2 config_group_2;
+        struct ConfigGroup3 config_group_3;
+        struct ConfigGroup4 config_group_4;
+        /* running totals, saved now and then by the totalizer */
+        int64_t totals[ADC_CHANNELS];
+        struct ConfigGroup5 config_group_5;
+};
 
-#define API_BROADCAST_SENSORS               20
+#define ANALOGX_DEFAULT_SAMPLE_RATE         DEFAULT_SAMPLE_RATE
 
 /* Base API functions */
 bool api_is_provisoned(void);
 void set_api_is_provisioned(bool);
 void api_initialize(void);
+void api_save_config(void);
 void api_set_config_group_1(CANRxFrame *rx_msg);
+void api_set_config_group_2(CANRxFrame *rx_msg);
+void api_set_config_group_3(CANRxFrame *rx_msg);
+void api_set_config_group_4(CANRxFrame *rx_msg);
+void api_set_config_group_5(CANRxFrame *rx_msg);
+void api_save_totals(const int64_t *totals);
+void api_reset_device_i(CANRxFrame *rx_msg);
 
 uint8_t get_sample_rate(void);
 void set_sample_rate(uint8_t sample_rate);
+const struct ConfigGroup2 *get_acquisition_profile(void);
+const uint8_t *get_channel_modes(void);
+const struct TotalizerChannel *get_totalizer_config(void);
+const int64_t *get_saved_totals(void);
+const struct VirtualChannel *get_virtual_channels(void);
 
 void api_send_announcement(void);
 
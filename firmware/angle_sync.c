@@ -0,0 +1,193 @@
+/*
+ * AnalogX firmware
+ *
+ * Copyright (C) 2017 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Crank angle synchronous acquisition, built with make USE_ANGLE_SYNC=yes.
+ *
+ * The tooth wheel signal drives TIM3 CH1 (PA6, analog 3) and a once per
+ * revolution index pulse TIM3 CH2 (PA7, analog 2). TIM3 runs in reset
+ * mode on the tooth edge, and its TRGO starts an ADC scan through the
+ * hardware trigger; the scans go by DMA into the circular stream buffer,
+ * so no code runs per tooth. The only interrupt is the index capture,
+ * once a revolution: it notes how many scans the DMA has written, which
+ * makes the next scan tooth 0. Scans are numbered from the start of
+ * acquisition and the tooth of each follows from the last index.
+ */
+
+#include "angle_sync.h"
+#include "acquisition.h"
+#include "logging.h"
+#include "settings.h"
+
+#define _LOG_PFX "ANGLE:       "
+
+#define ANGLE_TIMER             STM32_TIM3
+#define ANGLE_TIMER_HZ          1000000
+/* Input filter: 8 samples at 48MHz, rejects glitches under 170ns */
+#define ANGLE_INPUT_FILTER      3
+/* Slave mode: reset on TI1FP1; master mode: TRGO on reset */
+#define ANGLE_SMCR_TS_TI1FP1    5
+#define ANGLE_SMCR_SMS_RESET    4
+#define ANGLE_CR2_MMS_RESET     0
+
+static uint8_t g_teeth;
+static uint8_t g_steps = 1;
+
+static size_t g_buffer_depth;
+static uint32_t g_laps;
+static volatile uint32_t g_index_scan;
+static volatile bool g_synced;
+static systime_t g_index_time;
+static volatile systime_t g_revolution_ticks;
+static volatile uint32_t g_revolution_scans;
+
+/*
+ * Select the mode from CAN: data8[0] is the number of tooth positions
+ * per revolution (0 turns the mode off), data8[1] the number of scans
+ * streamed per tooth, interpolated between the measured ones.
+ */
+void angle_sync_configure(CANRxFrame *rx_msg)
+{
+        if (rx_msg->DLC < 2 || rx_msg->data8[1] == 0 || rx_msg->data8[1] > ANGLE_MAX_STEPS ||
+            rx_msg->data8[0] == ANGLE_NOT_SYNCED) {
+                log_info(_LOG_PFX "Invalid params for set angle mode\r\n");
+                return;
+        }
+        g_steps = rx_msg->data8[1];
+        g_teeth = rx_msg->data8[0];
+        log_info(_LOG_PFX "%u teeth, %u scans per tooth\r\n", g_teeth, g_steps);
+}
+
+uint8_t angle_sync_get_teeth(void)
+{
+        return g_teeth;
+}
+
+uint8_t angle_sync_get_steps(void)
+{
+        return g_steps;
+}
+
+/* Scans the ADC has written since the start, from the DMA position */
+static uint32_t _scans_written(void)
+{
+        const stm32_dma_stream_t *dma = ADCD1.dmastp;
+        size_t written = g_buffer_depth * ADC_CHANNELS - dmaStreamGetTransactionSize(dma);
+        uint32_t laps = g_laps;
+        /* wrapped, but the transfer complete interrupt has not run yet */
+        if ((dma->dma->ISR & (STM32_DMA_ISR_TCIF << dma->shift)) && written < g_buffer_depth * ADC_CHANNELS / 2)
+                laps++;
+        return laps * g_buffer_depth + written / ADC_CHANNELS;
+}
+
+OSAL_IRQ_HANDLER(STM32_TIM3_HANDLER)
+{
+        OSAL_IRQ_PROLOGUE();
+
+        if (ANGLE_TIMER->SR & STM32_TIM_SR_CC2IF) {
+                (void)ANGLE_TIMER->CCR[1];
+                systime_t now = chVTGetSystemTimeX();
+
+                osalSysLockFromISR();
+                uint32_t scan = _scans_written();
+                if (g_synced) {
+                        g_revolution_ticks = now - g_index_time;
+                        g_revolution_scans = scan - g_index_scan;
+                }
+                g_index_scan = scan;
+                g_index_time = now;
+                g_synced = true;
+                osalSysUnlockFromISR();
+        }
+
+        OSAL_IRQ_EPILOGUE();
+}
+
+/* Called from the ADC callback each time the DMA wraps */
+void angle_sync_buffer_wrapped_i(void)
+{
+        g_laps++;
+}
+
+void angle_sync_start(size_t buffer_depth)
+{
+        g_buffer_depth = buffer_depth;
+        g_laps = 0;
+        g_synced = false;
+        g_revolution_ticks = 0;
+        g_revolution_scans = 0;
+
+        palSetPadMode(GPIOA, 6, PAL_MODE_ALTERNATE(1));
+        palSetPadMode(GPIOA, 7, PAL_MODE_ALTERNATE(1));
+
+        rccEnableTIM3(FALSE);
+        rccResetTIM3();
+        ANGLE_TIMER->PSC = STM32_TIMCLK1 / ANGLE_TIMER_HZ - 1;
+        ANGLE_TIMER->ARR = 0xFFFF;
+        ANGLE_TIMER->CCMR1 = STM32_TIM_CCMR1_CC1S(1) | STM32_TIM_CCMR1_IC1F(ANGLE_INPUT_FILTER) |
+                             STM32_TIM_CCMR1_CC2S(1) | STM32_TIM_CCMR1_IC2F(ANGLE_INPUT_FILTER);
+        ANGLE_TIMER->CCER = STM32_TIM_CCER_CC1E | STM32_TIM_CCER_CC2E;
+        ANGLE_TIMER->SMCR = STM32_TIM_SMCR_TS(ANGLE_SMCR_TS_TI1FP1) | STM32_TIM_SMCR_SMS(ANGLE_SMCR_SMS_RESET);
+        ANGLE_TIMER->CR2 = STM32_TIM_CR2_MMS(ANGLE_CR2_MMS_RESET);
+        ANGLE_TIMER->DIER = STM32_TIM_DIER_CC2IE;
+        ANGLE_TIMER->CR1 = STM32_TIM_CR1_CEN;
+        nvicEnableVector(STM32_TIM3_NUMBER, ANGLE_SYNC_IRQ_PRIORITY);
+}
+
+void angle_sync_stop(void)
+{
+        nvicDisableVector(STM32_TIM3_NUMBER);
+        ANGLE_TIMER->CR1 = 0;
+        rccDisableTIM3(FALSE);
+        palSetPadMode(GPIOA, 6, PAL_MODE_INPUT_ANALOG);
+        palSetPadMode(GPIOA, 7, PAL_MODE_INPUT_ANALOG);
+}
+
+/* Tooth position of a scan, counted from the start of acquisition */
+uint8_t angle_sync_tooth(uint32_t scan)
+{
+        chSysLock();
+        bool synced = g_synced;
+        int32_t since_index = (int32_t)(scan - g_index_scan);
+        chSysUnlock();
+
+        if (!synced || !g_teeth)
+                return ANGLE_NOT_SYNCED;
+        int32_t tooth = since_index % g_teeth;
+        return tooth < 0 ? tooth + g_teeth : tooth;
+}
+
+/*
+ * Scans between the last two index pulses, one per tooth; anything else
+ * means a wrong tooth count, or missed or extra edges.
+ */
+uint32_t angle_sync_revolution_scans(void)
+{
+        return g_revolution_scans;
+}
+
+uint16_t angle_sync_rpm(void)
+{
+        systime_t ticks = g_revolution_ticks;
+        if (!ticks || chVTTimeElapsedSinceX(g_index_time) > ticks * 4)
+                return 0;
+        return 60 * CH_CFG_ST_FREQUENCY / ticks;
+}
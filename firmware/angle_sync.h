@@ -0,0 +1,41 @@
+/*
+ * AnalogX firmware
+ *
+ * Copyright (C) 2017 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ANGLE_SYNC_H_
+#define ANGLE_SYNC_H_
+#include "ch.h"
+#include "hal.h"
+
+/* Tooth index of scans taken before the first index pulse */
+#define ANGLE_NOT_SYNCED        0xFF
+#define ANGLE_MAX_STEPS         8
+
+void angle_sync_configure(CANRxFrame *rx_msg);
+uint8_t angle_sync_get_teeth(void);
+uint8_t angle_sync_get_steps(void);
+void angle_sync_start(size_t buffer_depth);
+void angle_sync_stop(void);
+void angle_sync_buffer_wrapped_i(void);
+uint8_t angle_sync_tooth(uint32_t scan);
+uint32_t angle_sync_revolution_scans(void);
+uint16_t angle_sync_rpm(void);
+
+#endif /* ANGLE_SYNC_H_ */
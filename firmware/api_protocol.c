@@ -0,0 +1,34 @@
+/*
+ * AnalogX firmware
+ *
+ * Copyright (C) 2017 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "api_protocol.h"
+
+/* Each address jumper setting moves the unit to its own API range */
+uint32_t api_protocol_base_id(uint8_t address_jumpers)
+{
+        return ANALOGX_CAN_BASE_ID + ANALOGX_CAN_API_RANGE * (address_jumpers & 0x03);
+}
+
+/* Offset of a message within our API range, or API_OFFSET_NONE */
+int32_t api_protocol_offset(uint32_t can_id, uint32_t base_id)
+{
+        uint32_t offset = can_id - base_id;
+        return offset < ANALOGX_CAN_API_RANGE ? (int32_t)offset : API_OFFSET_NONE;
+}
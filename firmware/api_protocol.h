@@ -0,0 +1,78 @@
+/*
+ * AnalogX firmware
+ *
+ * Copyright (C) 2017 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef API_PROTOCOL_H_
+#define API_PROTOCOL_H_
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * CAN API identifiers and their decoding; free of any RTOS or HAL
+ * dependency so it builds for the host, see test/.
+ */
+
+/* API offsets */
+#define ANALOGX_CAN_BASE_ID                 0xE4600
+#define ANALOGX_CAN_API_RANGE               256
+#define ANALOGx_CAN_FILTER_MASK             0x1FFFFF00
+
+/* Configuration and Runtime */
+
+#define API_ANNOUNCEMENT                    0
+#define API_RESET_DEVICE                    1
+#define API_STATS                           2
+#define API_SET_CONFIG_GROUP_1              3
+#define API_BOOT_TIMELINE                   4
+#define API_STATS_EXTENDED                  5
+#define API_GET_LATENCY_STATS               6
+#define API_LATENCY_STATS                   7
+#define API_SET_STREAM_MODE                 8
+#define API_NOISE_SCAN                      9
+#define API_NOISE_REPORT                    10
+#define API_SET_CONFIG_GROUP_2              11
+#define API_ACQUISITION_PROFILE             12
+#define API_SET_CONFIG_GROUP_3              13
+#define API_SET_ANGLE_MODE                  14
+#define API_SET_SPECTRUM_MODE               15
+#define API_SET_SPECTRUM_BANDS              16
+#define API_SPECTRUM_REPORT                 17
+#define API_SET_CONFIG_GROUP_4              18
+#define API_SET_TOTAL                       19
+
+#define API_BROADCAST_SENSORS               20
+#define API_TOTALS                          21
+#define API_SET_CONFIG_GROUP_5              22
+#define API_BROADCAST_VIRTUAL               23
+#define API_SET_CAN_STREAM                  24
+#define API_CAN_STREAM_DATA                 25
+#define API_CAN_STREAM_STATS                26
+#define API_GET_IMAGE_CRC                   27
+#define API_IMAGE_CRC                       28
+#define API_TRACE_CONTROL                   29
+#define API_TRACE_DATA                      30
+
+/* Returned by api_protocol_offset() for IDs outside our range */
+#define API_OFFSET_NONE                     -1
+
+uint32_t api_protocol_base_id(uint8_t address_jumpers);
+int32_t api_protocol_offset(uint32_t can_id, uint32_t base_id);
+
+#endif /* API_PROTOCOL_H_ */
@@ -0,0 +1,237 @@
+/*
+ * AnalogX firmware
+ *
+ * Copyright (C) 2017 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Benchmark image (make bench): times AnalogX hot paths and the kernel
+ * primitives they use with the SysTick cycle counter, and prints one
+ * machine parsable line per benchmark on SD2:
+ *
+ *   BENCH,<name>,<iterations>,<total cycles>,<cycles per iteration>
+ *
+ * Loop overhead is subtracted. The suite repeats every BENCH_PERIOD_MS
+ * between BENCH,begin and BENCH,end lines; compare two captures with
+ * tools/bench_compare.py.
+ */
+#include "ch.h"
+#include "hal.h"
+#include "chprintf.h"
+#include "settings.h"
+#include "analogx_api.h"
+#include "system_ADC.h"
+#include "system_CAN.h"
+#include "system_serial.h"
+#include "system_timer.h"
+#include "cobs.h"
+#include "crc32.h"
+#include "integrity.h"
+#include "system_flash.h"
+
+#if TELEMETRY_STREAM
+#error "The benchmark image reports on SD2; build it without USE_UART_STREAM"
+#endif
+
+#define BENCH_PERIOD_MS         5000
+#define BENCH_ITERATIONS        1000
+#define BENCH_ADC_SCANS         100
+#define BENCH_CAN_FRAMES        100
+#define BENCH_BUFFER_SIZE       64
+#define PING_THREAD_STACK       128
+
+#define BENCH(name, iterations, body) do { \
+        _drain_output(); \
+        uint32_t _start = system_timer_cycles(); \
+        for (uint32_t _i = 0; _i < (iterations); _i++) { \
+                body; \
+                asm volatile(""); \
+        } \
+        _report(name, iterations, system_timer_elapsed(_start)); \
+} while (0)
+
+static BaseSequentialStream *g_out = (BaseSequentialStream *)&SD2;
+static uint32_t g_loop_overhead = 0;
+static volatile uint32_t g_sink;
+
+/* Let SD2 go quiet so its interrupts stay out of the measurement */
+static void _drain_output(void)
+{
+        while (!oqIsEmptyI(&SD2.oqueue))
+                chThdSleepMilliseconds(1);
+        chThdSleepMilliseconds(1);
+}
+
+static void _report(const char *name, uint32_t iterations, uint32_t cycles)
+{
+        uint32_t overhead = g_loop_overhead * iterations;
+        cycles = cycles > overhead ? cycles - overhead : 0;
+        chprintf(g_out, "BENCH,%s,%u,%u,%u\r\n", name, iterations, cycles, cycles / iterations);
+}
+
+/* Calibrate the cost of an empty benchmark loop */
+static void _calibrate(void)
+{
+        uint32_t start = system_timer_cycles();
+        for (uint32_t i = 0; i < BENCH_ITERATIONS; i++)
+                asm volatile("");
+        g_loop_overhead = system_timer_elapsed(start) / BENCH_ITERATIONS;
+}
+
+static void _bench_sample_path(void)
+{
+        uint16_t raw = 0;
+        BENCH("scale_sample", BENCH_ITERATIONS, g_sink = scale_0_to_5_volts(raw++ & 0x0FFF));
+        BENCH("scale_scan", BENCH_ITERATIONS,
+              for (size_t c = 0; c < ADC_CHANNELS; c++)
+                      g_sink = scale_0_to_5_volts((raw + c) & 0x0FFF));
+}
+
+static void _bench_dispatch(void)
+{
+        CANRxFrame frame = {0};
+        frame.IDE = CAN_IDE_EXT;
+        frame.DLC = 1;
+
+        /* unknown API offset; falls through the dispatch table */
+        frame.EID = get_can_base_id() + ANALOGX_CAN_API_RANGE - 1;
+        BENCH("dispatch_unknown", BENCH_ITERATIONS, dispatch_can_rx(&frame));
+
+        /* unchanged sample rate; handled without touching flash */
+        frame.EID = get_can_base_id() + API_SET_CONFIG_GROUP_1;
+        frame.data8[0] = get_sample_rate();
+        BENCH("dispatch_config", BENCH_ITERATIONS, dispatch_can_rx(&frame));
+}
+
+/* Silent loopback, so frames complete without a bus or an ACK */
+static const CANConfig g_loopback_cfg = {
+        CAN_MCR_ABOM | CAN_MCR_TXFP | CAN_MCR_NART,
+        CAN_BTR_LBKM | CAN_BTR_SILM | CAN_BTR_SJW(1) |
+        CAN_BTR_TS1(11) | CAN_BTR_TS2(2) | CAN_BTR_BRP(2)
+};
+
+static void _bench_can_tx(void)
+{
+        CANTxFrame frame;
+        CANRxFrame rx;
+        prepare_can_tx_message(&frame, CAN_IDE_EXT, get_can_base_id() + API_BROADCAST_SENSORS);
+
+        canStart(&CAND1, &g_loopback_cfg);
+        BENCH("can_tx_1M", BENCH_CAN_FRAMES,
+              canTransmit(&CAND1, CAN_ANY_MAILBOX, &frame, MS2ST(CAN_TRANSMIT_TIMEOUT));
+              while (canReceive(&CAND1, CAN_ANY_MAILBOX, &rx, TIME_IMMEDIATE) == MSG_OK));
+        canStop(&CAND1);
+}
+
+static void _bench_adc(void)
+{
+        static const char *names[] = {
+                "adc_scan_1p5", "adc_scan_7p5", "adc_scan_13p5", "adc_scan_28p5",
+                "adc_scan_41p5", "adc_scan_55p5", "adc_scan_71p5", "adc_scan_239p5"
+        };
+        adcsample_t samples[ADC_CHANNELS];
+        ADCConversionGroup group = {
+                FALSE,
+                ADC_CHANNELS,
+                NULL,
+                NULL,
+                ADC_CFGR1_RES_12BIT,
+                ADC_TR(0, 0),
+                ADC_SMPR_SMP_1P5,
+                ADC_CHSELR_CHSEL5 | ADC_CHSELR_CHSEL6 | ADC_CHSELR_CHSEL7 | ADC_CHSELR_CHSEL9
+        };
+
+        for (uint32_t smpr = ADC_SMPR_SMP_1P5; smpr <= ADC_SMPR_SMP_239P5; smpr++) {
+                group.smpr = smpr;
+                BENCH(names[smpr], BENCH_ADC_SCANS, adcConvert(&ADCD1, &group, samples, 1));
+        }
+}
+
+static void _bench_util(void)
+{
+        static uint8_t data[BENCH_BUFFER_SIZE];
+        static uint8_t encoded[COBS_ENCODED_MAX(BENCH_BUFFER_SIZE)];
+        for (size_t i = 0; i < sizeof(data); i++)
+                data[i] = i * 7;
+
+        BENCH("crc32_64B", BENCH_ITERATIONS / 10, g_sink = crc32(data, sizeof(data)));
+        BENCH("cobs_64B", BENCH_ITERATIONS / 10, g_sink = cobs_encode(data, sizeof(data), encoded));
+        BENCH("integrity_64B", BENCH_ITERATIONS / 10, g_sink = integrity_crc32(data, sizeof(data)));
+
+        /* a kilobyte of flash, as the image check reads it */
+        size_t length;
+        const uint8_t *image = system_flash_image(&length);
+        BENCH("crc32_1K", BENCH_ITERATIONS / 100, g_sink = crc32(image, 1024));
+        BENCH("integrity_1K", BENCH_ITERATIONS / 100, g_sink = integrity_crc32(image, 1024));
+}
+
+static BSEMAPHORE_DECL(g_ping, true);
+static BSEMAPHORE_DECL(g_pong, true);
+static THD_WORKING_AREA(ping_wa, PING_THREAD_STACK);
+
+static THD_FUNCTION(ping_thread, arg)
+{
+        (void)arg;
+        chRegSetThreadName("bench ping");
+        while (true) {
+                chBSemWait(&g_ping);
+                chBSemSignal(&g_pong);
+        }
+}
+
+static void _bench_kernel(void)
+{
+        static MUTEX_DECL(mutex);
+        static BSEMAPHORE_DECL(bsem, false);
+        static EVENTSOURCE_DECL(event);
+
+        BENCH("lock_unlock", BENCH_ITERATIONS, chSysLock(); chSysUnlock());
+        BENCH("mutex_lock_unlock", BENCH_ITERATIONS, chMtxLock(&mutex); chMtxUnlock(&mutex));
+        BENCH("bsem_signal_wait", BENCH_ITERATIONS, chBSemSignal(&bsem); chBSemWait(&bsem));
+        BENCH("evt_broadcast", BENCH_ITERATIONS, chEvtBroadcast(&event));
+        BENCH("vt_get_time", BENCH_ITERATIONS, g_sink = chVTGetSystemTime());
+        /* two context switches per round trip through the ping thread */
+        BENCH("ctx_switch_x2", BENCH_ITERATIONS, chBSemSignal(&g_ping); chBSemWait(&g_pong));
+}
+
+int main(void)
+{
+        system_timer_init();
+        halInit();
+        chSysInit();
+
+        system_serial_init();
+        system_adc_init();
+        integrity_init();
+        chThdCreateStatic(ping_wa, sizeof(ping_wa), HIGHPRIO, ping_thread, NULL);
+        chThdSetPriority(HIGHPRIO - 1);
+
+        while (true) {
+                chprintf(g_out, "BENCH,begin,%u.%u.%u,%u\r\n", MAJOR_VER, MINOR_VER, PATCH_VER, STM32_HCLK);
+                _calibrate();
+                _bench_sample_path();
+                _bench_dispatch();
+                _bench_util();
+                _bench_kernel();
+                _bench_adc();
+                _bench_can_tx();
+                chprintf(g_out, "BENCH,end\r\n");
+                chThdSleepMilliseconds(BENCH_PERIOD_MS);
+        }
+        return 0;
+}
@@ -0,0 +1,110 @@
+/*
+ * AnalogX firmware
+ *
+ * Copyright (C) 2017 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Boot timeline instrumentation.
+ *
+ * Phase timestamps are in microseconds since main() was entered, which is
+ * the first point after __early_init() has brought up the clocks. Until the
+ * kernel's system timer starts at the end of halInit() we time with the
+ * SysTick cycle counter; after that system time is added to the HAL ready
+ * timestamp, at CH_CFG_ST_FREQUENCY resolution.
+ */
+
+#include "boot_timeline.h"
+#include "analogx_api.h"
+#include "logging.h"
+#include "settings.h"
+#include "system_CAN.h"
+#include "system_timer.h"
+
+#define _LOG_PFX "BOOT:        "
+
+#define US_PER_SYSTEM_TICK      (1000000 / CH_CFG_ST_FREQUENCY)
+
+static uint32_t g_phase_us[BOOT_PHASE_COUNT];
+static bool g_phase_recorded[BOOT_PHASE_COUNT];
+static bool g_reported = false;
+
+static const char * const g_phase_names[BOOT_PHASE_COUNT] = {
+        "clock ready",
+        "HAL ready",
+        "CAN ready",
+        "first conversion",
+        "first TX"
+};
+
+/* Record the first occurrence of a boot phase; later calls are ignored */
+void boot_timeline_mark(enum boot_phase phase)
+{
+        if (phase >= BOOT_PHASE_COUNT || g_phase_recorded[phase])
+                return;
+
+        if (phase <= BOOT_PHASE_HAL_READY) {
+                g_phase_us[phase] = system_timer_cycles_to_us(system_timer_cycles());
+        } else {
+                g_phase_us[phase] = g_phase_us[BOOT_PHASE_HAL_READY] +
+                                    chVTGetSystemTimeX() * US_PER_SYSTEM_TICK;
+        }
+        g_phase_recorded[phase] = true;
+}
+
+uint32_t boot_timeline_get_us(enum boot_phase phase)
+{
+        return phase < BOOT_PHASE_COUNT ? g_phase_us[phase] : 0;
+}
+
+/* Convert to the 100us units used on the wire, saturating at 16 bits */
+static uint16_t _to_wire_units(uint32_t us)
+{
+        uint32_t units = us / 100;
+        return units > UINT16_MAX ? UINT16_MAX : units;
+}
+
+/*
+ * Report the boot timeline over serial and CAN, once all phases
+ * have been recorded. Subsequent calls do nothing.
+ */
+void boot_timeline_report(void)
+{
+        if (g_reported || !g_phase_recorded[BOOT_PHASE_FIRST_TX])
+                return;
+        g_reported = true;
+
+        for (size_t i = 0; i < BOOT_PHASE_COUNT; i++) {
+                log_info(_LOG_PFX "%s: %u us\r\n", g_phase_names[i], g_phase_us[i]);
+        }
+
+        uint32_t first_frame_ms = g_phase_us[BOOT_PHASE_FIRST_TX] / 1000;
+        if (first_frame_ms > BOOT_FIRST_FRAME_BUDGET_MS) {
+                log_info(_LOG_PFX "First frame after %u ms exceeds budget of %u ms\r\n",
+                         first_frame_ms, BOOT_FIRST_FRAME_BUDGET_MS);
+        }
+
+        CANTxFrame boot_timeline;
+        prepare_can_tx_message(&boot_timeline, CAN_IDE_EXT, get_can_base_id() + API_BOOT_TIMELINE);
+        boot_timeline.data16[0] = _to_wire_units(g_phase_us[BOOT_PHASE_HAL_READY]);
+        boot_timeline.data16[1] = _to_wire_units(g_phase_us[BOOT_PHASE_CAN_READY]);
+        boot_timeline.data16[2] = _to_wire_units(g_phase_us[BOOT_PHASE_FIRST_CONVERSION]);
+        boot_timeline.data16[3] = _to_wire_units(g_phase_us[BOOT_PHASE_FIRST_TX]);
+        boot_timeline.DLC = 8;
+        canTransmit(&CAND1, CAN_ANY_MAILBOX, &boot_timeline, MS2ST(CAN_TRANSMIT_TIMEOUT));
+}
@@ -0,0 +1,40 @@
+/*
+ * AnalogX firmware
+ *
+ * Copyright (C) 2017 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BOOT_TIMELINE_H_
+#define BOOT_TIMELINE_H_
+#include <stdbool.h>
+#include <stdint.h>
+
+enum boot_phase {
+        BOOT_PHASE_CLOCK_READY,
+        BOOT_PHASE_HAL_READY,
+        BOOT_PHASE_CAN_READY,
+        BOOT_PHASE_FIRST_CONVERSION,
+        BOOT_PHASE_FIRST_TX,
+        BOOT_PHASE_COUNT
+};
+
+void boot_timeline_mark(enum boot_phase phase);
+uint32_t boot_timeline_get_us(enum boot_phase phase);
+void boot_timeline_report(void);
+
+#endif /* BOOT_TIMELINE_H_ */
@@ -0,0 +1,217 @@
+/*
+ * AnalogX firmware
+ *
+ * Copyright (C) 2017 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Continuous streaming of every scan over CAN, one frame per scan, at a
+ * fixed rate up to what the bus carries.
+ *
+ * TIM1 TRGO starts each scan through the ADC hardware trigger, so the
+ * sample times are as steady as the crystal; the DMA fills the circular
+ * stream buffer and each half is copied here into a queue from the ADC
+ * callback. The queue, CAN_STREAM_QUEUE_DEPTH scans, is lent by the ADC
+ * worker from the buffer it shares between its modes. The worker drains
+ * the queue into all three transmit mailboxes, refilling them as each
+ * frame leaves, so the bus never waits on the software. When the queue
+ * is full, scans are dropped and counted.
+ *
+ * Frames on API_CAN_STREAM_DATA: a 16 bit scan sequence number, counting
+ * dropped scans too, then the four raw 12 bit samples packed into 6
+ * bytes, see acquisition_pack_scan; virtual channels are only in the
+ * sensor frames. Every second API_CAN_STREAM_STATS reports the frames
+ * delivered per second, the scans dropped for lack of bus time, the
+ * frames lost on the bus (not acknowledged; with NART they are not
+ * retried) and the peak queue depth.
+ */
+
+#include "can_stream.h"
+#include "acquisition.h"
+#include "analogx_api.h"
+#include "logging.h"
+#include "settings.h"
+#include "system_CAN.h"
+#include "trace.h"
+
+#define _LOG_PFX "CAN_STREAM:  "
+
+#define CAN_STREAM_TIMER        STM32_TIM1
+#define CAN_STREAM_TIMER_HZ     1000000
+/* Master mode: TRGO on update */
+#define CAN_STREAM_CR2_MMS_UPDATE 2
+/* ARR is 16 bits */
+#define CAN_STREAM_MIN_RATE     (CAN_STREAM_TIMER_HZ / 65536 + 1)
+
+static bool g_enabled;
+static uint32_t g_requested_rate;
+static thread_t *g_thread;
+
+/* Written by the ADC callback at the head, read by the worker at the tail */
+static struct CanStreamScan *g_queue;
+static volatile uint32_t g_head;
+static uint32_t g_tail;
+static uint16_t g_sequence;
+
+/* Statistics of the current window, the first two updated by the callback */
+static uint32_t g_dropped;
+static uint32_t g_peak;
+static uint32_t g_delivered;
+static uint32_t g_lost;
+static systime_t g_window_start;
+static bool g_stats_due;
+
+/* Scans per second the bus carries with its share for the stream */
+static uint32_t _bus_rate(void)
+{
+        return get_can_bitrate() / 100 * CAN_STREAM_BUS_SHARE_PERCENT / CAN_STREAM_FRAME_BITS;
+}
+
+static uint32_t _rate(void)
+{
+        uint32_t rate = g_requested_rate ? g_requested_rate : _bus_rate();
+        if (rate < CAN_STREAM_MIN_RATE)
+                return CAN_STREAM_MIN_RATE;
+        return rate > CAN_STREAM_MAX_RATE ? CAN_STREAM_MAX_RATE : rate;
+}
+
+/*
+ * Select the mode from CAN: data8[0] turns the stream on (1) or off (0),
+ * data16[1] is the rate in scans/s; 0 or absent takes
+ * CAN_STREAM_BUS_SHARE_PERCENT of the bus.
+ */
+void can_stream_configure(CANRxFrame *rx_msg)
+{
+        if (rx_msg->data8[0] > 1) {
+                log_info(_LOG_PFX "Invalid params for set CAN stream\r\n");
+                return;
+        }
+        g_requested_rate = rx_msg->DLC >= 4 ? rx_msg->data16[1] : 0;
+        g_enabled = rx_msg->data8[0];
+        log_info(_LOG_PFX "%s, %u scans/s\r\n", g_enabled ? "on" : "off", _rate());
+}
+
+bool can_stream_enabled(void)
+{
+        return g_enabled;
+}
+
+/* Start the trigger timer, queueing into queue until can_stream_stop();
+ * called from the ADC worker, which the queue signals */
+void can_stream_start(struct CanStreamScan *queue)
+{
+        g_thread = chThdGetSelfX();
+        g_queue = queue;
+        g_head = g_tail = 0;
+        g_dropped = g_peak = g_delivered = g_lost = 0;
+        g_stats_due = false;
+        g_window_start = chVTGetSystemTime();
+
+        rccEnableTIM1(FALSE);
+        rccResetTIM1();
+        CAN_STREAM_TIMER->PSC = STM32_TIMCLK1 / CAN_STREAM_TIMER_HZ - 1;
+        CAN_STREAM_TIMER->ARR = CAN_STREAM_TIMER_HZ / _rate() - 1;
+        CAN_STREAM_TIMER->CR2 = STM32_TIM_CR2_MMS(CAN_STREAM_CR2_MMS_UPDATE);
+        CAN_STREAM_TIMER->EGR = STM32_TIM_EGR_UG;
+        CAN_STREAM_TIMER->CR1 = STM32_TIM_CR1_CEN;
+}
+
+void can_stream_stop(void)
+{
+        CAN_STREAM_TIMER->CR1 = 0;
+        rccDisableTIM1(FALSE);
+}
+
+/* Queue a block of scans in conversion order; called from the ADC callback */
+void can_stream_push_i(const adcsample_t *buffer, size_t n)
+{
+        uint32_t head = g_head;
+        for (size_t i = 0; i < n; i++, g_sequence++) {
+                if (head - g_tail == CAN_STREAM_QUEUE_DEPTH) {
+                        g_dropped++;
+                        continue;
+                }
+                struct CanStreamScan *scan = &g_queue[head % CAN_STREAM_QUEUE_DEPTH];
+                scan->sequence = g_sequence;
+                acquisition_remap_scan(buffer + i * ADC_CHANNELS, scan->samples);
+                head++;
+        }
+        g_head = head;
+        if (head - g_tail > g_peak)
+                g_peak = head - g_tail;
+        chEvtSignalI(g_thread, CAN_STREAM_EVENT);
+}
+
+static bool _send_stats(void)
+{
+        systime_t elapsed = chVTTimeElapsedSinceX(g_window_start);
+
+        chSysLock();
+        uint32_t dropped = g_dropped;
+        uint32_t peak = g_peak;
+        chSysUnlock();
+
+        CANTxFrame frame;
+        prepare_can_tx_message(&frame, CAN_IDE_EXT, get_can_base_id() + API_CAN_STREAM_STATS);
+        frame.data16[0] = (uint64_t)g_delivered * CH_CFG_ST_FREQUENCY / elapsed;
+        frame.data16[1] = dropped > UINT16_MAX ? UINT16_MAX : dropped;
+        frame.data16[2] = g_lost > UINT16_MAX ? UINT16_MAX : g_lost;
+        frame.data16[3] = peak;
+        if (canTransmit(&CAND1, CAN_ANY_MAILBOX, &frame, TIME_IMMEDIATE) != MSG_OK)
+                return false;
+
+        log_debug(_LOG_PFX "%u frames/s, %u dropped, %u lost, queue peak %u\r\n",
+                  frame.data16[0], frame.data16[1], frame.data16[2], frame.data16[3]);
+        chSysLock();
+        g_dropped = 0;
+        g_peak = g_head - g_tail;
+        chSysUnlock();
+        g_delivered = 0;
+        g_lost = 0;
+        g_window_start = chVTGetSystemTimeX();
+        return true;
+}
+
+/*
+ * Account for the frames that left since the last call, given the flags
+ * of the transmit empty event (errors in the upper half), then fill every
+ * free mailbox from the queue. A mailbox empties only once between calls,
+ * as nothing else refills it that fast, so the flags count the frames.
+ */
+void can_stream_feed(eventflags_t tx_flags)
+{
+        g_delivered += __builtin_popcount(tx_flags & 0xFFFF);
+        g_lost += __builtin_popcount(tx_flags >> 16);
+
+        /* the statistics take the first free mailbox */
+        if (chVTTimeElapsedSinceX(g_window_start) >= S2ST(1))
+                g_stats_due = true;
+        if (g_stats_due && _send_stats())
+                g_stats_due = false;
+
+        while (g_head != g_tail) {
+                const struct CanStreamScan *scan = &g_queue[g_tail % CAN_STREAM_QUEUE_DEPTH];
+                CANTxFrame frame;
+                prepare_can_tx_message(&frame, CAN_IDE_EXT, get_can_base_id() + API_CAN_STREAM_DATA);
+                acquisition_pack_scan(scan->samples, scan->sequence, frame.data8);
+                if (canTransmit(&CAND1, CAN_ANY_MAILBOX, &frame, TIME_IMMEDIATE) != MSG_OK)
+                        break;
+                g_tail++;
+        }
+        trace_mark(TRACE_MARK_STREAM_FEED, g_head - g_tail);
+}
@@ -0,0 +1,44 @@
+/*
+ * AnalogX firmware
+ *
+ * Copyright (C) 2017 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CAN_STREAM_H_
+#define CAN_STREAM_H_
+#include "ch.h"
+#include "hal.h"
+#include "acquisition.h"
+
+/* Signalled to the ADC worker as scans are queued */
+#define CAN_STREAM_EVENT        EVENT_MASK(1)
+
+void can_stream_configure(CANRxFrame *rx_msg);
+bool can_stream_enabled(void);
+/* A queued scan; the queue is lent by the ADC worker, see can_stream_start */
+struct CanStreamScan {
+        uint16_t sequence;
+        adcsample_t samples[ADC_CHANNELS];
+};
+
+void can_stream_start(struct CanStreamScan *queue);
+void can_stream_stop(void);
+void can_stream_push_i(const adcsample_t *buffer, size_t n);
+void can_stream_feed(eventflags_t tx_flags);
+
+#endif /* CAN_STREAM_H_ */
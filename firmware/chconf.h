@@ -131,6 +131,11 @@
  */
 /*===========================================================================*/
 
+/*
+ * Only what the application uses is enabled: semaphores, mutexes, events
+ * and queues. There is no dynamic allocation, threads are static.
+ */
+
 /**
  * @brief   Time Measurement APIs.
  * @details If enabled then the time measurement APIs are included in
@@ -155,7 +160,7 @@
  *
  * @note    The default is @p TRUE.
  */
-#define CH_CFG_USE_WAITEXIT                 TRUE
+#define CH_CFG_USE_WAITEXIT                 FALSE
 
 /**
  * @brief   Semaphores APIs.
@@ -202,7 +207,7 @@
  * @note    The default is @p TRUE.
  * @note    Requires @p CH_CFG_USE_MUTEXES.
  */
-#define CH_CFG_USE_CONDVARS                 TRUE
+#define CH_CFG_USE_CONDVARS                 FALSE
 
 /**
  * @brief   Conditional Variables APIs with timeout.
@@ -239,7 +244,7 @@
  *
  * @note    The default is @p TRUE.
  */
-#define CH_CFG_USE_MESSAGES                 TRUE
+#define CH_CFG_USE_MESSAGES                 FALSE
 
 /**
  * @brief   Synchronous Messages queuing mode.
@@ -260,7 +265,7 @@
  * @note    The default is @p TRUE.
  * @note    Requires @p CH_CFG_USE_SEMAPHORES.
  */
-#define CH_CFG_USE_MAILBOXES                TRUE
+#define CH_CFG_USE_MAILBOXES                FALSE
 
 /**
  * @brief   I/O Queues APIs.
@@ -277,7 +282,7 @@
  *
  * @note    The default is @p TRUE.
  */
-#define CH_CFG_USE_MEMCORE                  TRUE
+#define CH_CFG_USE_MEMCORE                  FALSE
 
 /**
  * @brief   Heap Allocator APIs.
@@ -289,7 +294,7 @@
  *          @p CH_CFG_USE_SEMAPHORES.
  * @note    Mutexes are recommended.
  */
-#define CH_CFG_USE_HEAP                     TRUE
+#define CH_CFG_USE_HEAP                     FALSE
 
 /**
  * @brief   Memory Pools Allocator APIs.
@@ -298,7 +303,7 @@
  *
  * @note    The default is @p TRUE.
  */
-#define CH_CFG_USE_MEMPOOLS                 TRUE
+#define CH_CFG_USE_MEMPOOLS                 FALSE
 
 /**
  * @brief   Dynamic Threads APIs.
@@ -309,7 +314,7 @@
  * @note    Requires @p CH_CFG_USE_WAITEXIT.
  * @note    Requires @p CH_CFG_USE_HEAP and/or @p CH_CFG_USE_MEMPOOLS.
  */
-#define CH_CFG_USE_DYNAMIC                  TRUE
+#define CH_CFG_USE_DYNAMIC                  FALSE
 
 /** @} */
 
@@ -384,7 +389,7 @@
  *
  * @note    The default is @p FALSE.
  */
-#define CH_DBG_FILL_THREADS                 FALSE
+#define CH_DBG_FILL_THREADS                 TRUE
 
 /**
  * @brief   Debug option, threads profiling.
@@ -411,7 +416,8 @@
  * @details User fields added to the end of the @p thread_t structure.
  */
 #define CH_CFG_THREAD_EXTRA_FIELDS                                          \
-  /* Add threads custom fields here.*/
+  /* CPU cycles consumed, see runtime_stats.c */                            \
+  uint32_t cpu_cycles;
 
 /**
  * @brief   Threads initialization hook.
@@ -421,7 +427,7 @@
  *          the threads creation APIs.
  */
 #define CH_CFG_THREAD_INIT_HOOK(tp) {                                       \
-  /* Add threads initialization code here.*/                                \
+  runtime_stats_thread_init(tp);                                            \
 }
 
 /**
@@ -441,7 +447,7 @@
  * @details This hook is invoked just before switching between threads.
  */
 #define CH_CFG_CONTEXT_SWITCH_HOOK(ntp, otp) {                              \
-  /* Context switch code here.*/                                            \
+  runtime_stats_context_switch(ntp, otp);                                   \
 }
 
 /**
@@ -451,6 +457,7 @@
  * @note    This macro can be used to activate a power saving mode.
  */
 #define CH_CFG_IDLE_ENTER_HOOK() {                                          \
+  runtime_stats_idle_enter();                                               \
 }
 
 /**
@@ -460,6 +467,7 @@
  * @note    This macro can be used to deactivate a power saving mode.
  */
 #define CH_CFG_IDLE_LEAVE_HOOK() {                                          \
+  power_idle_leave();                                                       \
 }
 
 /**
@@ -467,7 +475,8 @@
  * @details This hook is continuously invoked by the idle thread loop.
  */
 #define CH_CFG_IDLE_LOOP_HOOK() {                                           \
-  /* Idle loop code here.*/                                                 \
+  runtime_stats_idle_loop();                                                \
+  power_idle();                                                             \
 }
 
 /**
@@ -490,6 +499,20 @@
 
 /** @} */
 
+/*===========================================================================*/
+/* Application hook functions, see runtime_stats.h and power.h.              */
+/*===========================================================================*/
+
+#if !defined(_FROM_ASM_)
+struct ch_thread;
+void runtime_stats_thread_init(struct ch_thread *tp);
+void runtime_stats_context_switch(struct ch_thread *ntp, struct ch_thread *otp);
+void runtime_stats_idle_enter(void);
+void runtime_stats_idle_loop(void);
+void power_idle(void);
+void power_idle_leave(void);
+#endif
+
 /*===========================================================================*/
 /* Port-specific settings (override port settings defaulted in chcore.h).    */
 /*===========================================================================*/
@@ -0,0 +1,196 @@
+/*
+ * AnalogX firmware
+ *
+ * Copyright (C) 2017 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Wear-levelled configuration storage.
+ *
+ * Records are appended one after another into the active flash page;
+ * once it is full the other page is erased and becomes the active one.
+ * The newest record (highest sequence number) with a valid CRC wins,
+ * so a record torn by a power loss simply falls back to the previous one.
+ */
+
+#include "config_store.h"
+#include "ch.h"
+#include "system_flash.h"
+#include "integrity.h"
+#include "logging.h"
+#include <string.h>
+
+#define _LOG_PFX "CFG:         "
+
+#define CONFIG_RECORD_MAGIC     0xA5C0
+#define CONFIG_ERASED_MAGIC     0xFFFF
+#define CONFIG_PAGE_SIZE        SYSTEM_FLASH_PAGE_SIZE
+#define CONFIG_PAGES            SYSTEM_FLASH_CONFIG_PAGES
+
+#define ALIGN4(x)               (((x) + 3) & ~3)
+
+struct ConfigRecordHeader {
+        uint16_t magic;
+        uint16_t version;
+        uint16_t length;
+        uint16_t reserved;
+        uint32_t sequence;
+};
+
+/* header, payload padded to 4 bytes, then CRC32 over both; the padding
+ * is left erased */
+#define CONFIG_RECORD_SIZE(len) (sizeof(struct ConfigRecordHeader) + ALIGN4(len) + sizeof(uint32_t))
+
+static uint32_t g_active_page = 0;
+static uint32_t g_write_offset = CONFIG_PAGE_SIZE;
+static uint32_t g_sequence = 0;
+/* Saves come from more than one thread; the write position and the
+ * sequence are theirs in turn */
+static MUTEX_DECL(g_save_lock);
+
+static const struct ConfigRecordHeader * _record_at(uint32_t page, uint32_t offset)
+{
+        return (const struct ConfigRecordHeader *)(system_flash_config_area() + page * CONFIG_PAGE_SIZE + offset);
+}
+
+/*
+ * Walk the records in a page. Returns the offset of the first free slot,
+ * or CONFIG_PAGE_SIZE if nothing more can be appended. The newest valid
+ * record found in the page is returned through newest.
+ */
+static uint32_t _scan_page(uint32_t page, const struct ConfigRecordHeader **newest)
+{
+        uint32_t offset = 0;
+        *newest = NULL;
+
+        while (offset + sizeof(struct ConfigRecordHeader) <= CONFIG_PAGE_SIZE) {
+                const struct ConfigRecordHeader *header = _record_at(page, offset);
+
+                if (header->magic == CONFIG_ERASED_MAGIC)
+                        return offset;
+
+                uint32_t record_size = CONFIG_RECORD_SIZE(header->length);
+                if (header->magic != CONFIG_RECORD_MAGIC ||
+                    header->length > CONFIG_STORE_MAX_PAYLOAD ||
+                    offset + record_size > CONFIG_PAGE_SIZE)
+                        break;
+
+                const uint8_t *record = (const uint8_t *)header;
+                uint32_t stored_crc;
+                memcpy(&stored_crc, record + record_size - sizeof(uint32_t), sizeof(stored_crc));
+                if (integrity_crc32(record, record_size - sizeof(uint32_t)) != stored_crc)
+                        break;
+
+                if (*newest == NULL || header->sequence > (*newest)->sequence)
+                        *newest = header;
+                offset += record_size;
+        }
+        /* full, or holds a torn record we must not append after */
+        return CONFIG_PAGE_SIZE;
+}
+
+/*
+ * Locate the newest configuration record and copy its payload.
+ * Only min(stored length, length) bytes are copied; fields appended
+ * by newer firmware are left at whatever defaults the caller set.
+ */
+bool config_store_load(uint16_t *version, void *payload, uint16_t length)
+{
+        const struct ConfigRecordHeader *newest = NULL;
+
+        for (uint32_t page = 0; page < CONFIG_PAGES; page++) {
+                const struct ConfigRecordHeader *candidate;
+                uint32_t free_offset = _scan_page(page, &candidate);
+                if (candidate && (!newest || candidate->sequence > newest->sequence)) {
+                        newest = candidate;
+                        g_active_page = page;
+                        g_write_offset = free_offset;
+                }
+        }
+
+        if (!newest) {
+                log_info(_LOG_PFX "No stored configuration\r\n");
+                return false;
+        }
+
+        g_sequence = newest->sequence;
+        *version = newest->version;
+        memcpy(payload, newest + 1, newest->length < length ? newest->length : length);
+        log_info(_LOG_PFX "Loaded configuration v%u (seq %u)\r\n", newest->version, newest->sequence);
+        return true;
+}
+
+/*
+ * Program a record at offset straight from the header and the payload,
+ * without a copy in RAM: the CRC goes last, computed over the record as
+ * read back from flash.
+ */
+static bool _program_record(uint32_t offset, const struct ConfigRecordHeader *header, const void *payload)
+{
+        uint32_t record_size = CONFIG_RECORD_SIZE(header->length);
+        uint16_t even = header->length & ~1;
+
+        if (!system_flash_program_config(offset, header, sizeof(*header)) ||
+            !system_flash_program_config(offset + sizeof(*header), payload, even))
+                return false;
+        if (header->length & 1) {
+                uint16_t last = ((const uint8_t *)payload)[even];
+                if (!system_flash_program_config(offset + sizeof(*header) + even, &last, sizeof(last)))
+                        return false;
+        }
+
+        uint32_t crc = integrity_crc32(system_flash_config_area() + offset, record_size - sizeof(uint32_t));
+        return system_flash_program_config(offset + record_size - sizeof(uint32_t), &crc, sizeof(crc));
+}
+
+/* The payload must be half-word aligned, flash is programmed by half-words */
+bool config_store_save(uint16_t version, const void *payload, uint16_t length)
+{
+        if (length > CONFIG_STORE_MAX_PAYLOAD)
+                return false;
+
+        chMtxLock(&g_save_lock);
+        uint32_t record_size = CONFIG_RECORD_SIZE(length);
+        struct ConfigRecordHeader header = {
+                CONFIG_RECORD_MAGIC, version, length, 0, g_sequence + 1
+        };
+
+        /* Try the active page, then fall back to a freshly erased one */
+        for (uint32_t attempt = 0; attempt < CONFIG_PAGES; attempt++) {
+                if (g_write_offset + record_size > CONFIG_PAGE_SIZE) {
+                        g_active_page = (g_active_page + 1) % CONFIG_PAGES;
+                        g_write_offset = 0;
+                        if (!system_flash_erase_config_page(g_active_page)) {
+                                g_write_offset = CONFIG_PAGE_SIZE;
+                                continue;
+                        }
+                }
+                uint32_t offset = g_active_page * CONFIG_PAGE_SIZE + g_write_offset;
+                bool success = _program_record(offset, &header, payload);
+                g_write_offset = success ? g_write_offset + record_size : CONFIG_PAGE_SIZE;
+                if (success) {
+                        g_sequence = header.sequence;
+                        log_info(_LOG_PFX "Saved configuration (seq %u)\r\n", g_sequence);
+                        chMtxUnlock(&g_save_lock);
+                        return true;
+                }
+        }
+        chMtxUnlock(&g_save_lock);
+        log_info(_LOG_PFX "Failed to save configuration\r\n");
+        return false;
+}
@@ -0,0 +1,33 @@
+/*
+ * AnalogX firmware
+ *
+ * Copyright (C) 2017 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CONFIG_STORE_H_
+#define CONFIG_STORE_H_
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Largest configuration payload that can be persisted */
+#define CONFIG_STORE_MAX_PAYLOAD        128
+
+bool config_store_load(uint16_t *version, void *payload, uint16_t length);
+bool config_store_save(uint16_t version, const void *payload, uint16_t length);
+
+#endif /* CONFIG_STORE_H_ */
@@ -0,0 +1,144 @@
+/*
+ * AnalogX firmware
+ *
+ * Copyright (C) 2017 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Integrity checks: the CRC-32 of configuration records, telemetry
+ * frames and the firmware image, all the standard (zlib) CRC-32.
+ *
+ * With INTEGRITY_HW_CRC the CRC unit computes it. Its polynomial is
+ * fixed at the CRC-32 one, processed MSB first, so input is bit reversed
+ * per write (by byte for the unaligned ends, by word for the rest) and
+ * so is the output. Blocks of INTEGRITY_DMA_MIN_BYTES or more are fed by
+ * a memory to memory DMA at the lowest priority while the caller sleeps:
+ * the ADC DMA goes first and the CPU is free for the other threads.
+ * Without the unit (host builds) util/crc32 does it in software.
+ */
+
+#include "integrity.h"
+#include "analogx_api.h"
+#include "settings.h"
+#include "system_CAN.h"
+#include "system_flash.h"
+#include "crc32.h"
+
+#if INTEGRITY_HW_CRC
+#define INTEGRITY_DMA           STM32_DMA_STREAM(INTEGRITY_DMA_STREAM)
+#define CR_BYTES                (CRC_CR_REV_IN_0 | CRC_CR_REV_OUT)
+#define CR_WORDS                (CRC_CR_REV_IN | CRC_CR_REV_OUT)
+/* CNDTR is 16 bits */
+#define DMA_MAX_WORDS           0xFFFF
+
+static MUTEX_DECL(g_crc_lock);
+static BSEMAPHORE_DECL(g_dma_done, true);
+static bool g_dma_ready;
+
+static void _dma_done(void *p, uint32_t flags)
+{
+        (void)p;
+        if (flags & STM32_DMA_ISR_TEIF)
+                osalSysHalt("DMA failure");
+        chSysLockFromISR();
+        chBSemSignalI(&g_dma_done);
+        chSysUnlockFromISR();
+}
+
+static void _feed_bytes(const uint8_t *bytes, size_t count)
+{
+        CRC->CR = CR_BYTES;
+        while (count--)
+                *(volatile uint8_t *)&CRC->DR = *bytes++;
+}
+
+static void _feed_words(const uint32_t *words, size_t count)
+{
+        CRC->CR = CR_WORDS;
+        if (!g_dma_ready || count < INTEGRITY_DMA_MIN_BYTES / sizeof(uint32_t)) {
+                while (count--)
+                        CRC->DR = *words++;
+                return;
+        }
+        while (count) {
+                size_t chunk = count > DMA_MAX_WORDS ? DMA_MAX_WORDS : count;
+                dmaStreamSetPeripheral(INTEGRITY_DMA, &CRC->DR);
+                dmaStreamSetMemory0(INTEGRITY_DMA, words);
+                dmaStreamSetTransactionSize(INTEGRITY_DMA, chunk);
+                dmaStreamSetMode(INTEGRITY_DMA, DMA_CCR_MEM2MEM | STM32_DMA_CR_DIR_M2P | STM32_DMA_CR_MINC |
+                                 STM32_DMA_CR_PSIZE_WORD | STM32_DMA_CR_MSIZE_WORD | STM32_DMA_CR_PL(0) |
+                                 STM32_DMA_CR_TCIE | STM32_DMA_CR_TEIE);
+                dmaStreamEnable(INTEGRITY_DMA);
+                chBSemWait(&g_dma_done);
+                dmaStreamDisable(INTEGRITY_DMA);
+                words += chunk;
+                count -= chunk;
+        }
+}
+#endif
+
+void integrity_init(void)
+{
+#if INTEGRITY_HW_CRC
+        rccEnableCRC(FALSE);
+        /* should another driver hold the stream, the CPU feeds the unit */
+        g_dma_ready = !dmaStreamAllocate(INTEGRITY_DMA, INTEGRITY_DMA_IRQ_PRIORITY, _dma_done, NULL);
+#endif
+}
+
+/* Standard CRC-32 of a block of memory, RAM or flash */
+uint32_t integrity_crc32(const void *data, size_t len)
+{
+#if INTEGRITY_HW_CRC
+        const uint8_t *bytes = data;
+        size_t head = -(uintptr_t)bytes & 3;
+        if (head > len)
+                head = len;
+        size_t words = (len - head) / sizeof(uint32_t);
+
+        chMtxLock(&g_crc_lock);
+        CRC->INIT = 0xFFFFFFFF;
+        CRC->CR = CR_BYTES | CRC_CR_RESET;
+        _feed_bytes(bytes, head);
+        _feed_words((const uint32_t *)(bytes + head), words);
+        _feed_bytes(bytes + head + words * sizeof(uint32_t), (len - head) % sizeof(uint32_t));
+        uint32_t crc = ~CRC->DR;
+        chMtxUnlock(&g_crc_lock);
+        return crc;
+#else
+        return crc32(data, len);
+#endif
+}
+
+/*
+ * Report the CRC-32 of the running firmware image on API_IMAGE_CRC:
+ * data32[0] the CRC, data32[1] the length; they match the zlib CRC-32
+ * and size of the .bin file it was programmed from.
+ */
+void integrity_report_image(CANRxFrame *rx_msg)
+{
+        (void)rx_msg;
+        size_t length;
+        const uint8_t *image = system_flash_image(&length);
+
+        CANTxFrame frame;
+        prepare_can_tx_message(&frame, CAN_IDE_EXT, get_can_base_id() + API_IMAGE_CRC);
+        frame.data32[0] = integrity_crc32(image, length);
+        frame.data32[1] = length;
+        canTransmit(&CAND1, CAN_ANY_MAILBOX, &frame, MS2ST(CAN_TRANSMIT_TIMEOUT));
+}
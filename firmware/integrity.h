@@ -0,0 +1,31 @@
+/*
+ * AnalogX firmware
+ *
+ * Copyright (C) 2017 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INTEGRITY_H_
+#define INTEGRITY_H_
+#include "ch.h"
+#include "hal.h"
+
+void integrity_init(void);
+uint32_t integrity_crc32(const void *data, size_t len);
+void integrity_report_image(CANRxFrame *rx_msg);
+
+#endif /* INTEGRITY_H_ */
@@ -0,0 +1,197 @@
+/*
+ * AnalogX firmware
+ *
+ * Copyright (C) 2017 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Sample to wire latency probe.
+ *
+ * Timestamps are taken with the SysTick cycle counter when a conversion
+ * completes (ADC ISR), when the sample frame has been queued into a CAN
+ * mailbox and when the mailboxes have drained. Each interval feeds a
+ * histogram with power of two microsecond buckets, alongside exact
+ * min / max / average; p99 is reported as the upper bound of the bucket
+ * it falls in.
+ */
+
+#include "latency_probe.h"
+#include "analogx_api.h"
+#include "logging.h"
+#include "settings.h"
+#include "system_CAN.h"
+#include "system_timer.h"
+#include <string.h>
+
+#define _LOG_PFX "LATENCY:     "
+
+#define LATENCY_BUCKETS                 16
+#define LATENCY_BUCKETS_PER_FRAME       3
+#define LATENCY_RESET_AFTER_REPORT      0x01
+
+/* Report record pages for each interval */
+#define LATENCY_PAGE_SUMMARY            0
+#define LATENCY_PAGE_COUNT              1
+#define LATENCY_PAGE_BUCKETS            2
+
+struct LatencyHistogram {
+        uint32_t count;
+        uint32_t sum_us;
+        uint32_t min_us;
+        uint32_t max_us;
+        uint16_t buckets[LATENCY_BUCKETS];
+};
+
+static struct LatencyHistogram g_histograms[LATENCY_INTERVAL_COUNT];
+static volatile uint32_t g_conversion_cycles;
+static uint32_t g_queued_cycles;
+
+/* Bucket i holds latencies in [2^i, 2^(i+1)) us; bucket 0 also holds 0 */
+static uint8_t _bucket_for(uint32_t us)
+{
+        uint8_t bucket = 0;
+        while (us > 1 && bucket < LATENCY_BUCKETS - 1) {
+                us >>= 1;
+                bucket++;
+        }
+        return bucket;
+}
+
+static void _record(enum latency_interval interval, uint32_t cycles)
+{
+        struct LatencyHistogram *h = &g_histograms[interval];
+        uint32_t us = system_timer_cycles_to_us(cycles);
+
+        if (h->count == 0 || us < h->min_us)
+                h->min_us = us;
+        if (us > h->max_us)
+                h->max_us = us;
+
+        /* Halve the histogram when a bucket fills rather than saturate it,
+         * which would skew the percentiles; the count and sum go with it,
+         * keeping the average */
+        uint8_t bucket = _bucket_for(us);
+        if (h->buckets[bucket] == UINT16_MAX) {
+                for (size_t i = 0; i < LATENCY_BUCKETS; i++)
+                        h->buckets[i] /= 2;
+                h->count /= 2;
+                h->sum_us /= 2;
+        }
+        h->buckets[bucket]++;
+        h->count++;
+        h->sum_us += us;
+}
+
+/* Called from the ADC end of conversion callback */
+void latency_probe_conversion_complete(void)
+{
+        g_conversion_cycles = system_timer_cycles();
+}
+
+void latency_probe_queued(void)
+{
+        g_queued_cycles = system_timer_cycles();
+        _record(LATENCY_CONVERSION_TO_QUEUED, (g_queued_cycles - g_conversion_cycles) & SYSTEM_TIMER_MASK);
+}
+
+void latency_probe_tx_complete(void)
+{
+        uint32_t now = system_timer_cycles();
+        _record(LATENCY_QUEUED_TO_TX_COMPLETE, (now - g_queued_cycles) & SYSTEM_TIMER_MASK);
+        _record(LATENCY_CONVERSION_TO_TX_COMPLETE, (now - g_conversion_cycles) & SYSTEM_TIMER_MASK);
+}
+
+static uint16_t _saturate16(uint32_t value)
+{
+        return value > UINT16_MAX ? UINT16_MAX : value;
+}
+
+/* Upper bound, in us, of the bucket holding the 99th percentile */
+static uint32_t _p99_us(const struct LatencyHistogram *h)
+{
+        uint32_t total = 0;
+        for (size_t i = 0; i < LATENCY_BUCKETS; i++)
+                total += h->buckets[i];
+
+        uint32_t threshold = total - total / 100;
+        uint32_t cumulative = 0;
+        for (size_t i = 0; i < LATENCY_BUCKETS; i++) {
+                cumulative += h->buckets[i];
+                if (cumulative >= threshold && cumulative > 0)
+                        return (2UL << i) - 1;
+        }
+        return 0;
+}
+
+static void _send_page(CANTxFrame *frame, uint8_t interval, uint8_t page)
+{
+        frame->data8[0] = (interval << 4) | page;
+        frame->DLC = 8;
+        canTransmit(&CAND1, CAN_ANY_MAILBOX, frame, MS2ST(CAN_TRANSMIT_TIMEOUT));
+}
+
+/*
+ * Report the histograms in response to API_GET_LATENCY_STATS.
+ * For every interval we send, with byte 0 = (interval << 4) | page:
+ *   page 0: min, average and max in us (data16[1..3])
+ *   page 1: p99 bucket upper bound in us (data16[1]), sample count (data32[1]),
+ *           halved with the buckets each time one of them fills
+ *   page 2+: first bucket index (data8[1]) and three bucket counts
+ * If bit 0 of the request's first byte is set the histograms are reset.
+ */
+void latency_probe_report(CANRxFrame *rx_msg)
+{
+        uint32_t base_id = get_can_base_id() + API_LATENCY_STATS;
+
+        for (uint8_t interval = 0; interval < LATENCY_INTERVAL_COUNT; interval++) {
+                const struct LatencyHistogram *h = &g_histograms[interval];
+                CANTxFrame frame;
+
+                prepare_can_tx_message(&frame, CAN_IDE_EXT, base_id);
+                frame.data16[1] = _saturate16(h->min_us);
+                frame.data16[2] = _saturate16(h->count ? h->sum_us / h->count : 0);
+                frame.data16[3] = _saturate16(h->max_us);
+                _send_page(&frame, interval, LATENCY_PAGE_SUMMARY);
+
+                prepare_can_tx_message(&frame, CAN_IDE_EXT, base_id);
+                frame.data16[1] = _saturate16(_p99_us(h));
+                frame.data32[1] = h->count;
+                _send_page(&frame, interval, LATENCY_PAGE_COUNT);
+
+                uint8_t page = LATENCY_PAGE_BUCKETS;
+                for (uint8_t first = 0; first < LATENCY_BUCKETS; first += LATENCY_BUCKETS_PER_FRAME) {
+                        prepare_can_tx_message(&frame, CAN_IDE_EXT, base_id);
+                        frame.data8[1] = first;
+                        for (uint8_t i = 0; i < LATENCY_BUCKETS_PER_FRAME; i++) {
+                                uint8_t bucket = first + i;
+                                frame.data16[1 + i] = bucket < LATENCY_BUCKETS ? h->buckets[bucket] : 0;
+                        }
+                        _send_page(&frame, interval, page++);
+                }
+
+                log_info(_LOG_PFX "%u: min %u avg %u max %u p99 %u us (%u samples)\r\n",
+                         interval, h->min_us, h->count ? h->sum_us / h->count : 0,
+                         h->max_us, _p99_us(h), h->count);
+        }
+
+        if (rx_msg->DLC >= 1 && (rx_msg->data8[0] & LATENCY_RESET_AFTER_REPORT)) {
+                chSysLock();
+                memset(g_histograms, 0, sizeof(g_histograms));
+                chSysUnlock();
+        }
+}
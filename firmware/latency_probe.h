@@ -0,0 +1,46 @@
+/*
+ * AnalogX firmware
+ *
+ * Copyright (C) 2017 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LATENCY_PROBE_H_
+#define LATENCY_PROBE_H_
+#include "ch.h"
+#include "hal.h"
+
+enum latency_interval {
+        LATENCY_CONVERSION_TO_QUEUED,
+        LATENCY_QUEUED_TO_TX_COMPLETE,
+        LATENCY_CONVERSION_TO_TX_COMPLETE,
+        LATENCY_INTERVAL_COUNT
+};
+
+/* In builds without the probe the hooks compile to nothing */
+#if LATENCY_PROBE_ENABLED
+void latency_probe_conversion_complete(void);
+void latency_probe_queued(void);
+void latency_probe_tx_complete(void);
+void latency_probe_report(CANRxFrame *rx_msg);
+#else
+#define latency_probe_conversion_complete()     ((void)0)
+#define latency_probe_queued()                  ((void)0)
+#define latency_probe_tx_complete()             ((void)0)
+#endif
+
+#endif /* LATENCY_PROBE_H_ */
@@ -19,9 +19,44 @@
  * this code. If not, see <http://www.gnu.org/licenses/>.
  */
 #include "logging.h"
+#include <stdarg.h>
+#include <string.h>
+#if LOG_TOKENIZED
+#include "cobs.h"
+#endif
+#if TELEMETRY_STREAM
+#include "telemetry_stream.h"
+#endif
+
+#define _LOG_PFX "LOG:         "
+
+/* Must be a power of 2 */
+#define LOG_RING_SIZE 16
+#define LOG_RING_MASK (LOG_RING_SIZE - 1)
+#define LOG_DRAIN_STACK 384
+#define LOG_LINE_MAX 96
+
+/* token (2) + timestamp (4) + nargs / flags (1) + 32 bit arguments */
+#define LOG_PACKET_MAX (7 + LOG_MAX_ARGS * 4)
+
+struct LogRecord {
+        const char *format;
+        systime_t timestamp;
+        uint8_t flags;
+        uint8_t nargs;
+        uintptr_t args[LOG_MAX_ARGS];
+};
 
 static enum logging_levels logging_level = logging_level_info;
 
+static struct LogRecord g_log_ring[LOG_RING_SIZE];
+static uint32_t g_log_head = 0;
+static uint32_t g_log_count = 0;
+static uint32_t g_log_dropped = 0;
+static BSEMAPHORE_DECL(g_log_pending, true);
+
+static THD_WORKING_AREA(log_drain_wa, LOG_DRAIN_STACK);
+
 void set_logging_level(enum logging_levels level)
 {
         if (level > logging_level_debug)
@@ -34,25 +69,163 @@ enum logging_levels get_logging_level(void)
         return logging_level;
 }
 
-static void _log_debug_can_frame(uint8_t dlc, uint8_t ide, uint32_t sid, uint32_t eid, uint8_t * data_bytes)
+uint32_t get_logging_dropped(void)
+{
+        return g_log_dropped;
+}
+
+/* Records the ring can take before it drops */
+uint32_t get_logging_free(void)
+{
+        return LOG_RING_SIZE - g_log_count;
+}
+
+/*
+ * Capture a log record; callable from threads and ISRs. When the
+ * ring is full the record is dropped, counted and false returned.
+ */
+bool log_enqueue(uint8_t flags, const char *format, uint8_t nargs, ...)
+{
+        va_list ap;
+        syssts_t sts = chSysGetStatusAndLockX();
+
+        if (g_log_count == LOG_RING_SIZE) {
+                g_log_dropped++;
+                chSysRestoreStatusX(sts);
+                return false;
+        }
+
+        struct LogRecord *record = &g_log_ring[(g_log_head + g_log_count) & LOG_RING_MASK];
+        record->format = format;
+        record->timestamp = chVTGetSystemTimeX();
+        record->flags = flags;
+        record->nargs = nargs > LOG_MAX_ARGS ? LOG_MAX_ARGS : nargs;
+        va_start(ap, nargs);
+        for (size_t i = 0; i < record->nargs; i++)
+                record->args[i] = va_arg(ap, uintptr_t);
+        va_end(ap);
+        g_log_count++;
+
+        chBSemSignalI(&g_log_pending);
+        chSysRestoreStatusX(sts);
+        return true;
+}
+
+static bool _dequeue(struct LogRecord *record)
+{
+        bool available = false;
+        chSysLock();
+        if (g_log_count > 0) {
+                *record = g_log_ring[g_log_head];
+                g_log_head = (g_log_head + 1) & LOG_RING_MASK;
+                g_log_count--;
+                available = true;
+        }
+        chSysUnlock();
+        return available;
+}
+
+#if TELEMETRY_STREAM
+/* USART2 belongs to the telemetry stream; logs travel in its log frames */
+static void _log_output(const void *data, size_t len)
+{
+        telemetry_stream_send(TELEMETRY_FRAME_LOG, data, len);
+}
+#else
+static void _log_output(const void *data, size_t len)
+{
+        sdWrite(&SD2, data, len);
+}
+#endif
+
+#if LOG_TOKENIZED
+static uint8_t *_put_u32(uint8_t *p, uint32_t value)
+{
+        *p++ = value;
+        *p++ = value >> 8;
+        *p++ = value >> 16;
+        *p++ = value >> 24;
+        return p;
+}
+
+/* Send the record as a 0x00 delimited COBS packet, little endian fields */
+static void _write_record(struct LogRecord *record)
+{
+        uint8_t packet[LOG_PACKET_MAX];
+        uint8_t encoded[COBS_ENCODED_MAX(LOG_PACKET_MAX) + 1];
+        uint16_t token = (uintptr_t)record->format;
+        uint8_t *p = packet;
+
+        *p++ = token;
+        *p++ = token >> 8;
+        p = _put_u32(p, ST2MS(record->timestamp));
+        *p++ = record->nargs | (record->flags << 4);
+        for (size_t i = 0; i < record->nargs; i++)
+                p = _put_u32(p, record->args[i]);
+
+        size_t len = cobs_encode(packet, p - packet, encoded);
+        encoded[len++] = 0;
+        _log_output(encoded, len);
+}
+#else
+static void _write_record(struct LogRecord *record)
+{
+        char line[LOG_LINE_MAX];
+        uintptr_t *a = record->args;
+        size_t len = 0;
+
+        if (record->flags & LOG_FLAG_TIMESTAMP) {
+                chsnprintf(line, sizeof(line), "%i ", ST2MS(record->timestamp));
+                len = strlen(line);
+        }
+        /* unused trailing arguments are ignored by the format */
+        chsnprintf(line + len, sizeof(line) - len, record->format, a[0], a[1], a[2], a[3], a[4], a[5]);
+        _log_output(line, strlen(line));
+}
+#endif
+
+/* Format and write out queued records at the lowest priority */
+static THD_FUNCTION(log_drain, arg)
 {
-        uint32_t can_id = ide == CAN_IDE_EXT ? eid : sid;
-        log_debug_b(" ID(%i) ", can_id);
+        (void)arg;
+        chRegSetThreadName("log drain");
+
+        uint32_t dropped_reported = 0;
+        struct LogRecord record;
 
-        size_t i;
-        for (i = 0; i < dlc; i++) {
-                log_debug_b("%02X ", data_bytes[i]);
+        while (true) {
+                chBSemWait(&g_log_pending);
+                while (_dequeue(&record))
+                        _write_record(&record);
+
+                uint32_t dropped = g_log_dropped;
+                if (dropped != dropped_reported) {
+                        record.format = _LOG_FORMAT(_LOG_PFX "%u log records dropped\r\n");
+                        record.timestamp = chVTGetSystemTime();
+                        record.flags = 0;
+                        record.nargs = 1;
+                        record.args[0] = dropped - dropped_reported;
+                        _write_record(&record);
+                        dropped_reported = dropped;
+                }
         }
 }
+
+void logging_init(void)
+{
+        chThdCreateStatic(log_drain_wa, sizeof(log_drain_wa), LOWPRIO, log_drain, NULL);
+}
+
 void log_CAN_rx_message(char* log_pfx, CANRxFrame * can_frame)
 {
         if (get_logging_level() < logging_level_debug)
                 return;
 
-        log_debug(log_pfx);
-        log_debug_b("CAN Rx");
-
-        _log_debug_can_frame(can_frame->DLC, can_frame->IDE, can_frame->SID, can_frame->EID, can_frame->data8);
+        uint32_t can_id = can_frame->IDE == CAN_IDE_EXT ? can_frame->EID : can_frame->SID;
+        uint8_t *d = can_frame->data8;
+        log_debug("%sCAN Rx ID(%i) DLC %u %08X%08X\r\n", log_pfx, can_id, can_frame->DLC,
+                  ((uint32_t)d[0] << 24) | (d[1] << 16) | (d[2] << 8) | d[3],
+                  ((uint32_t)d[4] << 24) | (d[5] << 16) | (d[6] << 8) | d[7]);
 }
 
 
@@ -61,11 +234,14 @@ void log_CAN_tx_message(char *log_pfx, CANTxFrame * can_frame)
         if (get_logging_level() < logging_level_info)
                 return;
 
-        log_info(log_pfx);
-        log_info_b("CAN Tx");
-
-        if (get_logging_level() >= logging_level_debug) {
-                _log_debug_can_frame(can_frame->DLC, can_frame->IDE, can_frame->SID, can_frame->EID, can_frame->data8);
+        if (get_logging_level() < logging_level_debug) {
+                log_info("%sCAN Tx\r\n", log_pfx);
+                return;
         }
-        log_info_b("\r\n");
+
+        uint32_t can_id = can_frame->IDE == CAN_IDE_EXT ? can_frame->EID : can_frame->SID;
+        uint8_t *d = can_frame->data8;
+        log_info("%sCAN Tx ID(%i) DLC %u %08X%08X\r\n", log_pfx, can_id, can_frame->DLC,
+                 ((uint32_t)d[0] << 24) | (d[1] << 16) | (d[2] << 8) | d[3],
+                 ((uint32_t)d[4] << 24) | (d[5] << 16) | (d[6] << 8) | d[7]);
 }
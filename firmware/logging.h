@@ -32,12 +32,53 @@ enum logging_levels {
         logging_level_debug
 };
 
-#define log_info(msg, ...) if (get_logging_level() >= logging_level_info) {chprintf((BaseSequentialStream *)&SD2, "%i ", ST2MS(chVTGetSystemTimeX())); chprintf((BaseSequentialStream *)&SD2, msg, ##__VA_ARGS__);}
-#define log_debug(msg, ...) if (get_logging_level() >= logging_level_debug) {chprintf((BaseSequentialStream *)&SD2, "%i ", ST2MS(chVTGetSystemTimeX())); chprintf((BaseSequentialStream *)&SD2, msg, ##__VA_ARGS__);}
+/*
+ * Log calls only capture the format string, a timestamp and the raw
+ * arguments into a RAM ring buffer; a low priority thread formats them
+ * out on SD2 later. As formatting is deferred, %s arguments must point
+ * at strings that outlive the call, such as literals.
+ */
+#define LOG_MAX_ARGS 6
+#define LOG_FLAG_TIMESTAMP 0x01
+
+/*
+ * Tokenized logging (make USE_LOG_TOKENS=yes): format strings are placed
+ * in the non-loaded .logtokens section and never reach flash. The device
+ * sends COBS framed packets carrying the string's offset in that section
+ * as a 16 bit token, a millisecond timestamp and the raw arguments;
+ * tools/log_dictionary.py extracts the strings from the ELF and
+ * tools/log_decode.py turns the packets back into text.
+ */
+#ifndef LOG_TOKENIZED
+#define LOG_TOKENIZED FALSE
+#endif
+
+#if LOG_TOKENIZED
+#define _LOG_FORMAT(msg) ({ \
+        static const char _log_fmt[] __attribute__((section(".logtokens"), used)) = msg; \
+        _log_fmt; })
+#else
+#define _LOG_FORMAT(msg) (msg)
+#endif
+
+/* Count the variadic arguments, up to LOG_MAX_ARGS */
+#define _LOG_NARGS(...) _LOG_NARGS_(0, ##__VA_ARGS__, 6, 5, 4, 3, 2, 1, 0)
+#define _LOG_NARGS_(_0, _1, _2, _3, _4, _5, _6, n, ...) n
+
+#define log_info(msg, ...) if (get_logging_level() >= logging_level_info) {log_enqueue(LOG_FLAG_TIMESTAMP, _LOG_FORMAT(msg), _LOG_NARGS(__VA_ARGS__), ##__VA_ARGS__);}
+#define log_debug(msg, ...) if (get_logging_level() >= logging_level_debug) {log_enqueue(LOG_FLAG_TIMESTAMP, _LOG_FORMAT(msg), _LOG_NARGS(__VA_ARGS__), ##__VA_ARGS__);}
 
 /* Brief functions */
-#define log_info_b(msg, ...) if (get_logging_level() >= logging_level_info) {chprintf((BaseSequentialStream *)&SD2, msg, ##__VA_ARGS__);}
-#define log_debug_b(msg, ...) if (get_logging_level() >= logging_level_debug) {chprintf((BaseSequentialStream *)&SD2, msg, ##__VA_ARGS__);}
+#define log_info_b(msg, ...) if (get_logging_level() >= logging_level_info) {log_enqueue(0, _LOG_FORMAT(msg), _LOG_NARGS(__VA_ARGS__), ##__VA_ARGS__);}
+#define log_debug_b(msg, ...) if (get_logging_level() >= logging_level_debug) {log_enqueue(0, _LOG_FORMAT(msg), _LOG_NARGS(__VA_ARGS__), ##__VA_ARGS__);}
+
+void logging_init(void);
+
+bool log_enqueue(uint8_t flags, const char *format, uint8_t nargs, ...);
+
+uint32_t get_logging_free(void);
+
+uint32_t get_logging_dropped(void);
 
 void set_logging_level(enum logging_levels level);
 
@@ -26,6 +26,16 @@
 #include "system_serial.h"
 #include "system_CAN.h"
 #include "system_ADC.h"
+#include "analogx_api.h"
+#include "boot_timeline.h"
+#include "system_timer.h"
+#include "power.h"
+#include "totalizer.h"
+#include "integrity.h"
+#include "trace.h"
+#if PULSE_CAPTURE
+#include "pulse_capture.h"
+#endif
 
 #define DEFAULT_STACK 512
 #define STARTUP_DEMO_THREAD_STACK 256
@@ -35,6 +45,9 @@
 #define WATCHDOG_TIMEOUT 11000
 #define WATCHDOG_ENABLED true
 
+/* In fast boot acquisition runs ahead of the CAN receiver */
+#define ADC_WORKER_PRIORITY (FAST_BOOT ? NORMALPRIO + 1 : NORMALPRIO)
+
 /*
  * CAN receiver thread.
  */
@@ -81,8 +94,13 @@ int main(void)
          *   RTOS is active.
          */
 
+        /* Clocks are up by the time we get here; start the boot timeline */
+        system_timer_init();
+        boot_timeline_mark(BOOT_PHASE_CLOCK_READY);
+
         /* ChibiOS initialization */
         halInit();
+        boot_timeline_mark(BOOT_PHASE_HAL_READY);
         chSysInit();
         _start_watchdog();
 
@@ -90,14 +108,25 @@ int main(void)
         system_can_init();
         system_adc_init();
         system_serial_init();
+        logging_init();
+        power_init();
 
         log_info("===AnalogX START (Version %u.%u.%u)===\r\n", MAJOR_VER, MINOR_VER, PATCH_VER);
 
+        integrity_init();
+
+        /* Restore the last known configuration before acquisition starts */
+        api_initialize();
+#if PULSE_CAPTURE
+        pulse_capture_configure(get_channel_modes());
+#endif
+        totalizer_init();
+
         /*
          * Creates the processing threads.
          */
+        chThdCreateStatic(adc_worker_wa, sizeof(adc_worker_wa), ADC_WORKER_PRIORITY, adc_worker, NULL);
         chThdCreateStatic(can_rx_wa, sizeof(can_rx_wa), NORMALPRIO, can_rx, NULL);
-        chThdCreateStatic(adc_worker_wa, sizeof(adc_worker_wa), NORMALPRIO, adc_worker, NULL);
 
         uint32_t stats_check = 0;
         while (true) {
@@ -109,6 +138,12 @@ int main(void)
                 }
                 if (WATCHDOG_ENABLED)
                         wdgReset(&WDGD1);
+                boot_timeline_report();
+                power_check();
+                totalizer_check();
+#if TRACE_ENABLED
+                trace_check();
+#endif
                 check_system_state();
         }
         return 0;
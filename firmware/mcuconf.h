@@ -147,18 +147,65 @@
 #define STM32_PWM_TIM2_IRQ_PRIORITY         3
 #define STM32_PWM_TIM3_IRQ_PRIORITY         3
 
+/*
+ * Telemetry streaming (make USE_UART_STREAM=yes) hands USART2 from the
+ * SERIAL driver over to the DMA driven UART driver.
+ */
+#if !defined(TELEMETRY_STREAM)
+#define TELEMETRY_STREAM                    FALSE
+#endif
+
+/*
+ * TIM3 serves either pulse measurement on the analog pins (pulse_capture.c)
+ * or crank angle synchronous sampling (make USE_ANGLE_SYNC=yes).
+ */
+#if !defined(ANGLE_SYNC)
+#define ANGLE_SYNC                          FALSE
+#endif
+#if !defined(PULSE_CAPTURE)
+#define PULSE_CAPTURE                       (!ANGLE_SYNC)
+#endif
+#define PULSE_CAPTURE_IRQ_PRIORITY          2
+/* Below the ADC DMA, so a wrap is counted before an index capture runs */
+#define ANGLE_SYNC_IRQ_PRIORITY             3
+
+/*
+ * Integrity checks on the CRC unit (integrity.c), fed by DMA1 channel 2;
+ * SPI1, the other user of that channel, is disabled.
+ */
+#if !defined(INTEGRITY_HW_CRC)
+#define INTEGRITY_HW_CRC                    TRUE
+#endif
+#define INTEGRITY_DMA_STREAM                STM32_DMA_STREAM_ID(1, 2)
+#define INTEGRITY_DMA_IRQ_PRIORITY          3
+
+/*
+ * Kernel and application trace (trace.c, make USE_TRACE=yes).
+ */
+#if !defined(TRACE_ENABLED)
+#define TRACE_ENABLED                       FALSE
+#endif
+
+/*
+ * Sample to wire latency probe (latency_probe.c, make USE_LATENCY_PROBE=yes),
+ * a diagnostics build.
+ */
+#if !defined(LATENCY_PROBE_ENABLED)
+#define LATENCY_PROBE_ENABLED               FALSE
+#endif
+
 /*
  * SERIAL driver system settings.
  */
-#define STM32_SERIAL_USE_USART1             TRUE
-#define STM32_SERIAL_USE_USART2             TRUE
+#define STM32_SERIAL_USE_USART1             FALSE
+#define STM32_SERIAL_USE_USART2             (!TELEMETRY_STREAM)
 #define STM32_SERIAL_USART1_PRIORITY        3
 #define STM32_SERIAL_USART2_PRIORITY        3
 
 /*
  * SPI driver system settings.
  */
-#define STM32_SPI_USE_SPI1                  TRUE
+#define STM32_SPI_USE_SPI1                  FALSE
 #define STM32_SPI_SPI1_DMA_PRIORITY         1
 #define STM32_SPI_SPI1_IRQ_PRIORITY         2
 #define STM32_SPI_SPI1_RX_DMA_STREAM        STM32_DMA_STREAM_ID(1, 2)
@@ -175,7 +222,7 @@
  * UART driver system settings.
  */
 #define STM32_UART_USE_USART1               FALSE
-#define STM32_UART_USE_USART2               FALSE
+#define STM32_UART_USE_USART2               TELEMETRY_STREAM
 #define STM32_UART_USART1_IRQ_PRIORITY      3
 #define STM32_UART_USART2_IRQ_PRIORITY      3
 #define STM32_UART_USART1_DMA_PRIORITY      0
@@ -0,0 +1,112 @@
+/*
+ * AnalogX firmware
+ *
+ * Copyright (C) 2017 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Noise self characterization.
+ *
+ * On request the ADC worker captures NOISE_SCAN_DEPTH back to back scans
+ * at each of the eight sample time settings and reports mean, standard
+ * deviation, peak to peak and effective number of bits for every channel.
+ * Comparing the settings shows the fastest sample time that still gives
+ * clean data with the sensors and harness of an installation; comparing
+ * a channel with its input shorted at the connector separates the unit
+ * from the wiring.
+ */
+
+#include "noise_scan.h"
+#include "acquisition.h"
+#include "analogx_api.h"
+#include "logging.h"
+#include "settings.h"
+#include "system_CAN.h"
+
+#define _LOG_PFX "NOISE:       "
+
+#define NOISE_SMPR_SETTINGS     8
+
+static volatile bool g_pending;
+
+static ADCConversionGroup g_noise_group = {
+        FALSE,
+        ADC_CHANNELS,
+        NULL,
+        NULL,
+        ADC_CFGR1_CONT | ADC_CFGR1_RES_12BIT,            /* CFGR1 */
+        ADC_TR(0, 0),                                     /* TR */
+        ADC_SMPR_SMP_1P5,                                 /* SMPR */
+        ADC_CHSELR_CHSEL5 | ADC_CHSELR_CHSEL6 | ADC_CHSELR_CHSEL7 | ADC_CHSELR_CHSEL9
+};
+
+/* API_NOISE_SCAN handler; the scan itself runs in the ADC worker */
+void noise_scan_request(CANRxFrame *rx_msg)
+{
+        (void)rx_msg;
+        g_pending = true;
+}
+
+bool noise_scan_pending(void)
+{
+        return g_pending;
+}
+
+/*
+ * Run the scan and report it on API_NOISE_REPORT, one frame for each
+ * setting and channel:
+ *   data8[0]  SMPR setting, 0..7 = 1.5, 7.5, 13.5, 28.5, 41.5, 55.5,
+ *             71.5 and 239.5 ADC clock cycles
+ *   data8[1]  channel, 0..3
+ *   data16[1] mean in LSB / 16
+ *   data16[2] standard deviation in LSB / 16
+ *   data8[6]  peak to peak in LSB, saturated at 255
+ *   data8[7]  effective number of bits / 16
+ * samples holds NOISE_SCAN_DEPTH scans.
+ */
+void noise_scan_run(adcsample_t *samples)
+{
+        g_pending = false;
+        log_info(_LOG_PFX "scanning %u samples per setting\r\n", NOISE_SCAN_DEPTH);
+
+        for (uint8_t smpr = 0; smpr < NOISE_SMPR_SETTINGS; smpr++) {
+                struct NoiseStats stats[ADC_CHANNELS];
+                g_noise_group.smpr = smpr;
+                if (adcConvert(&ADCD1, &g_noise_group, samples, NOISE_SCAN_DEPTH) != MSG_OK) {
+                        log_info(_LOG_PFX "conversion failed\r\n");
+                        return;
+                }
+                acquisition_noise(samples, NOISE_SCAN_DEPTH, stats);
+
+                for (uint8_t c = 0; c < ADC_CHANNELS; c++) {
+                        const struct NoiseStats *s = &stats[c];
+                        CANTxFrame frame;
+                        prepare_can_tx_message(&frame, CAN_IDE_EXT, get_can_base_id() + API_NOISE_REPORT);
+                        frame.data8[0] = smpr;
+                        frame.data8[1] = c;
+                        frame.data16[1] = s->mean_q4;
+                        frame.data16[2] = s->stddev_q4;
+                        frame.data8[6] = s->peak_to_peak > UINT8_MAX ? UINT8_MAX : s->peak_to_peak;
+                        frame.data8[7] = s->enob_q8 >> 4;
+                        canTransmit(&CAND1, CAN_ANY_MAILBOX, &frame, MS2ST(CAN_TRANSMIT_TIMEOUT));
+
+                        log_info(_LOG_PFX "SMPR %u ch %u: mean %u sd %u/16 p-p %u enob %u/256\r\n",
+                                 smpr, c + 1, s->mean_q4 >> 4, s->stddev_q4, s->peak_to_peak, s->enob_q8);
+                }
+        }
+}
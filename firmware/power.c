@@ -0,0 +1,187 @@
+/*
+ * AnalogX firmware
+ *
+ * Copyright (C) 2017 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Low power operation.
+ *
+ * The idle thread sleeps the core with WFI until the next interrupt,
+ * normally the kernel timer waking the ADC worker or CAN traffic. The
+ * sleep is taken with interrupts masked so its exact length can be
+ * measured before the waking interrupt runs.
+ *
+ * Stop mode is not used: it stops TIM2, which keeps the kernel's time,
+ * and the ADC. Neither is the clock scaled, since the CAN bit timing,
+ * USART baud rates and the kernel timer are all derived from it.
+ *
+ * When nothing on the bus has acknowledged our frames or sent one of
+ * its own for POWER_CAN_IDLE_TIMEOUT_MS (car parked, logger off) the
+ * CAN controller goes to sleep and acquisition pauses. Bus traffic wakes
+ * it again through auto wakeup, and an announcement every
+ * POWER_CAN_PROBE_INTERVAL_MS finds a listener that only acknowledges.
+ */
+
+#include "power.h"
+#include "analogx_api.h"
+#include "logging.h"
+#include "settings.h"
+#include "system_timer.h"
+#include "runtime_stats.h"
+
+#define _LOG_PFX "POWER:       "
+
+#define CYCLES_PER_SYSTEM_TICK  (STM32_HCLK / CH_CFG_ST_FREQUENCY)
+/* Sleeps longer than this are timed in system ticks; the cycle counter wraps */
+#define SLEEP_CYCLES_MAX_TICKS  1000
+#define TX_OK_FLAGS             0x0000FFFF
+
+static event_listener_t g_rx_listener;
+static event_listener_t g_tx_listener;
+
+static uint32_t g_sleep_cycles;
+static uint32_t g_wake_cycles;
+static bool g_woke;
+static uint32_t g_wake_latency_max;
+static systime_t g_window_start;
+
+static bool g_can_asleep;
+static systime_t g_last_activity;
+static systime_t g_can_sleep_start;
+static systime_t g_last_probe;
+static uint32_t g_can_sleep_ms;
+static uint16_t g_can_wakeups;
+
+void power_init(void)
+{
+        chEvtRegisterMaskWithFlags(&CAND1.rxfull_event, &g_rx_listener, 0, ALL_EVENTS);
+        chEvtRegisterMaskWithFlags(&CAND1.txempty_event, &g_tx_listener, 0, ALL_EVENTS);
+        g_last_activity = chVTGetSystemTime();
+        g_window_start = g_last_activity;
+}
+
+/* Idle loop: sleep until an interrupt is pending, then let it run */
+void power_idle(void)
+{
+        if (!POWER_SLEEP_ENABLED)
+                return;
+
+        port_disable();
+        systime_t start_time = chVTGetSystemTimeX();
+        uint32_t start = system_timer_cycles();
+        __WFI();
+        uint32_t slept = system_timer_elapsed(start);
+        systime_t ticks = chVTGetSystemTimeX() - start_time;
+        if (ticks > SLEEP_CYCLES_MAX_TICKS)
+                slept = ticks * CYCLES_PER_SYSTEM_TICK;
+
+        g_sleep_cycles += slept;
+        g_wake_cycles = system_timer_cycles();
+        g_woke = true;
+        /* the sleep is not interrupt time */
+        runtime_stats_idle_enter();
+        port_enable();
+}
+
+/* A thread is about to run after idle; time it from the wake up */
+void power_idle_leave(void)
+{
+        if (!g_woke)
+                return;
+        g_woke = false;
+        uint32_t latency = system_timer_elapsed(g_wake_cycles);
+        if (latency > g_wake_latency_max)
+                g_wake_latency_max = latency;
+}
+
+bool power_can_asleep(void)
+{
+        return g_can_asleep;
+}
+
+static uint32_t _ticks_to_ms(systime_t ticks)
+{
+        return ticks / (CH_CFG_ST_FREQUENCY / 1000);
+}
+
+/* Called periodically from the main thread */
+void power_check(void)
+{
+        systime_t now = chVTGetSystemTime();
+        eventflags_t rx = chEvtGetAndClearFlags(&g_rx_listener);
+        eventflags_t tx = chEvtGetAndClearFlags(&g_tx_listener);
+        bool activity = rx || (tx & TX_OK_FLAGS);
+        if (activity)
+                g_last_activity = now;
+
+        if (!g_can_asleep) {
+                if (chVTTimeElapsedSinceX(g_last_activity) >= MS2ST(POWER_CAN_IDLE_TIMEOUT_MS)) {
+                        log_info(_LOG_PFX "CAN bus idle, sleeping\r\n");
+                        canSleep(&CAND1);
+                        g_can_asleep = true;
+                        g_can_sleep_start = now;
+                        g_last_probe = now;
+                }
+                return;
+        }
+
+        if (activity) {
+                uint32_t slept_ms = _ticks_to_ms(now - g_can_sleep_start);
+                g_can_asleep = false;
+                g_can_sleep_ms += slept_ms;
+                g_can_wakeups++;
+                log_info(_LOG_PFX "CAN awake after %u ms\r\n", slept_ms);
+                return;
+        }
+
+        /* an unanswered probe, or a glitch that woke the controller */
+        if (CAND1.state != CAN_SLEEP) {
+                canSleep(&CAND1);
+                return;
+        }
+
+        if (chVTTimeElapsedSinceX(g_last_probe) >= MS2ST(POWER_CAN_PROBE_INTERVAL_MS)) {
+                /* see whether anyone acknowledges us now */
+                g_last_probe = now;
+                canWakeup(&CAND1);
+                api_send_announcement();
+        }
+}
+
+/* Take the stats for the window since the last call */
+void power_collect(struct PowerStats *stats)
+{
+        systime_t now = chVTGetSystemTime();
+        uint32_t window_cycles = (systime_t)(now - g_window_start) * CYCLES_PER_SYSTEM_TICK;
+        g_window_start = now;
+
+        chSysLock();
+        uint32_t sleep_cycles = g_sleep_cycles;
+        uint32_t latency = g_wake_latency_max;
+        g_sleep_cycles = 0;
+        g_wake_latency_max = 0;
+        chSysUnlock();
+
+        uint32_t divisor = window_cycles / 1000;
+        uint32_t permille = divisor ? sleep_cycles / divisor : 0;
+        stats->sleep_permille = permille > 1000 ? 1000 : permille;
+        stats->wake_latency_max_us = system_timer_cycles_to_us(latency);
+        stats->can_sleep_ms = g_can_sleep_ms + (g_can_asleep ? _ticks_to_ms(now - g_can_sleep_start) : 0);
+        stats->can_wakeups = g_can_wakeups;
+}
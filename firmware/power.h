@@ -0,0 +1,43 @@
+/*
+ * AnalogX firmware
+ *
+ * Copyright (C) 2017 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef POWER_H_
+#define POWER_H_
+#include "ch.h"
+#include "hal.h"
+
+struct PowerStats {
+        uint16_t sleep_permille;        /* WFI residency over the window */
+        uint16_t wake_latency_max_us;   /* WFI wake to a thread running */
+        uint32_t can_sleep_ms;          /* CAN asleep, since boot */
+        uint16_t can_wakeups;           /* since boot */
+};
+
+void power_init(void);
+void power_check(void);
+bool power_can_asleep(void);
+void power_collect(struct PowerStats *stats);
+
+/* Kernel hooks, see chconf.h */
+void power_idle(void);
+void power_idle_leave(void);
+
+#endif /* POWER_H_ */
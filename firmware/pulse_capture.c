@@ -0,0 +1,297 @@
+/*
+ * AnalogX firmware
+ *
+ * Copyright (C) 2017 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Pulse inputs: frequency, period and duty cycle measured with TIM3 input
+ * capture on the analog pins that have a TIM3 channel (analog 1..3 on
+ * PB1, PA7 and PA6; PA5 is on TIM2, which keeps the kernel's time).
+ *
+ * TIM3 counts microseconds. Each broadcast arms a channel for a single
+ * cycle: a rising edge, the falling edge and the next rising edge, after
+ * which its capture interrupt is disabled until the following broadcast.
+ * That is at most three interrupts per channel and broadcast, whatever
+ * the pulse rate. Counter wraps are resolved with the kernel time taken
+ * at each capture, so there is no update interrupt either. The edge to
+ * capture is switched in the interrupt, so high and low times must be
+ * longer than its latency, a few microseconds.
+ */
+
+#include "pulse_capture.h"
+#include "logging.h"
+#include "settings.h"
+#include <string.h>
+
+#define _LOG_PFX "PULSE:       "
+
+#define PULSE_TIMER             STM32_TIM3
+#define PULSE_TIMER_HZ          1000000
+#define PULSE_US_PER_TICK       (1000000 / CH_CFG_ST_FREQUENCY)
+/* Input filter: 8 samples at 48MHz, rejects glitches under 170ns */
+#define PULSE_INPUT_FILTER      3
+
+#define CCER_BITS(n, bits)      ((bits) << (4 * (n)))
+#define CCER_ENABLE             0x1
+#define CCER_FALLING            0x2
+#define SR_CCIF(n)              (STM32_TIM_SR_CC1IF << (n))
+#define SR_CCOF(n)              (STM32_TIM_SR_CC1OF << (n))
+#define DIER_CCIE(n)            (STM32_TIM_DIER_CC1IE << (n))
+
+enum pulse_state {
+        PULSE_IDLE,
+        PULSE_WAIT_RISE,
+        PULSE_WAIT_FALL,
+        PULSE_WAIT_NEXT_RISE,
+};
+
+struct PulseInput {
+        ioportid_t port;
+        uint8_t pad;
+        uint8_t timer_channel;
+};
+
+struct PulseChannel {
+        uint8_t mode;
+        uint8_t state;
+        bool measured;
+        systime_t armed_at;
+        /* the last capture, and the kernel time it was taken at */
+        uint16_t capture;
+        systime_t capture_time;
+        uint32_t high_us;
+        uint32_t low_us;
+        /* the last complete measurement, period 0 when there are no pulses */
+        uint32_t period_us;
+        uint32_t duty_high_us;
+};
+
+/* By channel, analog 1..4; analog 4 has no TIM3 channel */
+static const struct PulseInput g_inputs[ADC_CHANNELS] = {
+        {GPIOB, 1, 3},
+        {GPIOA, 7, 1},
+        {GPIOA, 6, 0},
+        {NULL, 0, 0},
+};
+
+static struct PulseChannel g_channels[ADC_CHANNELS];
+static bool g_timer_running;
+
+bool pulse_capture_supported(uint8_t channel)
+{
+        return channel < ADC_CHANNELS && g_inputs[channel].port;
+}
+
+static volatile uint32_t *_ccmr(uint8_t n)
+{
+        return n < 2 ? &PULSE_TIMER->CCMR1 : &PULSE_TIMER->CCMR2;
+}
+
+static void _set_falling_edge(uint8_t n, bool falling)
+{
+        if (falling)
+                PULSE_TIMER->CCER |= CCER_BITS(n, CCER_FALLING);
+        else
+                PULSE_TIMER->CCER &= ~CCER_BITS(n, CCER_FALLING);
+}
+
+/* Wait for the next rising edge; called locked */
+static void _arm(uint8_t channel)
+{
+        struct PulseChannel *p = &g_channels[channel];
+        uint8_t n = g_inputs[channel].timer_channel;
+
+        _set_falling_edge(n, false);
+        (void)PULSE_TIMER->CCR[n];
+        PULSE_TIMER->SR = ~SR_CCOF(n);
+        PULSE_TIMER->DIER |= DIER_CCIE(n);
+        p->state = PULSE_WAIT_RISE;
+        p->measured = false;
+        p->armed_at = chVTGetSystemTimeX();
+}
+
+/*
+ * Microseconds between two captures. The kernel time gives the coarse
+ * interval, the 16 bit capture the exact one within +/- 32ms of it.
+ */
+static uint32_t _elapsed_us(struct PulseChannel *p, uint16_t capture, systime_t now)
+{
+        uint32_t coarse = (systime_t)(now - p->capture_time) * PULSE_US_PER_TICK;
+        int16_t correction = (int16_t)(uint16_t)((uint16_t)(capture - p->capture) - (uint16_t)coarse);
+        p->capture = capture;
+        p->capture_time = now;
+        return coarse + correction;
+}
+
+static void _capture(uint8_t channel, uint16_t capture, systime_t now)
+{
+        struct PulseChannel *p = &g_channels[channel];
+        uint8_t n = g_inputs[channel].timer_channel;
+
+        switch (p->state) {
+        case PULSE_WAIT_RISE:
+                p->capture = capture;
+                p->capture_time = now;
+                _set_falling_edge(n, true);
+                p->state = PULSE_WAIT_FALL;
+                break;
+        case PULSE_WAIT_FALL:
+                p->high_us = _elapsed_us(p, capture, now);
+                _set_falling_edge(n, false);
+                p->state = PULSE_WAIT_NEXT_RISE;
+                break;
+        case PULSE_WAIT_NEXT_RISE:
+                p->low_us = _elapsed_us(p, capture, now);
+                PULSE_TIMER->DIER &= ~DIER_CCIE(n);
+                p->measured = true;
+                p->state = PULSE_IDLE;
+                break;
+        default:
+                PULSE_TIMER->DIER &= ~DIER_CCIE(n);
+        }
+}
+
+OSAL_IRQ_HANDLER(STM32_TIM3_HANDLER)
+{
+        OSAL_IRQ_PROLOGUE();
+
+        uint32_t pending = PULSE_TIMER->SR & PULSE_TIMER->DIER;
+        systime_t now = chVTGetSystemTimeX();
+
+        osalSysLockFromISR();
+        for (uint8_t c = 0; c < ADC_CHANNELS; c++) {
+                if (!g_inputs[c].port)
+                        continue;
+                uint8_t n = g_inputs[c].timer_channel;
+                /* reading the capture clears its flag */
+                if (pending & SR_CCIF(n))
+                        _capture(c, PULSE_TIMER->CCR[n], now);
+        }
+        osalSysUnlockFromISR();
+
+        OSAL_IRQ_EPILOGUE();
+}
+
+static void _timer_start(void)
+{
+        rccEnableTIM3(FALSE);
+        rccResetTIM3();
+        PULSE_TIMER->PSC = STM32_TIMCLK1 / PULSE_TIMER_HZ - 1;
+        PULSE_TIMER->ARR = 0xFFFF;
+        PULSE_TIMER->EGR = STM32_TIM_EGR_UG;
+        PULSE_TIMER->CR1 = STM32_TIM_CR1_CEN;
+        nvicEnableVector(STM32_TIM3_NUMBER, PULSE_CAPTURE_IRQ_PRIORITY);
+        g_timer_running = true;
+}
+
+static void _timer_stop(void)
+{
+        nvicDisableVector(STM32_TIM3_NUMBER);
+        PULSE_TIMER->CR1 = 0;
+        rccDisableTIM3(FALSE);
+        g_timer_running = false;
+}
+
+/*
+ * Apply the channel modes: pulse channels become TIM3 inputs, the others
+ * analog again. The timer only runs while some channel needs it.
+ */
+void pulse_capture_configure(const uint8_t *modes)
+{
+        bool pulses = false;
+        for (uint8_t c = 0; c < ADC_CHANNELS; c++) {
+                if (modes[c] != CHANNEL_MODE_ANALOG && pulse_capture_supported(c))
+                        pulses = true;
+        }
+
+        chSysLock();
+        if (pulses && !g_timer_running)
+                _timer_start();
+
+        for (uint8_t c = 0; c < ADC_CHANNELS; c++) {
+                const struct PulseInput *in = &g_inputs[c];
+                struct PulseChannel *p = &g_channels[c];
+                if (!in->port)
+                        continue;
+                uint8_t n = in->timer_channel;
+                uint8_t shift = (n & 1) * 8;
+                bool pulse = modes[c] != CHANNEL_MODE_ANALOG;
+
+                if (g_timer_running) {
+                        PULSE_TIMER->DIER &= ~DIER_CCIE(n);
+                        PULSE_TIMER->CCER &= ~CCER_BITS(n, CCER_ENABLE | CCER_FALLING);
+                        *_ccmr(n) &= ~((STM32_TIM_CCMR1_CC1S_MASK | STM32_TIM_CCMR1_IC1F_MASK) << shift);
+                }
+                memset(p, 0, sizeof(*p));
+                p->mode = pulse ? modes[c] : CHANNEL_MODE_ANALOG;
+
+                if (pulse) {
+                        palSetPadMode(in->port, in->pad, PAL_MODE_ALTERNATE(1));
+                        *_ccmr(n) |= (STM32_TIM_CCMR1_CC1S(1) | STM32_TIM_CCMR1_IC1F(PULSE_INPUT_FILTER)) << shift;
+                        PULSE_TIMER->CCER |= CCER_BITS(n, CCER_ENABLE);
+                } else {
+                        palSetPadMode(in->port, in->pad, PAL_MODE_INPUT_ANALOG);
+                }
+        }
+
+        if (!pulses && g_timer_running)
+                _timer_stop();
+        chSysUnlock();
+
+        for (uint8_t c = 0; c < ADC_CHANNELS; c++) {
+                if (g_channels[c].mode != CHANNEL_MODE_ANALOG)
+                        log_info(_LOG_PFX "analog %u measures pulses, mode %u\r\n", c + 1, g_channels[c].mode);
+        }
+}
+
+/*
+ * Called with each broadcast: replace the values of pulse channels with
+ * their latest measurement and arm the next one. A channel without a
+ * complete cycle within PULSE_TIMEOUT_MS reads as stopped, with its duty
+ * cycle taken from the pin level.
+ */
+void pulse_capture_update(uint16_t *values)
+{
+        for (uint8_t c = 0; c < ADC_CHANNELS; c++) {
+                struct PulseChannel *p = &g_channels[c];
+                if (p->mode == CHANNEL_MODE_ANALOG)
+                        continue;
+
+                chSysLock();
+                if (p->measured) {
+                        p->period_us = p->high_us + p->low_us;
+                        p->duty_high_us = p->high_us;
+                        _arm(c);
+                } else if (p->state == PULSE_IDLE ||
+                           chVTTimeElapsedSinceX(p->armed_at) >= MS2ST(PULSE_TIMEOUT_MS)) {
+                        if (p->state != PULSE_IDLE)
+                                p->period_us = 0;
+                        _arm(c);
+                }
+                uint32_t period = p->period_us;
+                uint32_t high = p->duty_high_us;
+                chSysUnlock();
+
+                if (!period && p->mode == CHANNEL_MODE_DUTY)
+                        values[c] = palReadPad(g_inputs[c].port, g_inputs[c].pad) ? 1000 : 0;
+                else
+                        values[c] = acquisition_pulse_value(p->mode, period, high);
+                log_debug(_LOG_PFX "analog %u period %u us high %u us\r\n", c + 1, period, high);
+        }
+}
@@ -0,0 +1,228 @@
+/*
+ * AnalogX firmware
+ *
+ * Copyright (C) 2017 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Runtime statistics: per thread CPU share, stack headroom and ISR load.
+ *
+ * CPU time is charged to each thread from the context switch hook using
+ * the SysTick cycle counter. Shares are computed over the window since
+ * the previous report, measured in system time.
+ *
+ * ChibiOS offers no IRQ hooks on ARMv6-M, so ISR time is observed from
+ * the idle loop instead: any gap between two idle loop iterations longer
+ * than IDLE_LOOP_GAP_CYCLES was spent servicing interrupts. This only
+ * sees interrupts taken while idle, which is where most of them land.
+ *
+ * Stack headroom relies on CH_DBG_FILL_THREADS and the crt0 stack fill;
+ * it is the number of never touched bytes at the bottom of each stack.
+ */
+
+#include "runtime_stats.h"
+#include "analogx_api.h"
+#include "logging.h"
+#include "settings.h"
+#include "system_CAN.h"
+#include "system_timer.h"
+#include "power.h"
+#include "trace.h"
+#if TELEMETRY_STREAM
+#include "telemetry_stream.h"
+#endif
+
+#define _LOG_PFX "STATS:       "
+
+#define IDLE_LOOP_GAP_CYCLES    64
+#define CYCLES_PER_SYSTEM_TICK  (STM32_HCLK / CH_CFG_ST_FREQUENCY)
+#define STATS_RECORD_SUMMARY    0
+#define STATS_RECORD_COUNTERS   0x80
+#define STATS_RECORD_POWER      0x81
+
+/* Linker symbols for the exception and main() thread stacks */
+extern uint8_t __main_stack_base__[];
+extern uint8_t __main_stack_end__[];
+extern uint8_t __process_stack_base__[];
+extern uint8_t __process_stack_end__[];
+
+static uint32_t g_last_switch_cycles;
+static uint32_t g_idle_last_cycles;
+static volatile uint32_t g_isr_cycles;
+static systime_t g_window_start;
+static uint16_t g_idle_permille;
+
+void runtime_stats_thread_init(thread_t *tp)
+{
+        tp->cpu_cycles = 0;
+}
+
+/* Charge the outgoing thread for the time since the last switch */
+void runtime_stats_context_switch(thread_t *ntp, thread_t *otp)
+{
+        uint32_t now = system_timer_cycles();
+        otp->cpu_cycles += (now - g_last_switch_cycles) & SYSTEM_TIMER_MASK;
+        g_last_switch_cycles = now;
+        trace_context_switch(ntp, now);
+}
+
+void runtime_stats_idle_enter(void)
+{
+        g_idle_last_cycles = system_timer_cycles();
+}
+
+void runtime_stats_idle_loop(void)
+{
+        uint32_t now = system_timer_cycles();
+        uint32_t gap = (now - g_idle_last_cycles) & SYSTEM_TIMER_MASK;
+        if (gap > IDLE_LOOP_GAP_CYCLES) {
+                g_isr_cycles += gap;
+                trace_isr(g_idle_last_cycles, gap);
+        }
+        g_idle_last_cycles = now;
+}
+
+/* Count the untouched fill bytes from the bottom of a stack */
+static uint16_t _stack_free(const uint8_t *base, const uint8_t *end)
+{
+        const uint8_t *p = base;
+        while (p < end && *p == CH_DBG_STACK_FILL_VALUE)
+                p++;
+        return p - base;
+}
+
+/* Working areas hold the thread structure followed by its stack; the
+ * main() thread runs on the process stack reserved by the linker */
+static uint16_t _thread_stack_free(thread_t *tp)
+{
+        if (tp == &ch.mainthread)
+                return _stack_free(__process_stack_base__, __process_stack_end__);
+        return _stack_free((const uint8_t *)(tp + 1), (const uint8_t *)tp->p_ctx.r13);
+}
+
+static uint16_t _permille(uint32_t cycles, uint32_t window_cycles)
+{
+        uint32_t divisor = window_cycles / 1000;
+        if (divisor == 0)
+                return 0;
+        uint32_t permille = cycles / divisor;
+        return permille > 1000 ? 1000 : permille;
+}
+
+uint16_t runtime_stats_idle_permille(void)
+{
+        return g_idle_permille;
+}
+
+/* While CAN sleeps the stats only go to the log */
+static void _transmit(CANTxFrame *frame)
+{
+        if (power_can_asleep())
+                return;
+        canTransmit(&CAND1, CAN_ANY_MAILBOX, frame, MS2ST(CAN_TRANSMIT_TIMEOUT));
+}
+
+static uint16_t _saturate16(uint32_t value)
+{
+        return value > UINT16_MAX ? UINT16_MAX : value;
+}
+
+/*
+ * Broadcast the extended stats: one record per thread followed by
+ * a summary record, a counters record and a power record. The first
+ * data byte is the record index, with the summary always at index 0,
+ * the counters at STATS_RECORD_COUNTERS and power at STATS_RECORD_POWER.
+ */
+void runtime_stats_broadcast(void)
+{
+        systime_t now = chVTGetSystemTimeX();
+        uint32_t window_cycles = (systime_t)(now - g_window_start) * CYCLES_PER_SYSTEM_TICK;
+        g_window_start = now;
+
+        CANTxFrame frame;
+        uint8_t record = STATS_RECORD_SUMMARY + 1;
+        uint8_t thread_count = 0;
+
+        thread_t *tp = chRegFirstThread();
+        while (tp) {
+                chSysLock();
+                uint32_t cycles = tp->cpu_cycles;
+                tp->cpu_cycles = 0;
+                chSysUnlock();
+
+                uint16_t cpu_permille = _permille(cycles, window_cycles);
+                uint16_t stack_free = _thread_stack_free(tp);
+                const char *name = tp->p_name ? tp->p_name : "";
+
+                if (tp->p_prio == IDLEPRIO)
+                        g_idle_permille = cpu_permille;
+
+                prepare_can_tx_message(&frame, CAN_IDE_EXT, get_can_base_id() + API_STATS_EXTENDED);
+                frame.data8[0] = record++;
+                frame.data8[1] = tp->p_prio;
+                frame.data16[1] = cpu_permille;
+                frame.data16[2] = stack_free;
+                frame.data8[6] = name[0];
+                frame.data8[7] = name[0] ? name[1] : 0;
+                _transmit(&frame);
+
+                log_info(_LOG_PFX "%s: cpu %u/1000 stack free %u\r\n", name, cpu_permille, stack_free);
+                thread_count++;
+                tp = chRegNextThread(tp);
+        }
+
+        chSysLock();
+        uint32_t isr_cycles = g_isr_cycles;
+        g_isr_cycles = 0;
+        chSysUnlock();
+
+        uint16_t isr_permille = _permille(isr_cycles, window_cycles);
+        uint16_t exception_stack_free = _stack_free(__main_stack_base__, __main_stack_end__);
+
+        prepare_can_tx_message(&frame, CAN_IDE_EXT, get_can_base_id() + API_STATS_EXTENDED);
+        frame.data8[0] = STATS_RECORD_SUMMARY;
+        frame.data8[1] = thread_count;
+        frame.data16[1] = g_idle_permille;
+        frame.data16[2] = isr_permille;
+        frame.data16[3] = exception_stack_free;
+        _transmit(&frame);
+
+        log_info(_LOG_PFX "idle %u/1000 isr %u/1000 exception stack free %u\r\n",
+                 g_idle_permille, isr_permille, exception_stack_free);
+
+        prepare_can_tx_message(&frame, CAN_IDE_EXT, get_can_base_id() + API_STATS_EXTENDED);
+        frame.data8[0] = STATS_RECORD_COUNTERS;
+        frame.data16[1] = _saturate16(get_logging_dropped());
+#if TELEMETRY_STREAM
+        frame.data16[2] = _saturate16(telemetry_stream_get_dropped());
+#endif
+        _transmit(&frame);
+
+        struct PowerStats power;
+        power_collect(&power);
+        prepare_can_tx_message(&frame, CAN_IDE_EXT, get_can_base_id() + API_STATS_EXTENDED);
+        frame.data8[0] = STATS_RECORD_POWER;
+        frame.data8[1] = power.can_wakeups > UINT8_MAX ? UINT8_MAX : power.can_wakeups;
+        frame.data16[1] = power.sleep_permille;
+        frame.data16[2] = _saturate16(power.can_sleep_ms / 1000);
+        frame.data16[3] = power.wake_latency_max_us;
+        _transmit(&frame);
+
+        log_info(_LOG_PFX "sleep %u/1000 wake latency max %u us, CAN slept %u s, %u wakeups\r\n",
+                 power.sleep_permille, power.wake_latency_max_us, power.can_sleep_ms / 1000, power.can_wakeups);
+}
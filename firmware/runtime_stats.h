@@ -0,0 +1,36 @@
+/*
+ * AnalogX firmware
+ *
+ * Copyright (C) 2017 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RUNTIME_STATS_H_
+#define RUNTIME_STATS_H_
+#include "ch.h"
+#include "hal.h"
+
+/* Kernel hooks, see chconf.h */
+void runtime_stats_thread_init(thread_t *tp);
+void runtime_stats_context_switch(thread_t *ntp, thread_t *otp);
+void runtime_stats_idle_enter(void);
+void runtime_stats_idle_loop(void);
+
+uint16_t runtime_stats_idle_permille(void);
+void runtime_stats_broadcast(void);
+
+#endif /* RUNTIME_STATS_H_ */
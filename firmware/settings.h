@@ -38,4 +38,79 @@
 /* The default sample rate at power up */
 #define DEFAULT_SAMPLE_RATE 50
 
+/* The default acquisition profile: 28.5 cycles sample time, 12 bits */
+#define DEFAULT_ADC_SAMPLE_TIME 3
+#define DEFAULT_ADC_RESOLUTION 0
+
+/* Fast boot: skip start up delays and give acquisition
+ * priority, to minimize the time to the first sensor frame */
+#define FAST_BOOT TRUE
+
+/* Time budget from reset to the first sensor frame */
+#define BOOT_FIRST_FRAME_BUDGET_MS 50
+
+/* With the latency probe (make USE_LATENCY_PROBE=yes) the ADC worker
+ * waits up to this many ms for each sensor frame to leave */
+#define LATENCY_TX_COMPLETE_TIMEOUT 10
+
+/* Telemetry stream (make USE_UART_STREAM=yes) baud rate
+ * and the oversampling applied until the host picks one */
+#define TELEMETRY_BAUD 2000000
+#define TELEMETRY_DEFAULT_OVERSAMPLE_SHIFT 2
+
+/* A pulse channel without a full cycle for this long reads as stopped */
+#define PULSE_TIMEOUT_MS 1000
+
+/* Scans captured at each sample time setting by the noise scan; 72 fill
+ * the ADC worker's shared buffer, which the CAN stream sizes */
+#define NOISE_SCAN_DEPTH 72
+
+/* Interval between spectrum analyses of the selected channel, and log2
+ * of the largest transform; it works in the ADC worker's shared buffer,
+ * 2 bytes a point */
+#define SPECTRUM_INTERVAL_MS 200
+#define SPECTRUM_MAX_LOG2 8
+
+/* Measure the supply and die temperature this often, and correct the
+ * external channels for the supply */
+#define SUPPLY_MONITOR_INTERVAL_MS 1000
+#define SUPPLY_COMPENSATION TRUE
+
+/* Totalizers: broadcast interval, flash save interval (each save is a
+ * config record, so mind the flash endurance) and the longest gap in
+ * acquisition that is still integrated */
+#define TOTALIZER_REPORT_INTERVAL_MS 1000
+#define TOTALIZER_SAVE_INTERVAL_S 600
+#define TOTALIZER_MAX_GAP_MS 1000
+
+/* CAN stream: the share of the bus it takes when no rate is set, the
+ * bits on the wire of its frames (extended ID, 8 bytes, typical bit
+ * stuffing), the highest rate accepted, in scans/s, and the scans queued
+ * for the mailboxes, a power of 2, held in the ADC worker's shared buffer */
+#define CAN_STREAM_BUS_SHARE_PERCENT 90
+#define CAN_STREAM_FRAME_BITS 150
+#define CAN_STREAM_MAX_RATE 20000
+#define CAN_STREAM_QUEUE_DEPTH 32
+
+/* Blocks this size or larger are fed to the CRC unit by DMA; below,
+ * setting up the transfer costs more than the CPU writing the words */
+#define INTEGRITY_DMA_MIN_BYTES 256
+
+/* Trace buffer, in 8 byte events, a power of 2 (make USE_TRACE=yes);
+ * what ram0 has left, less with the stream or the latency probe */
+#if TELEMETRY_STREAM && LATENCY_PROBE_ENABLED
+#define TRACE_BUFFER_EVENTS 16
+#elif TELEMETRY_STREAM || LATENCY_PROBE_ENABLED
+#define TRACE_BUFFER_EVENTS 32
+#else
+#define TRACE_BUFFER_EVENTS 64
+#endif
+
+/* Sleep the core in the idle thread. CAN sleeps after the bus has
+ * been idle for POWER_CAN_IDLE_TIMEOUT_MS, then probes for a listener
+ * every POWER_CAN_PROBE_INTERVAL_MS */
+#define POWER_SLEEP_ENABLED TRUE
+#define POWER_CAN_IDLE_TIMEOUT_MS 10000
+#define POWER_CAN_PROBE_INTERVAL_MS 2000
+
 #endif /* SETTINGS_H_ */
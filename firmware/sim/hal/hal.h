@@ -0,0 +1,319 @@
+/*
+ * AnalogX firmware
+ *
+ * Copyright (C) 2017 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Host simulation HAL: the subset of the ChibiOS HAL API the application
+ * uses, with the same types and semantics, backed by the peripheral
+ * models in sim_hal.c instead of STM32 registers.
+ */
+#ifndef SIM_HAL_H_
+#define SIM_HAL_H_
+#include "ch.h"
+#include "hal_streams.h"
+#include "stm32f042x6.h"
+
+/* Optional firmware features the simulation does not model */
+#define TELEMETRY_STREAM                FALSE
+#define PULSE_CAPTURE                   FALSE
+#define ANGLE_SYNC                      FALSE
+#define INTEGRITY_HW_CRC                FALSE
+#if !defined(TRACE_ENABLED)
+#define TRACE_ENABLED                   FALSE
+#endif
+#if !defined(LATENCY_PROBE_ENABLED)
+#define LATENCY_PROBE_ENABLED           FALSE
+#endif
+
+#define STM32_HCLK                      48000000
+#define STM32_PCLK                      48000000
+
+void halInit(void);
+
+/* PAL */
+typedef GPIO_TypeDef *ioportid_t;
+typedef uint32_t ioportmask_t;
+typedef uint32_t iomode_t;
+
+#define PAL_LOW                         0
+#define PAL_HIGH                        1
+#define PAL_PORT_BIT(n)                 ((ioportmask_t)(1U << (n)))
+#define PAL_MODE_INPUT_ANALOG           3U
+#define PAL_STM32_MODE_INPUT            (0U << 0)
+#define PAL_STM32_MODE_OUTPUT           (1U << 0)
+#define PAL_STM32_MODE_ALTERNATE        (2U << 0)
+#define PAL_STM32_MODE_ANALOG           (3U << 0)
+#define PAL_STM32_OTYPE_PUSHPULL        (0U << 2)
+#define PAL_STM32_OTYPE_OPENDRAIN       (1U << 2)
+#define PAL_STM32_OSPEED_HIGHEST        (3U << 3)
+#define PAL_STM32_PUPDR_FLOATING        (0U << 5)
+#define PAL_STM32_PUPDR_PULLUP          (1U << 5)
+#define PAL_STM32_PUPDR_PULLDOWN        (2U << 5)
+#define PAL_STM32_ALTERNATE(n)          ((n) << 7)
+
+void palSetGroupMode(ioportid_t port, ioportmask_t mask, uint32_t offset, iomode_t mode);
+#define palSetPadMode(port, pad, mode)  palSetGroupMode(port, PAL_PORT_BIT(pad), 0, mode)
+#define palReadPad(port, pad)           (((port)->IDR >> (pad)) & 1U)
+#define palSetPad(port, pad)            ((port)->ODR |= PAL_PORT_BIT(pad))
+#define palClearPad(port, pad)          ((port)->ODR &= ~PAL_PORT_BIT(pad))
+
+/* ADC */
+typedef uint16_t adcsample_t;
+typedef uint16_t adc_channels_num_t;
+typedef enum {
+        ADC_ERR_DMAFAILURE = 0,
+        ADC_ERR_OVERFLOW = 1,
+        ADC_ERR_AWD = 2
+} adcerror_t;
+
+typedef struct ADCDriver ADCDriver;
+typedef void (*adccallback_t)(ADCDriver *adcp, adcsample_t *buffer, size_t n);
+typedef void (*adcerrorcallback_t)(ADCDriver *adcp, adcerror_t err);
+
+typedef struct {
+        bool                    circular;
+        adc_channels_num_t      num_channels;
+        adccallback_t           end_cb;
+        adcerrorcallback_t      error_cb;
+        uint32_t                cfgr1;
+        uint32_t                tr;
+        uint32_t                smpr;
+        uint32_t                chselr;
+} ADCConversionGroup;
+
+typedef struct {
+        uint32_t                dummy;
+} ADCConfig;
+
+struct ADCDriver {
+        bool                    started;
+        uint32_t                conversions;
+};
+
+extern ADCDriver ADCD1;
+
+#define ADC_CFGR1_CONT                  (1U << 13)
+#define ADC_CFGR1_RES_12BIT             (0U << 3)
+#define ADC_CFGR1_RES_10BIT             (1U << 3)
+#define ADC_CFGR1_RES_8BIT              (2U << 3)
+#define ADC_CFGR1_RES_6BIT              (3U << 3)
+#define ADC_CFGR1_SCANDIR               (1U << 2)
+#define ADC_CFGR1_EXTEN_MASK            (3U << 10)
+#define ADC_CFGR1_EXTEN_RISING          (1U << 10)
+#define ADC_CFGR1_EXTSEL_SRC(n)         ((n) << 6)
+#define ADC_TR(low, high)               (((uint32_t)(high) << 16) | (uint32_t)(low))
+#define ADC_SMPR_SMP_1P5                0U
+#define ADC_SMPR_SMP_7P5                1U
+#define ADC_SMPR_SMP_13P5               2U
+#define ADC_SMPR_SMP_28P5               3U
+#define ADC_SMPR_SMP_41P5               4U
+#define ADC_SMPR_SMP_55P5               5U
+#define ADC_SMPR_SMP_71P5               6U
+#define ADC_SMPR_SMP_239P5              7U
+#define ADC_CHSELR_CHSEL(n)             (1U << (n))
+#define ADC_CHSELR_CHSEL5               ADC_CHSELR_CHSEL(5)
+#define ADC_CHSELR_CHSEL6               ADC_CHSELR_CHSEL(6)
+#define ADC_CHSELR_CHSEL7               ADC_CHSELR_CHSEL(7)
+#define ADC_CHSELR_CHSEL9               ADC_CHSELR_CHSEL(9)
+#define ADC_CHSELR_CHSEL16              ADC_CHSELR_CHSEL(16)
+#define ADC_CHSELR_CHSEL17              ADC_CHSELR_CHSEL(17)
+#define ADC_CCR_TSEN                    (1U << 23)
+#define ADC_CCR_VREFEN                  (1U << 22)
+#define adcSTM32SetCCR(ccr)             ((void)(ccr))
+
+/* Factory calibration of VREFINT and the temperature sensor */
+extern const uint16_t g_sim_vrefint_cal;
+extern const uint16_t g_sim_ts_cal[2];
+#define VREFINT_CAL_ADDR                (&g_sim_vrefint_cal)
+#define TEMPSENSOR_CAL1_ADDR            (&g_sim_ts_cal[0])
+#define TEMPSENSOR_CAL2_ADDR            (&g_sim_ts_cal[1])
+
+void adcStart(ADCDriver *adcp, const ADCConfig *config);
+void adcStop(ADCDriver *adcp);
+msg_t adcConvert(ADCDriver *adcp, const ADCConversionGroup *grpp,
+                 adcsample_t *samples, size_t depth);
+void adcStartConversion(ADCDriver *adcp, const ADCConversionGroup *grpp,
+                        adcsample_t *samples, size_t depth);
+void adcStopConversion(ADCDriver *adcp);
+
+/* Timers: TIM1 as the trigger of ADC scans, its TRGO on update */
+typedef struct {
+        volatile uint32_t       CR1;
+        volatile uint32_t       CR2;
+        volatile uint32_t       EGR;
+        volatile uint32_t       PSC;
+        volatile uint32_t       ARR;
+} stm32_tim_t;
+
+extern stm32_tim_t g_sim_tim1;
+
+#define STM32_TIM1                      (&g_sim_tim1)
+#define STM32_TIMCLK1                   STM32_PCLK
+#define STM32_TIM_CR1_CEN               (1U << 0)
+#define STM32_TIM_CR2_MMS(n)            ((n) << 4)
+#define STM32_TIM_EGR_UG                (1U << 0)
+#define rccEnableTIM1(lp)               ((void)(lp))
+#define rccDisableTIM1(lp)              ((void)(lp))
+#define rccResetTIM1()                  (g_sim_tim1 = (stm32_tim_t){0})
+
+/* CAN */
+#define CAN_TX_MAILBOXES                3
+#define CAN_RX_MAILBOXES                2
+#define CAN_ANY_MAILBOX                 0
+#define CAN_IDE_STD                     0
+#define CAN_IDE_EXT                     1
+#define CAN_RTR_DATA                    0
+#define CAN_RTR_REMOTE                  1
+#define CAN_MAILBOX_TO_MASK(mbx)        (1U << ((mbx) - 1U))
+#define CAN_USE_SLEEP_MODE              TRUE
+
+typedef uint32_t canmbx_t;
+typedef enum {
+        CAN_UNINIT = 0,
+        CAN_STOP = 1,
+        CAN_STARTING = 2,
+        CAN_READY = 3,
+        CAN_SLEEP = 4
+} canstate_t;
+
+typedef struct {
+        struct {
+                uint8_t         DLC:4;
+                uint8_t         RTR:1;
+                uint8_t         IDE:1;
+        };
+        union {
+                struct {
+                        uint32_t SID:11;
+                };
+                struct {
+                        uint32_t EID:29;
+                };
+        };
+        union {
+                uint8_t         data8[8];
+                uint16_t        data16[4];
+                uint32_t        data32[2];
+                uint64_t        data64[1];
+        };
+} CANTxFrame;
+
+typedef struct {
+        struct {
+                uint8_t         FMI;
+                uint16_t        TIME;
+        };
+        struct {
+                uint8_t         DLC:4;
+                uint8_t         RTR:1;
+                uint8_t         IDE:1;
+        };
+        union {
+                struct {
+                        uint32_t SID:11;
+                };
+                struct {
+                        uint32_t EID:29;
+                };
+        };
+        union {
+                uint8_t         data8[8];
+                uint16_t        data16[4];
+                uint32_t        data32[2];
+                uint64_t        data64[1];
+        };
+} CANRxFrame;
+
+typedef struct {
+        uint32_t                mcr;
+        uint32_t                btr;
+} CANConfig;
+
+typedef struct {
+        canstate_t              state;
+        const CANConfig         *config;
+        threads_queue_t         txqueue;
+        threads_queue_t         rxqueue;
+        event_source_t          rxfull_event;
+        event_source_t          txempty_event;
+        event_source_t          error_event;
+        event_source_t          sleep_event;
+        event_source_t          wakeup_event;
+        CAN_TypeDef             *can;
+} CANDriver;
+
+extern CANDriver CAND1;
+
+void canStart(CANDriver *canp, const CANConfig *config);
+void canStop(CANDriver *canp);
+msg_t canTransmit(CANDriver *canp, canmbx_t mailbox, const CANTxFrame *ctfp, systime_t timeout);
+msg_t canReceive(CANDriver *canp, canmbx_t mailbox, CANRxFrame *crfp, systime_t timeout);
+void canSleep(CANDriver *canp);
+void canWakeup(CANDriver *canp);
+
+/* Serial */
+typedef struct {
+        uint32_t                speed;
+        uint32_t                cr1;
+        uint32_t                cr2;
+        uint32_t                cr3;
+} SerialConfig;
+
+typedef struct {
+        const struct BaseSequentialStreamVMT *vmt;
+        bool                    started;
+} SerialDriver;
+
+extern SerialDriver SD1;
+extern SerialDriver SD2;
+
+void sdStart(SerialDriver *sdp, const SerialConfig *config);
+#define sdWrite(sdp, b, n)              streamWrite(sdp, b, n)
+#define sdGet(sdp)                      streamGet(sdp)
+#define sdPut(sdp, b)                   streamPut(sdp, b)
+
+/* Watchdog; expiry ends the simulation as a failure */
+typedef struct {
+        uint32_t                pr;
+        uint32_t                rlr;
+        uint32_t                winr;
+} WDGConfig;
+
+typedef struct {
+        const WDGConfig         *config;
+        virtual_timer_t         expiry;
+} WDGDriver;
+
+extern WDGDriver WDGD1;
+
+#define STM32_IWDG_PR_4                 0U
+#define STM32_IWDG_PR_8                 1U
+#define STM32_IWDG_PR_16                2U
+#define STM32_IWDG_PR_32                3U
+#define STM32_IWDG_PR_64                4U
+#define STM32_IWDG_PR_128               5U
+#define STM32_IWDG_PR_256               6U
+#define STM32_IWDG_RL(n)                (n)
+#define STM32_IWDG_WIN_DISABLED         0x0FFFU
+
+void wdgStart(WDGDriver *wdgp, const WDGConfig *config);
+void wdgReset(WDGDriver *wdgp);
+
+#endif /* SIM_HAL_H_ */
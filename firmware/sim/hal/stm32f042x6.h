@@ -0,0 +1,114 @@
+/*
+ * AnalogX firmware
+ *
+ * Copyright (C) 2017 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Host simulation stand-in for the CMSIS device header: only the
+ * registers the application touches directly, backed by plain memory.
+ */
+#ifndef SIM_STM32F042X6_H_
+#define SIM_STM32F042X6_H_
+#include <stdint.h>
+
+typedef struct {
+        volatile uint32_t CTRL;
+        volatile uint32_t LOAD;
+        volatile uint32_t VAL;
+        volatile uint32_t CALIB;
+} SysTick_Type;
+
+typedef struct {
+        volatile uint32_t APB2ENR;
+        volatile uint32_t APB1ENR;
+        volatile uint32_t AHBENR;
+} RCC_TypeDef;
+
+typedef struct {
+        volatile uint32_t CFGR1;
+} SYSCFG_TypeDef;
+
+typedef struct {
+        volatile uint32_t IDR;
+        volatile uint32_t ODR;
+} GPIO_TypeDef;
+
+typedef struct {
+        volatile uint32_t MCR;
+        volatile uint32_t MSR;
+        volatile uint32_t TSR;
+        volatile uint32_t RF0R;
+        volatile uint32_t RF1R;
+        volatile uint32_t IER;
+        volatile uint32_t ESR;
+        volatile uint32_t BTR;
+} CAN_TypeDef;
+
+/* Reading SysTick moves virtual time forward, see sim_time.c */
+SysTick_Type *sim_systick(void);
+#define SysTick                         (sim_systick())
+#define SysTick_CTRL_ENABLE_Msk         (1UL << 0)
+#define SysTick_CTRL_TICKINT_Msk        (1UL << 1)
+#define SysTick_CTRL_CLKSOURCE_Msk      (1UL << 2)
+#define SysTick_VAL_CURRENT_Msk         0x00FFFFFFUL
+
+extern RCC_TypeDef g_sim_rcc;
+extern SYSCFG_TypeDef g_sim_syscfg;
+extern GPIO_TypeDef g_sim_gpioa;
+extern GPIO_TypeDef g_sim_gpiob;
+extern CAN_TypeDef g_sim_can;
+
+#define RCC                             (&g_sim_rcc)
+#define SYSCFG                          (&g_sim_syscfg)
+#define GPIOA                           (&g_sim_gpioa)
+#define GPIOB                           (&g_sim_gpiob)
+#define CAN                             (&g_sim_can)
+
+#define RCC_APB2ENR_SYSCFGCOMPEN        (1UL << 0)
+#define RCC_AHBENR_FLITFEN              (1UL << 4)
+#define SYSCFG_CFGR1_PA11_PA12_RMP      (1UL << 4)
+
+#define CAN_MCR_INRQ                    (1UL << 0)
+#define CAN_MCR_SLEEP                   (1UL << 1)
+#define CAN_MCR_TXFP                    (1UL << 2)
+#define CAN_MCR_RFLM                    (1UL << 3)
+#define CAN_MCR_NART                    (1UL << 4)
+#define CAN_MCR_AWUM                    (1UL << 5)
+#define CAN_MCR_ABOM                    (1UL << 6)
+#define CAN_MCR_TTCM                    (1UL << 7)
+#define CAN_MSR_SLAK                    (1UL << 1)
+#define CAN_TSR_TME0                    (1UL << 26)
+#define CAN_TSR_TME1                    (1UL << 27)
+#define CAN_TSR_TME2                    (1UL << 28)
+#define CAN_TSR_TME                     (CAN_TSR_TME0 | CAN_TSR_TME1 | CAN_TSR_TME2)
+#define CAN_TSR_CODE                    (3UL << 24)
+#define CAN_BTR_BRP(n)                  (n)
+#define CAN_BTR_TS1(n)                  ((n) << 16)
+#define CAN_BTR_TS2(n)                  ((n) << 20)
+#define CAN_BTR_SJW(n)                  ((n) << 24)
+#define CAN_BTR_LBKM                    (1UL << 30)
+#define CAN_BTR_SILM                    (1UL << 31)
+
+void NVIC_SystemReset(void);
+
+/* Sleeping moves virtual time to the next interrupt, see sim_time.c */
+void sim_wfi(void);
+#define __WFI()                         sim_wfi()
+
+#endif /* SIM_STM32F042X6_H_ */
@@ -0,0 +1,55 @@
+/*
+ * AnalogX firmware
+ *
+ * Copyright (C) 2017 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "ch.h"
+
+bool port_isr_context_flag;
+syssts_t port_irq_sts;
+
+void port_switch(thread_t *ntp, thread_t *otp)
+{
+        swapcontext(&otp->p_ctx.uc, &ntp->p_ctx.uc);
+}
+
+/* makecontext() only passes ints, so pointers travel as two halves */
+static void _port_thread_start(uint32_t pf_hi, uint32_t pf_lo, uint32_t arg_hi, uint32_t arg_lo)
+{
+        void (*pf)(void *) = (void (*)(void *))(((uintptr_t)pf_hi << 32) | pf_lo);
+        void *arg = (void *)(((uintptr_t)arg_hi << 32) | arg_lo);
+
+        chSysUnlock();
+        pf(arg);
+        chThdExit(MSG_OK);
+}
+
+void _port_setup_context(struct context *ctx, void *stack, size_t size,
+                         void (*pf)(void *), void *arg)
+{
+        uintptr_t f = (uintptr_t)pf;
+        uintptr_t a = (uintptr_t)arg;
+
+        getcontext(&ctx->uc);
+        ctx->uc.uc_stack.ss_sp = stack;
+        ctx->uc.uc_stack.ss_size = size;
+        ctx->uc.uc_link = NULL;
+        ctx->r13 = (uint8_t *)stack + size;
+        makecontext(&ctx->uc, (void (*)(void))_port_thread_start, 4,
+                    (uint32_t)(f >> 32), (uint32_t)f, (uint32_t)(a >> 32), (uint32_t)a);
+}
@@ -0,0 +1,174 @@
+/*
+ * AnalogX firmware
+ *
+ * Copyright (C) 2017 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Host simulation port for ChibiOS/RT.
+ *
+ * Threads are ucontext coroutines on a single host thread, so there is
+ * no preemption by host signals and every run is deterministic. Time is
+ * virtual: it only moves forward when the idle thread runs, jumping
+ * straight to the next kernel alarm, or when code busy waits on the
+ * SysTick cycle counter (see sim_time.c). "Interrupts" are kernel
+ * virtual timer callbacks run from the idle thread.
+ */
+#ifndef _CHCORE_H_
+#define _CHCORE_H_
+
+#include <ucontext.h>
+
+#define PORT_ARCHITECTURE_SIMPOSIX
+#define PORT_ARCHITECTURE_NAME          "Simulator"
+#define PORT_CORE_VARIANT_NAME          "POSIX ucontext"
+#define PORT_COMPILER_NAME              "GCC " __VERSION__
+#define PORT_INFO                       "No preemption, virtual time"
+
+/* No realtime counter, as on the Cortex-M0 */
+#define PORT_SUPPORTS_RT                FALSE
+
+#ifndef PORT_IDLE_THREAD_STACK_SIZE
+#define PORT_IDLE_THREAD_STACK_SIZE     256
+#endif
+
+/* Host library calls need far more stack than the firmware sizes for */
+#ifndef PORT_INT_REQUIRED_STACK
+#define PORT_INT_REQUIRED_STACK         32768
+#endif
+
+#if CH_DBG_ENABLE_STACK_CHECK
+#error "option CH_DBG_ENABLE_STACK_CHECK not supported by this port"
+#endif
+
+#if CH_CFG_ST_TIMEDELTA == 0
+#error "the simulation port only supports tickless mode"
+#endif
+
+typedef struct {
+        uint8_t a[16];
+} stkalign_t __attribute__((aligned(16)));
+
+struct port_extctx {
+};
+
+struct port_intctx {
+};
+
+/* r13 mirrors the Cortex-M port: the top of the thread's stack, used by
+ * the stack watermark scan in runtime_stats.c */
+struct context {
+        ucontext_t uc;
+        void *r13;
+};
+
+#define PORT_SETUP_CONTEXT(tp, workspace, wsize, pf, arg) \
+        _port_setup_context(&(tp)->p_ctx, (uint8_t *)(workspace) + sizeof(thread_t), \
+                            (wsize) - sizeof(thread_t), (pf), (arg))
+
+#define PORT_WA_SIZE(n) (((size_t)(n)) + ((size_t)(PORT_INT_REQUIRED_STACK)))
+
+#define PORT_IRQ_PROLOGUE() {                                               \
+        port_isr_context_flag = true;                                       \
+}
+
+#define PORT_IRQ_EPILOGUE() {                                               \
+        port_isr_context_flag = false;                                      \
+}
+
+#define PORT_IRQ_HANDLER(id) void id(void)
+
+#define PORT_FAST_IRQ_HANDLER(id) void id(void)
+
+extern bool port_isr_context_flag;
+extern syssts_t port_irq_sts;
+
+void port_switch(struct ch_thread *ntp, struct ch_thread *otp);
+void _port_setup_context(struct context *ctx, void *stack, size_t size,
+                         void (*pf)(void *), void *arg);
+void _sim_wait_for_interrupt(void);
+
+/* Tickless system timer, driven by virtual time */
+systime_t port_timer_get_time(void);
+void port_timer_start_alarm(systime_t time);
+void port_timer_stop_alarm(void);
+void port_timer_set_alarm(systime_t time);
+systime_t port_timer_get_alarm(void);
+
+static inline void port_init(void)
+{
+        port_irq_sts = (syssts_t)0;
+        port_isr_context_flag = false;
+}
+
+static inline syssts_t port_get_irq_status(void)
+{
+        return port_irq_sts;
+}
+
+static inline bool port_irq_enabled(syssts_t sts)
+{
+        return sts == (syssts_t)0;
+}
+
+static inline bool port_is_isr_context(void)
+{
+        return port_isr_context_flag;
+}
+
+static inline void port_lock(void)
+{
+        port_irq_sts = (syssts_t)1;
+}
+
+static inline void port_unlock(void)
+{
+        port_irq_sts = (syssts_t)0;
+}
+
+static inline void port_lock_from_isr(void)
+{
+        port_irq_sts = (syssts_t)1;
+}
+
+static inline void port_unlock_from_isr(void)
+{
+        port_irq_sts = (syssts_t)0;
+}
+
+static inline void port_disable(void)
+{
+        port_irq_sts = (syssts_t)1;
+}
+
+static inline void port_suspend(void)
+{
+        port_irq_sts = (syssts_t)1;
+}
+
+static inline void port_enable(void)
+{
+        port_irq_sts = (syssts_t)0;
+}
+
+static inline void port_wait_for_interrupt(void)
+{
+        _sim_wait_for_interrupt();
+}
+
+#endif /* _CHCORE_H_ */
@@ -0,0 +1,70 @@
+/*
+ * AnalogX firmware
+ *
+ * Copyright (C) 2017 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Host simulation port: basic types, as the SIMIA32 port defines them.
+ */
+#ifndef _CHTYPES_H_
+#define _CHTYPES_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#if !defined(FALSE)
+#define FALSE               0
+#endif
+
+#if !defined(TRUE)
+#define TRUE                1
+#endif
+
+typedef volatile int8_t     vint8_t;
+typedef volatile uint8_t    vuint8_t;
+typedef volatile int16_t    vint16_t;
+typedef volatile uint16_t   vuint16_t;
+typedef volatile int32_t    vint32_t;
+typedef volatile uint32_t   vuint32_t;
+
+typedef uint32_t            rtcnt_t;
+typedef uint64_t            rttime_t;
+typedef uint32_t            syssts_t;
+typedef uint8_t             tmode_t;
+typedef uint8_t             tstate_t;
+typedef uint8_t             trefs_t;
+typedef uint8_t             tslices_t;
+typedef uint32_t            tprio_t;
+typedef int32_t             msg_t;
+typedef int32_t             eventid_t;
+typedef uint32_t            eventmask_t;
+typedef uint32_t            eventflags_t;
+typedef int32_t             cnt_t;
+typedef uint32_t            ucnt_t;
+
+#define ROMCONST const
+
+#define NOINLINE __attribute__((noinline))
+
+#define PORT_THD_FUNCTION(tname, arg) void tname(void *arg)
+
+#define PACKED_VAR __attribute__((packed))
+
+#endif /* _CHTYPES_H_ */
@@ -0,0 +1,73 @@
+/*
+ * AnalogX firmware
+ *
+ * Copyright (C) 2017 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SIM_H_
+#define SIM_H_
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+/* Core clock the virtual cycle counter runs at, as on the STM32F042 */
+#define SIM_HCLK                48000000
+#define SIM_NS_PER_SECOND       UINT64_C(1000000000)
+
+/* Virtual time, see sim_time.c */
+uint64_t sim_time_ns(void);
+void sim_time_advance_ns(uint64_t ns);
+uint32_t sim_cycles(void);
+void sim_set_duration_ms(uint64_t ms);
+
+/*
+ * A peripheral interrupt at an exact virtual time; unlike a virtual timer
+ * it is not rounded to the kernel tick. The handler runs in ISR context.
+ */
+struct SimEvent {
+        uint64_t at_ns;
+        void (*handler)(void *arg);
+        void *arg;
+        bool armed;
+        bool linked;
+        struct SimEvent *next;
+};
+
+void sim_event_set(struct SimEvent *ev, uint64_t at_ns, void (*handler)(void *), void *arg);
+void sim_event_cancel(struct SimEvent *ev);
+
+/* Print the report and leave the simulation, see sim_main.c */
+void sim_finish(int status) __attribute__((noreturn));
+
+/* Peripheral models, see sim_hal.c */
+bool sim_adc_load(const char *path);
+void sim_adc_set_noise(double lsb);
+void sim_adc_set_tone(double hz, double lsb);
+void sim_adc_set_supply(uint32_t mv);
+bool sim_can_open(const char *input, const char *output);
+void sim_can_set_load(uint32_t percent, uint32_t seed);
+void sim_can_set_rx_cost(uint32_t cycles);
+void sim_can_set_silent(uint64_t from_ms, uint64_t until_ms);
+void sim_set_jumpers(uint8_t address, bool baud_1m);
+void sim_flash_open(const char *path);
+void sim_report(FILE *out);
+
+/* Log output of the application (SD2) */
+extern FILE *g_sim_serial;
+
+#endif /* SIM_H_ */
@@ -0,0 +1,119 @@
+/*
+ * AnalogX firmware
+ *
+ * Copyright (C) 2017 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Configuration flash model: the system_flash.h API over a RAM copy of
+ * the configuration pages, optionally loaded from and written back to a
+ * file so configuration survives between runs like it does on a device.
+ */
+#include "system_flash.h"
+#include "sim.h"
+#include <string.h>
+
+#define CONFIG_AREA_SIZE        (SYSTEM_FLASH_CONFIG_PAGES * SYSTEM_FLASH_PAGE_SIZE)
+#define ERASED_HALFWORD         0xFFFF
+
+static uint8_t g_config_area[CONFIG_AREA_SIZE] __attribute__((aligned(4)));
+static const char *g_flash_path;
+static bool g_flash_loaded;
+
+static void _load(void)
+{
+        g_flash_loaded = true;
+        memset(g_config_area, 0xFF, sizeof(g_config_area));
+        if (!g_flash_path)
+                return;
+
+        FILE *f = fopen(g_flash_path, "rb");
+        if (!f)
+                return;
+        if (fread(g_config_area, 1, sizeof(g_config_area), f) != sizeof(g_config_area))
+                memset(g_config_area, 0xFF, sizeof(g_config_area));
+        fclose(f);
+}
+
+static void _write_back(void)
+{
+        if (!g_flash_path)
+                return;
+
+        FILE *f = fopen(g_flash_path, "wb");
+        if (!f)
+                return;
+        fwrite(g_config_area, 1, sizeof(g_config_area), f);
+        fclose(f);
+}
+
+void sim_flash_open(const char *path)
+{
+        g_flash_path = path;
+        _load();
+}
+
+const uint8_t * system_flash_config_area(void)
+{
+        if (!g_flash_loaded)
+                _load();
+        return g_config_area;
+}
+
+/* The simulator's own code stands in for the application image */
+const uint8_t * system_flash_image(size_t *length)
+{
+        extern const uint8_t __executable_start[], etext[];
+        *length = etext - __executable_start;
+        return __executable_start;
+}
+
+bool system_flash_erase_config_page(uint32_t page)
+{
+        if (page >= SYSTEM_FLASH_CONFIG_PAGES)
+                return false;
+
+        /* page erase takes ~20ms with the CPU stalled */
+        sim_time_advance_ns(20000000);
+        memset(g_config_area + page * SYSTEM_FLASH_PAGE_SIZE, 0xFF, SYSTEM_FLASH_PAGE_SIZE);
+        _write_back();
+        return true;
+}
+
+/* Like the hardware, programming a non erased half-word fails unless it clears it */
+bool system_flash_program_config(uint32_t offset, const void *data, size_t len)
+{
+        if ((offset & 1) || (len & 1) || offset + len > CONFIG_AREA_SIZE)
+                return false;
+
+        const uint16_t *src = data;
+        uint16_t *dest = (uint16_t *)(g_config_area + offset);
+        bool success = true;
+
+        for (size_t i = 0; i < len / 2 && success; i++) {
+                /* ~50us per half-word */
+                sim_time_advance_ns(50000);
+                if (dest[i] != ERASED_HALFWORD && src[i] != 0) {
+                        success = false;
+                        break;
+                }
+                dest[i] = src[i];
+        }
+        _write_back();
+        return success;
+}
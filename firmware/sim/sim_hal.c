@@ -0,0 +1,1000 @@
+/*
+ * AnalogX firmware
+ *
+ * Copyright (C) 2017 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Peripheral models for the host simulation.
+ *
+ * ADC: conversions take the time the sample time setting implies and
+ * read waveforms from a CSV file (time_ms,analog1..analog4), linearly
+ * interpolated, or built in sine waves without one.
+ *
+ * CAN: an in-process bus with an always acknowledging peer. Frames are
+ * serialized on the wire at the configured bit rate, contending with the
+ * frames of other nodes by arbitration, and the transmitted ones are
+ * written to a candump style log. Other nodes' frames are replayed from
+ * a log in the same format or generated to load the bus.
+ */
+#include "ch.h"
+#include "hal.h"
+#include "sim.h"
+#include "system_CAN.h"
+#include "analogx_api.h"
+#include <inttypes.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define ADC_CLOCK_HZ            14000000
+#define ADC_MAX_CHANNELS        19
+#define ANALOG_INPUTS           4
+#define CAN_RX_FIFO_DEPTH       3
+#define CAN_MAX_IDS             32
+#define CAN_INTERFRAME_BITS     3
+#define LSI_HZ                  40000
+
+/* ADC channels of analog 1..4 (PB1, PA7, PA6, PA5) */
+static const uint8_t g_analog_channels[ANALOG_INPUTS] = {9, 7, 6, 5};
+
+RCC_TypeDef g_sim_rcc;
+SYSCFG_TypeDef g_sim_syscfg;
+GPIO_TypeDef g_sim_gpioa;
+GPIO_TypeDef g_sim_gpiob;
+CAN_TypeDef g_sim_can;
+
+ADCDriver ADCD1;
+stm32_tim_t g_sim_tim1;
+CANDriver CAND1;
+SerialDriver SD1;
+SerialDriver SD2;
+WDGDriver WDGD1;
+
+FILE *g_sim_serial;
+
+/*===========================================================================*/
+/* PAL                                                                       */
+/*===========================================================================*/
+
+void palSetGroupMode(ioportid_t port, ioportmask_t mask, uint32_t offset, iomode_t mode)
+{
+        (void)port;
+        (void)mask;
+        (void)offset;
+        (void)mode;
+}
+
+/* Jumper inputs: PA0 / PA4 select the address offset, PA2 the baud rate */
+void sim_set_jumpers(uint8_t address, bool baud_1m)
+{
+        g_sim_gpioa.IDR = (address & 0x01 ? PAL_PORT_BIT(0) : 0) |
+                          (address & 0x02 ? PAL_PORT_BIT(4) : 0) |
+                          (baud_1m ? PAL_PORT_BIT(2) : 0);
+}
+
+/*===========================================================================*/
+/* ADC                                                                       */
+/*===========================================================================*/
+
+struct WaveformRow {
+        uint64_t time_ns;
+        uint16_t values[ANALOG_INPUTS];
+};
+
+static struct WaveformRow *g_wave;
+static size_t g_wave_rows;
+
+/* Gaussian noise added to the analog inputs, LSB rms */
+static double g_adc_noise_lsb;
+static uint32_t g_adc_noise_seed = 1;
+
+/*
+ * The ADC's supply: inputs, VREFINT and the temperature sensor are fixed
+ * voltages, so their codes scale inversely with it. The calibration is
+ * that of a part reading 25C in the model at 3.3V.
+ */
+#define SIM_CAL_SUPPLY_MV       3300
+static uint32_t g_adc_supply_mv = SIM_CAL_SUPPLY_MV;
+const uint16_t g_sim_vrefint_cal = 1500;
+const uint16_t g_sim_ts_cal[2] = {1723, 1296};
+
+/* Sine added to the analog inputs, as a knock or vibration sensor */
+static double g_adc_tone_hz;
+static double g_adc_tone_lsb;
+
+/* Sample time settings in half ADC clock cycles, plus 12.5 for conversion */
+static const uint16_t g_smpr_half_cycles[] = {3, 15, 27, 57, 83, 111, 143, 479};
+
+bool sim_adc_load(const char *path)
+{
+        FILE *f = fopen(path, "r");
+        if (!f)
+                return false;
+
+        char line[256];
+        while (fgets(line, sizeof(line), f)) {
+                double time_ms;
+                unsigned v[ANALOG_INPUTS];
+                if (sscanf(line, "%lf,%u,%u,%u,%u", &time_ms, &v[0], &v[1], &v[2], &v[3]) != 5)
+                        continue;
+                g_wave = realloc(g_wave, (g_wave_rows + 1) * sizeof(*g_wave));
+                g_wave[g_wave_rows].time_ns = (uint64_t)(time_ms * 1000000);
+                for (size_t i = 0; i < ANALOG_INPUTS; i++)
+                        g_wave[g_wave_rows].values[i] = v[i] > 4095 ? 4095 : v[i];
+                g_wave_rows++;
+        }
+        fclose(f);
+        return g_wave_rows > 0;
+}
+
+static uint16_t _analog_value(size_t input, uint64_t now)
+{
+        if (!g_wave_rows) {
+                double t = now / (double)SIM_NS_PER_SECOND;
+                return 2048 + (int)(1500 * sin(2 * M_PI * 0.5 * (input + 1) * t));
+        }
+
+        size_t i = 0;
+        while (i + 1 < g_wave_rows && g_wave[i + 1].time_ns <= now)
+                i++;
+        if (i + 1 == g_wave_rows || now <= g_wave[i].time_ns)
+                return g_wave[i].values[input];
+
+        const struct WaveformRow *a = &g_wave[i];
+        const struct WaveformRow *b = &g_wave[i + 1];
+        double f = (double)(now - a->time_ns) / (b->time_ns - a->time_ns);
+        return a->values[input] + (int)((b->values[input] - a->values[input]) * f);
+}
+
+void sim_adc_set_noise(double lsb)
+{
+        g_adc_noise_lsb = lsb;
+}
+
+void sim_adc_set_supply(uint32_t mv)
+{
+        g_adc_supply_mv = mv;
+}
+
+void sim_adc_set_tone(double hz, double lsb)
+{
+        g_adc_tone_hz = hz;
+        g_adc_tone_lsb = lsb;
+}
+
+/* Approximately normal, from the sum of twelve uniform values */
+static double _adc_noise(void)
+{
+        double sum = 0;
+        for (int i = 0; i < 12; i++) {
+                g_adc_noise_seed = g_adc_noise_seed * 1103515245 + 12345;
+                sum += (g_adc_noise_seed >> 8) / (double)(1 << 24);
+        }
+        return (sum - 6) * g_adc_noise_lsb;
+}
+
+static uint16_t _supply_scaled(uint32_t value)
+{
+        value = value * SIM_CAL_SUPPLY_MV / g_adc_supply_mv;
+        return value > 4095 ? 4095 : value;
+}
+
+static uint16_t _channel_value(uint32_t channel, uint64_t now)
+{
+        for (size_t i = 0; i < ANALOG_INPUTS; i++) {
+                if (g_analog_channels[i] != channel)
+                        continue;
+                /* waveforms are codes at the calibration supply */
+                if (!g_adc_noise_lsb && !g_adc_tone_lsb)
+                        return _supply_scaled(_analog_value(i, now));
+                double t = now / (double)SIM_NS_PER_SECOND;
+                double tone = g_adc_tone_lsb * sin(2 * M_PI * g_adc_tone_hz * t);
+                int value = _analog_value(i, now) + (int)lround(tone + (g_adc_noise_lsb ? _adc_noise() : 0));
+                return _supply_scaled(value < 0 ? 0 : value > 4095 ? 4095 : value);
+        }
+        /* temperature sensor near 25C and VREFINT, per the datasheet */
+        if (channel == 16)
+                return _supply_scaled(1750);
+        if (channel == 17)
+                return _supply_scaled(1500);
+        return 0;
+}
+
+void adcStart(ADCDriver *adcp, const ADCConfig *config)
+{
+        (void)config;
+        adcp->started = true;
+}
+
+void adcStop(ADCDriver *adcp)
+{
+        adcp->started = false;
+}
+
+static uint64_t _conversion_ns(const ADCConversionGroup *grpp)
+{
+        uint32_t half_cycles = g_smpr_half_cycles[grpp->smpr & 7] + 25;
+        return half_cycles * SIM_NS_PER_SECOND / (2 * ADC_CLOCK_HZ);
+}
+
+/* Convert one scan, the first conversion ending at now; returns its end */
+static uint64_t _convert_scan(const ADCConversionGroup *grpp, adcsample_t **p, uint64_t now)
+{
+        uint64_t conversion_ns = _conversion_ns(grpp);
+        uint32_t resolution_shift = ((grpp->cfgr1 >> 3) & 3) * 2;
+        bool backward = grpp->cfgr1 & ADC_CFGR1_SCANDIR;
+
+        for (uint32_t i = 0; i < ADC_MAX_CHANNELS; i++) {
+                uint32_t channel = backward ? ADC_MAX_CHANNELS - 1 - i : i;
+                if (!(grpp->chselr & ADC_CHSELR_CHSEL(channel)))
+                        continue;
+                *(*p)++ = _channel_value(channel, now) >> resolution_shift;
+                now += conversion_ns;
+        }
+        return now - conversion_ns;
+}
+
+msg_t adcConvert(ADCDriver *adcp, const ADCConversionGroup *grpp,
+                 adcsample_t *samples, size_t depth)
+{
+        uint64_t conversion_ns = _conversion_ns(grpp);
+        adcsample_t *p = samples;
+
+        for (size_t d = 0; d < depth; d++) {
+                /* the converting thread is busy for the conversion time */
+                uint64_t end = _convert_scan(grpp, &p, sim_time_ns() + conversion_ns);
+                sim_time_advance_ns(end - sim_time_ns());
+        }
+        adcp->conversions += depth;
+
+        if (grpp->end_cb)
+                grpp->end_cb(adcp, samples, depth);
+        return MSG_OK;
+}
+
+/*
+ * Continuous conversions into a circular buffer. The DMA fills it in the
+ * background: each half is converted with the times of its scans and
+ * handed to the callback as its last scan would complete. Hardware
+ * triggered groups start a scan on each TIM1 update instead, at the rate
+ * the timer was set to when conversion started; a trigger that comes
+ * while a scan is still converting is lost, as on the chip.
+ */
+static struct SimEvent g_adc_event;
+static const ADCConversionGroup *g_adc_group;
+static adcsample_t *g_adc_buffer;
+static size_t g_adc_depth;
+static size_t g_adc_half;
+static uint64_t g_adc_next_ns;
+static uint64_t g_adc_trigger_ns;
+static uint64_t g_adc_period_ns;
+
+static uint64_t _scan_ns(const ADCConversionGroup *grpp)
+{
+        return __builtin_popcount(grpp->chselr) * _conversion_ns(grpp);
+}
+
+static uint64_t _trigger_period_ns(const ADCConversionGroup *grpp)
+{
+        if (!(grpp->cfgr1 & ADC_CFGR1_EXTEN_MASK))
+                return 0;
+        if (!(g_sim_tim1.CR1 & STM32_TIM_CR1_CEN))
+                return UINT64_MAX;
+        uint64_t period = (uint64_t)(g_sim_tim1.PSC + 1) * (g_sim_tim1.ARR + 1) *
+                          SIM_NS_PER_SECOND / STM32_TIMCLK1;
+        uint64_t scan_ns = _scan_ns(grpp);
+        return (scan_ns + period - 1) / period * period;
+}
+
+static uint64_t _half_ns(void)
+{
+        uint64_t period = g_adc_period_ns ? g_adc_period_ns : _scan_ns(g_adc_group);
+        return g_adc_depth / 2 * period;
+}
+
+static void _adc_half_complete(void *arg)
+{
+        ADCDriver *adcp = arg;
+        uint32_t channels = __builtin_popcount(g_adc_group->chselr);
+        adcsample_t *half = g_adc_buffer + g_adc_half * g_adc_depth / 2 * channels;
+        adcsample_t *p = half;
+        uint64_t conversion_ns = _conversion_ns(g_adc_group);
+
+        for (size_t d = 0; d < g_adc_depth / 2; d++) {
+                uint64_t start = g_adc_next_ns;
+                if (g_adc_period_ns)
+                        start = g_adc_trigger_ns += g_adc_period_ns;
+                g_adc_next_ns = _convert_scan(g_adc_group, &p, start + conversion_ns);
+        }
+        adcp->conversions += g_adc_depth / 2;
+        g_adc_half ^= 1;
+
+        const ADCConversionGroup *grpp = g_adc_group;
+        if (grpp->circular)
+                sim_event_set(&g_adc_event, g_adc_next_ns + _half_ns(), _adc_half_complete, adcp);
+        if (grpp->end_cb)
+                grpp->end_cb(adcp, half, g_adc_depth / 2);
+}
+
+void adcStartConversion(ADCDriver *adcp, const ADCConversionGroup *grpp,
+                        adcsample_t *samples, size_t depth)
+{
+        g_adc_group = grpp;
+        g_adc_buffer = samples;
+        g_adc_depth = depth;
+        g_adc_half = 0;
+        g_adc_next_ns = g_adc_trigger_ns = sim_time_ns();
+        g_adc_period_ns = _trigger_period_ns(grpp);
+        /* no trigger, no scans */
+        if (g_adc_period_ns == UINT64_MAX)
+                return;
+        sim_event_set(&g_adc_event, g_adc_next_ns + _half_ns(), _adc_half_complete, adcp);
+}
+
+void adcStopConversion(ADCDriver *adcp)
+{
+        (void)adcp;
+        sim_event_cancel(&g_adc_event);
+}
+
+/*===========================================================================*/
+/* CAN                                                                       */
+/*===========================================================================*/
+
+/* A frame of another node, from the input log or the traffic generator */
+struct ForeignFrame {
+        bool pending;
+        uint64_t ready_ns;
+        CANRxFrame frame;
+};
+
+struct TxMailbox {
+        bool busy;
+        uint32_t order;
+        uint64_t queued_ns;
+        CANTxFrame frame;
+};
+
+struct IdStats {
+        uint32_t id;
+        uint32_t frames;
+        uint64_t first_ns;
+        uint64_t last_ns;
+        uint64_t interval_max_ns;
+        uint64_t latency_sum_ns;
+        uint64_t latency_max_ns;
+};
+
+static struct TxMailbox g_tx_mailboxes[CAN_TX_MAILBOXES];
+static uint32_t g_tx_order;
+
+/* The frame on the wire: a mailbox index, or -1 for a foreign frame */
+static bool g_bus_busy;
+static int g_bus_mailbox;
+static struct ForeignFrame *g_bus_foreign;
+static uint64_t g_bus_start_ns;
+static uint64_t g_bus_busy_ns;
+static struct SimEvent g_bus_event;
+static struct SimEvent g_foreign_event;
+
+static FILE *g_can_in;
+static FILE *g_can_out;
+static struct ForeignFrame g_replay;
+static struct ForeignFrame g_generated;
+static uint32_t g_load_percent;
+static uint32_t g_load_seed;
+
+/* While silent nobody else is on the bus: no traffic and no acknowledges */
+static uint64_t g_silent_from_ns;
+static uint64_t g_silent_until_ns;
+static uint32_t g_tx_unacked;
+
+/* The receive FIFO; without filters set the driver routes all to FIFO 0 */
+static CANRxFrame g_rx_fifo[CAN_RX_FIFO_DEPTH];
+static size_t g_rx_head;
+static size_t g_rx_count;
+static size_t g_rx_high_water;
+static uint32_t g_rx_delivered;
+static uint32_t g_rx_overruns;
+static uint32_t g_rx_read;
+
+/* Per frame cost charged to the reading thread, and host time measured */
+static uint64_t g_rx_cost_ns;
+static bool g_rx_timing;
+static uint64_t g_rx_host_start_ns;
+static uint64_t g_rx_host_sum_ns;
+static uint64_t g_rx_host_max_ns;
+static uint32_t g_rx_host_frames;
+
+static struct IdStats g_id_stats[CAN_MAX_IDS];
+static size_t g_id_count;
+
+static uint64_t _host_ns(void)
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * SIM_NS_PER_SECOND + ts.tv_nsec;
+}
+
+static uint32_t _bitrate(const CANConfig *config)
+{
+        uint32_t btr = config->btr;
+        uint32_t brp = (btr & 0x3FF) + 1;
+        uint32_t ts1 = ((btr >> 16) & 0xF) + 1;
+        uint32_t ts2 = ((btr >> 20) & 0x7) + 1;
+        return STM32_PCLK / (brp * (1 + ts1 + ts2));
+}
+
+/* Time on the wire, without stuff bits */
+static uint64_t _frame_ns(uint8_t ide, uint8_t dlc)
+{
+        uint32_t bits = (ide == CAN_IDE_EXT ? 67 : 47) + 8 * dlc + CAN_INTERFRAME_BITS;
+        return bits * SIM_NS_PER_SECOND / _bitrate(CAND1.config);
+}
+
+static uint32_t _frame_id(uint8_t ide, uint32_t sid, uint32_t eid)
+{
+        return ide == CAN_IDE_EXT ? eid : sid;
+}
+
+/*
+ * Arbitration order, lowest wins: the 11 bit base ID, then a standard
+ * frame beats an extended one, then the 18 bit ID extension.
+ */
+static uint32_t _arbitration_key(uint8_t ide, uint32_t sid, uint32_t eid)
+{
+        if (ide == CAN_IDE_EXT)
+                return ((eid >> 18) << 19) | (1U << 18) | (eid & 0x3FFFF);
+        return sid << 19;
+}
+
+static void _record_tx(const struct TxMailbox *mbx, uint64_t done_ns)
+{
+        uint32_t id = _frame_id(mbx->frame.IDE, mbx->frame.SID, mbx->frame.EID);
+        struct IdStats *stats = NULL;
+        for (size_t i = 0; i < g_id_count; i++) {
+                if (g_id_stats[i].id == id)
+                        stats = &g_id_stats[i];
+        }
+        if (!stats && g_id_count < CAN_MAX_IDS) {
+                stats = &g_id_stats[g_id_count++];
+                stats->id = id;
+                stats->first_ns = done_ns;
+                stats->last_ns = done_ns;
+        }
+        if (stats) {
+                uint64_t latency = done_ns - mbx->queued_ns;
+                uint64_t interval = done_ns - stats->last_ns;
+                stats->frames++;
+                stats->last_ns = done_ns;
+                stats->latency_sum_ns += latency;
+                if (latency > stats->latency_max_ns)
+                        stats->latency_max_ns = latency;
+                if (interval > stats->interval_max_ns)
+                        stats->interval_max_ns = interval;
+        }
+
+        if (g_can_out) {
+                fprintf(g_can_out, "(%010" PRIu64 ".%06" PRIu64 ") can0 ",
+                        done_ns / SIM_NS_PER_SECOND, done_ns % SIM_NS_PER_SECOND / 1000);
+                fprintf(g_can_out, mbx->frame.IDE == CAN_IDE_EXT ? "%08X#" : "%03X#", id);
+                for (size_t i = 0; i < mbx->frame.DLC; i++)
+                        fprintf(g_can_out, "%02X", mbx->frame.data8[i]);
+                fputc('\n', g_can_out);
+        }
+}
+
+static void _rx_push_i(const CANRxFrame *frame)
+{
+        if (CAND1.state == CAN_SLEEP && (CAND1.config->mcr & CAN_MCR_AWUM)) {
+                CAND1.state = CAN_READY;
+                chEvtBroadcastI(&CAND1.wakeup_event);
+        }
+        if (CAND1.state != CAN_READY)
+                return;
+        if (g_rx_count == CAN_RX_FIFO_DEPTH) {
+                g_rx_overruns++;
+                return;
+        }
+        g_rx_fifo[(g_rx_head + g_rx_count) % CAN_RX_FIFO_DEPTH] = *frame;
+        g_rx_count++;
+        g_rx_delivered++;
+        if (g_rx_count > g_rx_high_water)
+                g_rx_high_water = g_rx_count;
+        chThdDequeueAllI(&CAND1.rxqueue, MSG_OK);
+        chEvtBroadcastFlagsI(&CAND1.rxfull_event, CAN_MAILBOX_TO_MASK(1));
+}
+
+/* Read the next frame to replay from the candump style input log */
+static void _replay_next(void)
+{
+        char line[256];
+        g_replay.pending = false;
+        while (g_can_in && fgets(line, sizeof(line), g_can_in)) {
+                unsigned long sec, usec;
+                char id[16], data[32];
+                if (sscanf(line, " (%lu.%lu) %*s %15[0-9A-Fa-f]#%31[0-9A-Fa-f]", &sec, &usec, id, data) < 3)
+                        continue;
+
+                CANRxFrame *frame = &g_replay.frame;
+                memset(frame, 0, sizeof(*frame));
+                frame->IDE = strlen(id) > 3 ? CAN_IDE_EXT : CAN_IDE_STD;
+                if (frame->IDE == CAN_IDE_EXT)
+                        frame->EID = strtoul(id, NULL, 16);
+                else
+                        frame->SID = strtoul(id, NULL, 16);
+                size_t len = strchr(line, '#')[1] == '\n' ? 0 : strlen(data) / 2;
+                frame->DLC = len > 8 ? 8 : len;
+                for (size_t i = 0; i < frame->DLC; i++) {
+                        char byte[3] = {data[2 * i], data[2 * i + 1], 0};
+                        frame->data8[i] = strtoul(byte, NULL, 16);
+                }
+                g_replay.ready_ns = sec * SIM_NS_PER_SECOND + usec * 1000;
+                g_replay.pending = true;
+                return;
+        }
+}
+
+static uint32_t _random(void)
+{
+        g_load_seed = g_load_seed * 1103515245 + 12345;
+        return g_load_seed >> 8;
+}
+
+/*
+ * Synthetic traffic of other nodes: a mix of standard and extended IDs
+ * outside our API range with random lengths, spaced to load the bus
+ * to the requested percentage.
+ */
+static void _generate_next(void)
+{
+        CANRxFrame *frame = &g_generated.frame;
+        uint32_t base = get_can_base_id();
+        memset(frame, 0, sizeof(*frame));
+        do {
+                if (_random() % 10 < 7) {
+                        frame->IDE = CAN_IDE_STD;
+                        frame->SID = _random() & 0x7FF;
+                } else {
+                        frame->IDE = CAN_IDE_EXT;
+                        frame->EID = _random() & 0x1FFFFFFF;
+                }
+        } while (frame->IDE == CAN_IDE_EXT && frame->EID - base < ANALOGX_CAN_API_RANGE);
+        frame->DLC = _random() % 9;
+        for (size_t i = 0; i < frame->DLC; i++)
+                frame->data8[i] = _random();
+
+        uint64_t spacing = _frame_ns(frame->IDE, frame->DLC) * 100 / g_load_percent;
+        g_generated.ready_ns = g_generated.pending ? g_generated.ready_ns + spacing : sim_time_ns();
+        g_generated.pending = true;
+}
+
+/* The next foreign frame to contend for the bus */
+static struct ForeignFrame *_foreign_next(void)
+{
+        if (g_replay.pending && (!g_generated.pending || g_replay.ready_ns <= g_generated.ready_ns))
+                return &g_replay;
+        return g_generated.pending ? &g_generated : NULL;
+}
+
+/* Our next mailbox to transmit, by request order or ID */
+static int _tx_next(void)
+{
+        int next = -1;
+        for (int i = 0; i < CAN_TX_MAILBOXES; i++) {
+                struct TxMailbox *m = &g_tx_mailboxes[i];
+                if (!m->busy)
+                        continue;
+                if (next < 0) {
+                        next = i;
+                        continue;
+                }
+                struct TxMailbox *n = &g_tx_mailboxes[next];
+                bool earlier = CAND1.config->mcr & CAN_MCR_TXFP ? m->order < n->order :
+                        _arbitration_key(m->frame.IDE, m->frame.SID, m->frame.EID) <
+                        _arbitration_key(n->frame.IDE, n->frame.SID, n->frame.EID);
+                if (earlier)
+                        next = i;
+        }
+        return next;
+}
+
+static void _bus_frame_end(void *p);
+static void _foreign_ready(void *p);
+
+static bool _bus_silent(uint64_t now)
+{
+        return now >= g_silent_from_ns && now < g_silent_until_ns;
+}
+
+/* With the bus idle, start the frame that wins arbitration */
+static void _bus_schedule_i(void)
+{
+        if (g_bus_busy || CAND1.state == CAN_STOP)
+                return;
+
+        uint64_t now = sim_time_ns();
+        int mailbox = CAND1.state == CAN_READY ? _tx_next() : -1;
+        struct ForeignFrame *foreign = _foreign_next();
+        /* the other nodes come back when the silence ends */
+        if (foreign && _bus_silent(foreign->ready_ns))
+                foreign->ready_ns = g_silent_until_ns;
+        bool foreign_ready = foreign && foreign->ready_ns <= now;
+
+        if (foreign_ready && mailbox >= 0) {
+                const CANTxFrame *tx = &g_tx_mailboxes[mailbox].frame;
+                if (_arbitration_key(tx->IDE, tx->SID, tx->EID) <
+                    _arbitration_key(foreign->frame.IDE, foreign->frame.SID, foreign->frame.EID))
+                        foreign_ready = false;
+        }
+
+        uint64_t frame_ns;
+        if (foreign_ready) {
+                g_bus_foreign = foreign;
+                g_bus_mailbox = -1;
+                frame_ns = _frame_ns(foreign->frame.IDE, foreign->frame.DLC);
+        } else if (mailbox >= 0) {
+                g_bus_foreign = NULL;
+                g_bus_mailbox = mailbox;
+                frame_ns = _frame_ns(g_tx_mailboxes[mailbox].frame.IDE, g_tx_mailboxes[mailbox].frame.DLC);
+        } else {
+                if (foreign)
+                        sim_event_set(&g_foreign_event, foreign->ready_ns, _foreign_ready, NULL);
+                return;
+        }
+        g_bus_busy = true;
+        g_bus_start_ns = now;
+        sim_event_set(&g_bus_event, now + frame_ns, _bus_frame_end, NULL);
+}
+
+static void _foreign_ready(void *p)
+{
+        (void)p;
+        chSysLockFromISR();
+        _bus_schedule_i();
+        chSysUnlockFromISR();
+}
+
+/* The empty flags, and in CODE the mailbox the LLD fills next */
+static void _tx_mailbox_set_empty_i(int index, bool empty)
+{
+        uint32_t tsr = CAND1.can->TSR & ~CAN_TSR_CODE;
+        if (empty)
+                tsr |= CAN_TSR_TME0 << index;
+        else
+                tsr &= ~(CAN_TSR_TME0 << index);
+        for (int i = 0; i < CAN_TX_MAILBOXES; i++) {
+                if (tsr & (CAN_TSR_TME0 << i)) {
+                        tsr |= (uint32_t)i << 24;
+                        break;
+                }
+        }
+        CAND1.can->TSR = tsr;
+}
+
+static void _tx_complete_i(int index)
+{
+        struct TxMailbox *mbx = &g_tx_mailboxes[index];
+        if (_bus_silent(g_bus_start_ns)) {
+                /* not acknowledged, and with NART set not retried */
+                g_tx_unacked++;
+                mbx->busy = false;
+                _tx_mailbox_set_empty_i(index, true);
+                chThdDequeueAllI(&CAND1.txqueue, MSG_OK);
+                chEvtBroadcastFlagsI(&CAND1.txempty_event, CAN_MAILBOX_TO_MASK(index + 1) << 16);
+                return;
+        }
+        _record_tx(mbx, sim_time_ns());
+        if (CAND1.config->btr & CAN_BTR_LBKM) {
+                CANRxFrame rx = {0};
+                rx.IDE = mbx->frame.IDE;
+                rx.RTR = mbx->frame.RTR;
+                rx.DLC = mbx->frame.DLC;
+                rx.EID = mbx->frame.EID;
+                rx.data64[0] = mbx->frame.data64[0];
+                _rx_push_i(&rx);
+        }
+        mbx->busy = false;
+        _tx_mailbox_set_empty_i(index, true);
+        chThdDequeueAllI(&CAND1.txqueue, MSG_OK);
+        chEvtBroadcastFlagsI(&CAND1.txempty_event, CAN_MAILBOX_TO_MASK(index + 1));
+}
+
+static void _bus_frame_end(void *p)
+{
+        (void)p;
+        chSysLockFromISR();
+        g_bus_busy = false;
+        g_bus_busy_ns += sim_time_ns() - g_bus_start_ns;
+        if (g_bus_mailbox >= 0) {
+                _tx_complete_i(g_bus_mailbox);
+        } else {
+                _rx_push_i(&g_bus_foreign->frame);
+                if (g_bus_foreign == &g_replay)
+                        _replay_next();
+                else
+                        _generate_next();
+        }
+        _bus_schedule_i();
+        chSysUnlockFromISR();
+}
+
+bool sim_can_open(const char *input, const char *output)
+{
+        if (input && !(g_can_in = fopen(input, "r")))
+                return false;
+        if (output && !(g_can_out = strcmp(output, "-") ? fopen(output, "w") : stdout))
+                return false;
+        _replay_next();
+        return true;
+}
+
+void sim_can_set_load(uint32_t percent, uint32_t seed)
+{
+        g_load_percent = percent > 100 ? 100 : percent;
+        g_load_seed = seed;
+}
+
+void sim_can_set_silent(uint64_t from_ms, uint64_t until_ms)
+{
+        g_silent_from_ns = from_ms * 1000000;
+        g_silent_until_ns = until_ms * 1000000;
+}
+
+void sim_can_set_rx_cost(uint32_t cycles)
+{
+        g_rx_cost_ns = (uint64_t)cycles * SIM_NS_PER_SECOND / STM32_HCLK;
+}
+
+void canStart(CANDriver *canp, const CANConfig *config)
+{
+        chSysLock();
+        canp->config = config;
+        canp->state = CAN_READY;
+        canp->can->TSR = CAN_TSR_TME;
+        if (g_load_percent && !g_generated.pending)
+                _generate_next();
+        _bus_schedule_i();
+        chSysUnlock();
+}
+
+void canStop(CANDriver *canp)
+{
+        chSysLock();
+        canp->state = CAN_STOP;
+        chThdDequeueAllI(&canp->txqueue, MSG_RESET);
+        chThdDequeueAllI(&canp->rxqueue, MSG_RESET);
+        chSchRescheduleS();
+        chSysUnlock();
+}
+
+msg_t canTransmit(CANDriver *canp, canmbx_t mailbox, const CANTxFrame *ctfp, systime_t timeout)
+{
+        chSysLock();
+        while (true) {
+                if (canp->state == CAN_READY) {
+                        for (int i = 0; i < CAN_TX_MAILBOXES; i++) {
+                                struct TxMailbox *m = &g_tx_mailboxes[i];
+                                if (m->busy || (mailbox != CAN_ANY_MAILBOX && mailbox != (canmbx_t)(i + 1)))
+                                        continue;
+                                m->busy = true;
+                                m->order = g_tx_order++;
+                                m->queued_ns = sim_time_ns();
+                                m->frame = *ctfp;
+                                _tx_mailbox_set_empty_i(i, false);
+                                _bus_schedule_i();
+                                chSysUnlock();
+                                return MSG_OK;
+                        }
+                }
+                msg_t msg = chThdEnqueueTimeoutS(&canp->txqueue, timeout);
+                if (msg != MSG_OK) {
+                        chSysUnlock();
+                        return msg;
+                }
+        }
+}
+
+/*
+ * The time from one frame being returned to the next call is the cost of
+ * processing it; measured on the host, and charged in virtual time.
+ */
+msg_t canReceive(CANDriver *canp, canmbx_t mailbox, CANRxFrame *crfp, systime_t timeout)
+{
+        (void)mailbox;
+        if (g_rx_timing) {
+                uint64_t host_ns = _host_ns() - g_rx_host_start_ns;
+                g_rx_host_sum_ns += host_ns;
+                g_rx_host_frames++;
+                if (host_ns > g_rx_host_max_ns)
+                        g_rx_host_max_ns = host_ns;
+                g_rx_timing = false;
+                sim_time_advance_ns(g_rx_cost_ns);
+        }
+
+        chSysLock();
+        while (g_rx_count == 0) {
+                msg_t msg = chThdEnqueueTimeoutS(&canp->rxqueue, timeout);
+                if (msg != MSG_OK) {
+                        chSysUnlock();
+                        return msg;
+                }
+        }
+        *crfp = g_rx_fifo[g_rx_head];
+        g_rx_head = (g_rx_head + 1) % CAN_RX_FIFO_DEPTH;
+        g_rx_count--;
+        g_rx_read++;
+        chSysUnlock();
+
+        g_rx_timing = true;
+        g_rx_host_start_ns = _host_ns();
+        return MSG_OK;
+}
+
+void canSleep(CANDriver *canp)
+{
+        chSysLock();
+        if (canp->state == CAN_READY) {
+                canp->state = CAN_SLEEP;
+                chEvtBroadcastI(&canp->sleep_event);
+                chSchRescheduleS();
+        }
+        chSysUnlock();
+}
+
+void canWakeup(CANDriver *canp)
+{
+        chSysLock();
+        if (canp->state == CAN_SLEEP) {
+                canp->state = CAN_READY;
+                chEvtBroadcastI(&canp->wakeup_event);
+                _bus_schedule_i();
+                chSchRescheduleS();
+        }
+        chSysUnlock();
+}
+
+/*===========================================================================*/
+/* Serial                                                                    */
+/*===========================================================================*/
+
+static size_t _serial_write(void *ip, const uint8_t *bp, size_t n)
+{
+        (void)ip;
+        return fwrite(bp, 1, n, g_sim_serial);
+}
+
+static size_t _serial_read(void *ip, uint8_t *bp, size_t n)
+{
+        (void)ip;
+        (void)bp;
+        (void)n;
+        return 0;
+}
+
+static msg_t _serial_put(void *ip, uint8_t b)
+{
+        (void)ip;
+        fputc(b, g_sim_serial);
+        return MSG_OK;
+}
+
+/* There is no serial input in the simulation */
+static msg_t _serial_get(void *ip)
+{
+        (void)ip;
+        return MSG_RESET;
+}
+
+static const struct BaseSequentialStreamVMT g_serial_vmt = {
+        _serial_write, _serial_read, _serial_put, _serial_get
+};
+
+void sdStart(SerialDriver *sdp, const SerialConfig *config)
+{
+        (void)config;
+        sdp->started = true;
+}
+
+/*===========================================================================*/
+/* Watchdog and reset                                                        */
+/*===========================================================================*/
+
+static void _wdg_expired(void *p)
+{
+        (void)p;
+        fprintf(stderr, "sim: watchdog expired at %.3f s\n", sim_time_ns() / (double)SIM_NS_PER_SECOND);
+        sim_finish(EXIT_FAILURE);
+}
+
+static systime_t _wdg_timeout(const WDGConfig *config)
+{
+        uint32_t divider = 4U << config->pr;
+        return MS2ST((uint64_t)config->rlr * divider * 1000 / LSI_HZ);
+}
+
+void wdgStart(WDGDriver *wdgp, const WDGConfig *config)
+{
+        wdgp->config = config;
+        chVTSet(&wdgp->expiry, _wdg_timeout(config), _wdg_expired, NULL);
+}
+
+void wdgReset(WDGDriver *wdgp)
+{
+        chVTSet(&wdgp->expiry, _wdg_timeout(wdgp->config), _wdg_expired, NULL);
+}
+
+void NVIC_SystemReset(void)
+{
+        fprintf(stderr, "sim: system reset requested at %.3f s\n", sim_time_ns() / (double)SIM_NS_PER_SECOND);
+        sim_finish(EXIT_SUCCESS);
+}
+
+/*===========================================================================*/
+/* HAL                                                                       */
+/*===========================================================================*/
+
+void halInit(void)
+{
+        if (!g_sim_serial)
+                g_sim_serial = stdout;
+        SD1.vmt = &g_serial_vmt;
+        SD2.vmt = &g_serial_vmt;
+
+        CAND1.state = CAN_STOP;
+        CAND1.can = CAN;
+        chThdQueueObjectInit(&CAND1.txqueue);
+        chThdQueueObjectInit(&CAND1.rxqueue);
+        chEvtObjectInit(&CAND1.rxfull_event);
+        chEvtObjectInit(&CAND1.txempty_event);
+        chEvtObjectInit(&CAND1.error_event);
+        chEvtObjectInit(&CAND1.sleep_event);
+        chEvtObjectInit(&CAND1.wakeup_event);
+        chVTObjectInit(&WDGD1.expiry);
+}
+
+/* Summary of what was observed on the simulated bus */
+void sim_report(FILE *out)
+{
+        uint64_t now = sim_time_ns();
+        double seconds = now / (double)SIM_NS_PER_SECOND;
+        fprintf(out, "sim: %.3f s simulated, %u ADC scans\n", seconds, ADCD1.conversions);
+        fprintf(out, "sim: CAN bus load %.1f%%\n", now ? 100.0 * g_bus_busy_ns / now : 0.0);
+
+        uint32_t received = g_rx_delivered + g_rx_overruns;
+        fprintf(out, "sim: CAN rx frames %u (%.0f/s) read %u dropped %u (%.3f%%) FIFO high water %zu/%u\n",
+                received, seconds > 0 ? received / seconds : 0.0, g_rx_read, g_rx_overruns,
+                received ? 100.0 * g_rx_overruns / received : 0.0, g_rx_high_water, CAN_RX_FIFO_DEPTH);
+        if (g_silent_until_ns)
+                fprintf(out, "sim: CAN tx frames not acknowledged %u\n", g_tx_unacked);
+        if (g_rx_host_frames)
+                fprintf(out, "sim: CAN rx processing host ns/frame avg %" PRIu64 " max %" PRIu64 ", charged %" PRIu64 " ns/frame\n",
+                        g_rx_host_sum_ns / g_rx_host_frames, g_rx_host_max_ns, g_rx_cost_ns);
+
+        for (size_t i = 0; i < g_id_count; i++) {
+                struct IdStats *s = &g_id_stats[i];
+                double span = (s->last_ns - s->first_ns) / (double)SIM_NS_PER_SECOND;
+                fprintf(out, "sim: CAN tx id 0x%08X frames %u rate %.2f Hz interval max %" PRIu64 " us"
+                        " latency avg %" PRIu64 " us max %" PRIu64 " us\n",
+                        s->id, s->frames, s->frames > 1 && span > 0 ? (s->frames - 1) / span : 0.0,
+                        s->interval_max_ns / 1000, s->latency_sum_ns / s->frames / 1000,
+                        s->latency_max_ns / 1000);
+        }
+}
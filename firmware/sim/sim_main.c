@@ -0,0 +1,219 @@
+/*
+ * AnalogX firmware
+ *
+ * Copyright (C) 2017 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Host simulation entry point: parses the model options and runs the
+ * application's main() (built as analogx_main) in virtual time.
+ */
+#include "ch.h"
+#include "hal.h"
+#include "sim.h"
+#include "logging.h"
+#include <getopt.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DEFAULT_DURATION_MS     10000
+#define DEFAULT_RX_CYCLES       600
+
+int analogx_main(void);
+
+/*
+ * Stand-ins for the linker script symbols: the exception and process
+ * stacks runtime_stats.c reads watermarks from, filled with the stack
+ * fill pattern so they read as unused, and the core memory heap.
+ */
+__asm__(".data\n"
+        ".balign 4\n"
+        ".globl __main_stack_base__\n"
+        "__main_stack_base__:\n"
+        ".fill 256, 1, 0x55\n"
+        ".globl __main_stack_end__\n"
+        "__main_stack_end__:\n"
+        ".globl __process_stack_base__\n"
+        "__process_stack_base__:\n"
+        ".fill 256, 1, 0x55\n"
+        ".globl __process_stack_end__\n"
+        "__process_stack_end__:\n"
+        ".balign 8\n"
+        ".globl __heap_base__\n"
+        "__heap_base__:\n"
+        ".fill 4096, 1, 0\n"
+        ".globl __heap_end__\n"
+        "__heap_end__:\n"
+        ".text\n");
+
+static void _usage(const char *name)
+{
+        fprintf(stderr,
+                "usage: %s [options]\n"
+                "  --duration MS     simulated run time (default %u)\n"
+                "  --adc FILE        CSV waveforms: time_ms,analog1,analog2,analog3,analog4\n"
+                "  --adc-noise LSB   gaussian noise added to the analog inputs, rms\n"
+                "  --adc-tone HZ:LSB sine added to the analog inputs, amplitude\n"
+                "  --supply MV       ADC supply, 3300 nominal; inputs are given at 3300\n"
+                "  --can-in FILE     candump style log of frames to receive\n"
+                "  --can-out FILE    candump style log of transmitted frames ('-' for stdout)\n"
+                "  --can-load PCT    generate other nodes' traffic to load the bus\n"
+                "  --seed N          seed of the generated traffic\n"
+                "  --rx-cycles N     CPU cycles charged per received frame (default %u)\n"
+                "  --can-silent FROM:UNTIL\n"
+                "                    ms window with no other node on the bus\n"
+                "  --debug           log at debug level, including every received frame\n"
+                "  --serial FILE     log output (default stdout)\n"
+                "  --flash FILE      file backing the configuration flash pages\n"
+                "  --address N       address jumpers, 0..3\n"
+                "  --baud 500|1000   baud rate jumper in kbps\n",
+                name, DEFAULT_DURATION_MS, DEFAULT_RX_CYCLES);
+}
+
+void sim_finish(int status)
+{
+        fflush(g_sim_serial);
+        fflush(stdout);
+        sim_report(stderr);
+        exit(status);
+}
+
+int main(int argc, char **argv)
+{
+        static const struct option options[] = {
+                {"duration", required_argument, NULL, 'd'},
+                {"adc",      required_argument, NULL, 'a'},
+                {"adc-noise", required_argument, NULL, 'n'},
+                {"adc-tone", required_argument, NULL, 't'},
+                {"supply",   required_argument, NULL, 'V'},
+                {"can-in",   required_argument, NULL, 'i'},
+                {"can-out",  required_argument, NULL, 'o'},
+                {"can-load", required_argument, NULL, 'l'},
+                {"seed",     required_argument, NULL, 'S'},
+                {"rx-cycles", required_argument, NULL, 'r'},
+                {"can-silent", required_argument, NULL, 'q'},
+                {"debug",    no_argument,       NULL, 'D'},
+                {"serial",   required_argument, NULL, 's'},
+                {"flash",    required_argument, NULL, 'f'},
+                {"address",  required_argument, NULL, 'A'},
+                {"baud",     required_argument, NULL, 'b'},
+                {"help",     no_argument,       NULL, 'h'},
+                {NULL, 0, NULL, 0}
+        };
+        uint64_t duration = DEFAULT_DURATION_MS;
+        const char *can_in = NULL;
+        const char *can_out = NULL;
+        const char *flash = NULL;
+        uint8_t address = 0;
+        bool baud_1m = false;
+        uint32_t load = 0;
+        uint32_t seed = 1;
+        uint32_t rx_cycles = DEFAULT_RX_CYCLES;
+        uint64_t silent_from = 0;
+        uint64_t silent_until = 0;
+        char *end;
+        int opt;
+
+        while ((opt = getopt_long(argc, argv, "", options, NULL)) != -1) {
+                switch (opt) {
+                case 'd':
+                        duration = strtoull(optarg, NULL, 0);
+                        break;
+                case 'a':
+                        if (!sim_adc_load(optarg)) {
+                                fprintf(stderr, "sim: cannot load waveforms from %s\n", optarg);
+                                return EXIT_FAILURE;
+                        }
+                        break;
+                case 'n':
+                        sim_adc_set_noise(strtod(optarg, NULL));
+                        break;
+                case 't': {
+                        double hz = strtod(optarg, &end);
+                        if (*end != ':') {
+                                _usage(argv[0]);
+                                return EXIT_FAILURE;
+                        }
+                        sim_adc_set_tone(hz, strtod(end + 1, NULL));
+                        break;
+                }
+                case 'V':
+                        sim_adc_set_supply(strtoul(optarg, NULL, 0));
+                        break;
+                case 'i':
+                        can_in = optarg;
+                        break;
+                case 'o':
+                        can_out = optarg;
+                        break;
+                case 'l':
+                        load = strtoul(optarg, NULL, 0);
+                        break;
+                case 'S':
+                        seed = strtoul(optarg, NULL, 0);
+                        break;
+                case 'r':
+                        rx_cycles = strtoul(optarg, NULL, 0);
+                        break;
+                case 'q':
+                        silent_from = strtoull(optarg, &end, 0);
+                        if (*end != ':') {
+                                _usage(argv[0]);
+                                return EXIT_FAILURE;
+                        }
+                        silent_until = strtoull(end + 1, NULL, 0);
+                        break;
+                case 'D':
+                        set_logging_level(logging_level_debug);
+                        break;
+                case 's':
+                        g_sim_serial = fopen(optarg, "w");
+                        if (!g_sim_serial) {
+                                fprintf(stderr, "sim: cannot open %s\n", optarg);
+                                return EXIT_FAILURE;
+                        }
+                        break;
+                case 'f':
+                        flash = optarg;
+                        break;
+                case 'A':
+                        address = strtoul(optarg, NULL, 0) & 0x03;
+                        break;
+                case 'b':
+                        baud_1m = strtoul(optarg, NULL, 0) == 1000;
+                        break;
+                default:
+                        _usage(argv[0]);
+                        return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+                }
+        }
+
+        if (!sim_can_open(can_in, can_out)) {
+                fprintf(stderr, "sim: cannot open CAN logs\n");
+                return EXIT_FAILURE;
+        }
+        sim_can_set_load(load, seed);
+        sim_can_set_rx_cost(rx_cycles);
+        sim_can_set_silent(silent_from, silent_until);
+        sim_flash_open(flash);
+        sim_set_jumpers(address, baud_1m);
+        sim_set_duration_ms(duration);
+
+        analogx_main();
+        sim_finish(EXIT_SUCCESS);
+}
@@ -0,0 +1,224 @@
+/*
+ * AnalogX firmware
+ *
+ * Copyright (C) 2017 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Virtual time for the host simulation.
+ *
+ * Time stands still while threads run and jumps to the next kernel alarm
+ * when the idle thread is reached, so results do not depend on the host.
+ * The only other way time advances is a read of the SysTick cycle
+ * counter, which costs SYSTICK_READ_NS; that keeps busy waits such as
+ * system_timer_delay_us() finite.
+ */
+#include "ch.h"
+#include "hal.h"
+#include "sim.h"
+#include <stdlib.h>
+
+#define NS_PER_TICK             (SIM_NS_PER_SECOND / CH_CFG_ST_FREQUENCY)
+#define SYSTICK_READ_NS         250
+
+static uint64_t g_now_ns = 0;
+static uint64_t g_end_ns = UINT64_MAX;
+static bool g_alarm_armed = false;
+static systime_t g_alarm = 0;
+static SysTick_Type g_systick;
+static struct SimEvent *g_events;
+
+uint64_t sim_time_ns(void)
+{
+        return g_now_ns;
+}
+
+/* Time of the earliest pending interrupt, the kernel alarm or an event */
+static bool _next_interrupt_ns(uint64_t *at_ns)
+{
+        bool pending = false;
+        if (g_alarm_armed) {
+                uint64_t now_ticks = g_now_ns / NS_PER_TICK;
+                int32_t delta = (int32_t)(g_alarm - (systime_t)now_ticks);
+                *at_ns = delta > 0 ? (now_ticks + delta) * NS_PER_TICK : g_now_ns;
+                pending = true;
+        }
+        for (struct SimEvent *ev = g_events; ev; ev = ev->next) {
+                if (ev->armed && (!pending || ev->at_ns < *at_ns)) {
+                        *at_ns = ev->at_ns;
+                        pending = true;
+                }
+        }
+        return pending;
+}
+
+/* Run every interrupt that is due, as the NVIC would */
+static void _run_interrupts(void)
+{
+        uint64_t at_ns;
+        while (_next_interrupt_ns(&at_ns) && at_ns <= g_now_ns) {
+                PORT_IRQ_PROLOGUE();
+                for (struct SimEvent *ev = g_events; ev; ev = ev->next) {
+                        if (ev->armed && ev->at_ns <= g_now_ns) {
+                                ev->armed = false;
+                                ev->handler(ev->arg);
+                        }
+                }
+                if (g_alarm_armed && (int32_t)(port_timer_get_time() - g_alarm) >= 0) {
+                        chSysLockFromISR();
+                        chSysTimerHandlerI();
+                        chSysUnlockFromISR();
+                }
+                PORT_IRQ_EPILOGUE();
+        }
+}
+
+static void _check_end(void)
+{
+        if (g_now_ns >= g_end_ns) {
+                g_now_ns = g_end_ns;
+                sim_finish(EXIT_SUCCESS);
+        }
+}
+
+/*
+ * Time spent running code. A thread that can be interrupted takes the
+ * interrupts falling in that time where they are due, and is preempted
+ * if they wake a higher priority thread.
+ */
+void sim_time_advance_ns(uint64_t ns)
+{
+        if (port_is_isr_context() || !port_irq_enabled(port_get_irq_status()) || !currp) {
+                g_now_ns += ns;
+                return;
+        }
+
+        uint64_t at_ns;
+        while (_next_interrupt_ns(&at_ns) && at_ns < g_now_ns + ns) {
+                uint64_t step = at_ns > g_now_ns ? at_ns - g_now_ns : 0;
+                g_now_ns += step;
+                ns -= step;
+                _check_end();
+                _run_interrupts();
+                chSysLock();
+                chSchRescheduleS();
+                chSysUnlock();
+        }
+        g_now_ns += ns;
+        _check_end();
+}
+
+void sim_event_set(struct SimEvent *ev, uint64_t at_ns, void (*handler)(void *), void *arg)
+{
+        if (!ev->linked) {
+                ev->next = g_events;
+                g_events = ev;
+                ev->linked = true;
+        }
+        ev->at_ns = at_ns;
+        ev->handler = handler;
+        ev->arg = arg;
+        ev->armed = true;
+}
+
+void sim_event_cancel(struct SimEvent *ev)
+{
+        ev->armed = false;
+}
+
+uint32_t sim_cycles(void)
+{
+        return g_now_ns * (SIM_HCLK / 1000000) / 1000;
+}
+
+void sim_set_duration_ms(uint64_t ms)
+{
+        g_end_ns = ms * 1000000;
+}
+
+SysTick_Type *sim_systick(void)
+{
+        sim_time_advance_ns(SYSTICK_READ_NS);
+        g_systick.VAL = SysTick_VAL_CURRENT_Msk - (sim_cycles() & SysTick_VAL_CURRENT_Msk);
+        return &g_systick;
+}
+
+systime_t port_timer_get_time(void)
+{
+        return (systime_t)(g_now_ns / NS_PER_TICK);
+}
+
+void port_timer_start_alarm(systime_t time)
+{
+        g_alarm = time;
+        g_alarm_armed = true;
+}
+
+void port_timer_stop_alarm(void)
+{
+        g_alarm_armed = false;
+}
+
+void port_timer_set_alarm(systime_t time)
+{
+        g_alarm = time;
+}
+
+systime_t port_timer_get_alarm(void)
+{
+        return g_alarm;
+}
+
+/*
+ * WFI with interrupts masked: time moves to the next interrupt, which
+ * runs once they are enabled and the idle thread waits again.
+ */
+void sim_wfi(void)
+{
+        uint64_t at_ns;
+        if (!_next_interrupt_ns(&at_ns)) {
+                fprintf(stderr, "sim: no pending interrupts, sleeping forever\n");
+                sim_finish(EXIT_FAILURE);
+        }
+
+        if (at_ns > g_now_ns)
+                g_now_ns = at_ns;
+        _check_end();
+}
+
+/*
+ * Called by the idle thread: nothing can run until the next interrupt,
+ * so move time there, run it, then let any thread it woke preempt idle.
+ */
+void _sim_wait_for_interrupt(void)
+{
+        uint64_t at_ns;
+        if (!_next_interrupt_ns(&at_ns)) {
+                fprintf(stderr, "sim: no pending interrupts, every thread is blocked\n");
+                sim_finish(EXIT_FAILURE);
+        }
+
+        if (at_ns > g_now_ns)
+                g_now_ns = at_ns;
+        _check_end();
+        _run_interrupts();
+
+        chSysLock();
+        chSchRescheduleS();
+        chSysUnlock();
+}
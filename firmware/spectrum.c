@@ -0,0 +1,227 @@
+/*
+ * AnalogX firmware
+ *
+ * Copyright (C) 2017 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Spectrum analysis for knock and vibration sensors.
+ *
+ * Every SPECTRUM_INTERVAL_MS the ADC worker captures a block of back to
+ * back conversions of one channel, transforms it with a real input Q15
+ * FFT (half the points as a complex transform, then the split) and
+ * reports the strongest component and the level of SPECTRUM_BANDS
+ * configurable bands on API_SPECTRUM_REPORT: a kHz rate analysis in a
+ * few frames per second instead of the raw waveform.
+ */
+
+#include "spectrum.h"
+#include "acquisition.h"
+#include "analogx_api.h"
+#include "fft_q15.h"
+#include "fixed_math.h"
+#include "logging.h"
+#include "power.h"
+#include "settings.h"
+#include "system_CAN.h"
+
+#define _LOG_PFX "SPECTRUM:    "
+
+#if SPECTRUM_MAX_LOG2 > FFT_MAX_LOG2
+#error "SPECTRUM_MAX_LOG2 exceeds the FFT sine table"
+#endif
+
+#define SPECTRUM_PAGE_PEAK      0
+#define SPECTRUM_PAGE_BANDS     1
+#define SPECTRUM_LEVEL_NONE     INT16_MIN
+
+/* Band powers to the signal's mean square in LSB^2, in 0.1dB: the inputs
+ * are scaled by 4 and the transform divides by the number of points, so a
+ * tone of amplitude a has 2a in each of its two bins; Hann adds its
+ * 0.375 power gain */
+static const int16_t g_window_offsets[FFT_WINDOWS] = {90, 48};
+
+/* ADC channel of analog 1..4 */
+static const uint32_t g_adc_channels[ADC_CHANNELS] = {
+        ADC_CHSELR_CHSEL9, ADC_CHSELR_CHSEL7, ADC_CHSELR_CHSEL6, ADC_CHSELR_CHSEL5
+};
+
+static uint8_t g_channel;
+static uint8_t g_log2n = SPECTRUM_MAX_LOG2;
+static uint8_t g_window = FFT_WINDOW_HANN;
+static uint8_t g_sample_time;
+
+/* Bins, first and last included; thirds of a 256 point spectrum until set */
+static uint8_t g_bands[SPECTRUM_BANDS][2] = {
+        {1, 42}, {43, 85}, {86, 128}
+};
+
+static systime_t g_last_run;
+
+static ADCConversionGroup g_spectrum_group = {
+        FALSE,
+        1,
+        NULL,
+        NULL,
+        ADC_CFGR1_CONT | ADC_CFGR1_RES_12BIT,            /* CFGR1 */
+        ADC_TR(0, 0),                                     /* TR */
+        ADC_SMPR_SMP_1P5,                                 /* SMPR */
+        0
+};
+
+/*
+ * Select the analysis from CAN: data8[0] is the channel, 1..4 (0 turns
+ * the analysis off), data8[1] log2 of the number of points, data8[2] the
+ * window (0 rectangular, 1 Hann) and data8[3] the ADC sample time, which
+ * sets the sample rate as for API_SET_CONFIG_GROUP_2.
+ */
+void spectrum_configure(CANRxFrame *rx_msg)
+{
+        uint8_t channel = rx_msg->data8[0];
+        uint8_t log2n = rx_msg->data8[1];
+
+        if (channel > ADC_CHANNELS || log2n < FFT_MIN_LOG2 || log2n > SPECTRUM_MAX_LOG2 ||
+            rx_msg->data8[2] >= FFT_WINDOWS || rx_msg->data8[3] >= ACQUISITION_SAMPLE_TIMES) {
+                log_info(_LOG_PFX "Invalid params for set spectrum mode\r\n");
+                return;
+        }
+        g_log2n = log2n;
+        g_window = rx_msg->data8[2];
+        g_sample_time = rx_msg->data8[3];
+        g_channel = channel;
+        log_info(_LOG_PFX "channel %u, %u points, window %u, %u Hz\r\n", g_channel, 1 << g_log2n,
+                 g_window, acquisition_conversion_rate(g_sample_time, 0));
+}
+
+/*
+ * Set the bands from CAN: data8[2 * b] and data8[2 * b + 1] are the first
+ * and last bin of band b. Bins beyond the configured transform are
+ * ignored, so a band past the end reads as empty.
+ */
+void spectrum_configure_bands(CANRxFrame *rx_msg)
+{
+        for (size_t b = 0; b < SPECTRUM_BANDS; b++) {
+                if (rx_msg->data8[2 * b] > rx_msg->data8[2 * b + 1]) {
+                        log_info(_LOG_PFX "Invalid params for set spectrum bands\r\n");
+                        return;
+                }
+        }
+        for (size_t b = 0; b < SPECTRUM_BANDS; b++) {
+                g_bands[b][0] = rx_msg->data8[2 * b];
+                g_bands[b][1] = rx_msg->data8[2 * b + 1];
+        }
+}
+
+/* Nobody is listening while CAN sleeps */
+bool spectrum_due(void)
+{
+        return g_channel && !power_can_asleep() &&
+                chVTTimeElapsedSinceX(g_last_run) >= MS2ST(SPECTRUM_INTERVAL_MS);
+}
+
+/* Capture a block into x, remove its mean and scale it to +/-16384 for
+ * the FFT */
+static bool _capture(int16_t *x, uint16_t points)
+{
+        adcsample_t *samples = (adcsample_t *)x;
+
+        g_spectrum_group.smpr = g_sample_time;
+        g_spectrum_group.chselr = g_adc_channels[g_channel - 1];
+        if (adcConvert(&ADCD1, &g_spectrum_group, samples, points) != MSG_OK)
+                return false;
+
+        uint32_t sum = 0;
+        for (uint16_t i = 0; i < points; i++)
+                sum += samples[i];
+        int16_t mean = sum >> g_log2n;
+        for (uint16_t i = 0; i < points; i++)
+                x[i] = ((int16_t)samples[i] - mean) * 4;
+        return true;
+}
+
+static int16_t _level(uint64_t energy)
+{
+        if (!energy)
+                return SPECTRUM_LEVEL_NONE;
+        return (int32_t)((uint64_t)fixed_log2_q8(energy) * 30103 / 256000) - g_window_offsets[g_window];
+}
+
+static void _send(CANTxFrame *frame)
+{
+        canTransmit(&CAND1, CAN_ANY_MAILBOX, frame, MS2ST(CAN_TRANSMIT_TIMEOUT));
+}
+
+/*
+ * Run one analysis and report it on API_SPECTRUM_REPORT in two frames:
+ *   data8[0] = 0: data8[1] peak bin, data16[1] its amplitude in LSB / 16,
+ *                 data32[1] its frequency in Hz
+ *   data8[0] = 1: data8[1] log2 of the number of points, data16[1..3]
+ *                 the band levels, mean square in 0.1dB re 1 LSB^2
+ * Levels of empty bands read as INT16_MIN. work holds SPECTRUM_WORK_SIZE
+ * values.
+ */
+void spectrum_run(int16_t *work)
+{
+        uint16_t points = 1 << g_log2n;
+        uint16_t bins = points / 2;
+
+        g_last_run = chVTGetSystemTimeX();
+        if (!_capture(work, points)) {
+                log_info(_LOG_PFX "conversion failed\r\n");
+                return;
+        }
+        fft_q15_window(work, g_log2n, g_window);
+        fft_q15_real(work, g_log2n);
+
+        uint16_t peak = 0;
+        uint32_t peak_power = 0;
+        for (uint16_t k = 1; k <= bins; k++) {
+                uint32_t power = fft_q15_real_energy(work, g_log2n, k, k + 1);
+                if (power > peak_power) {
+                        peak_power = power;
+                        peak = k;
+                }
+        }
+
+        /* sqrt(power) is 2a, or a with the 0.5 amplitude gain of Hann */
+        uint32_t amplitude_q4 = fixed_isqrt((uint64_t)peak_power << 8);
+        if (g_window == FFT_WINDOW_RECTANGULAR)
+                amplitude_q4 /= 2;
+        uint32_t frequency = (uint64_t)peak * acquisition_conversion_rate(g_sample_time, 0) / points;
+
+        CANTxFrame frame;
+        prepare_can_tx_message(&frame, CAN_IDE_EXT, get_can_base_id() + API_SPECTRUM_REPORT);
+        frame.data8[0] = SPECTRUM_PAGE_PEAK;
+        frame.data8[1] = peak > UINT8_MAX ? UINT8_MAX : peak;
+        frame.data16[1] = amplitude_q4 > UINT16_MAX ? UINT16_MAX : amplitude_q4;
+        frame.data32[1] = frequency;
+        _send(&frame);
+
+        prepare_can_tx_message(&frame, CAN_IDE_EXT, get_can_base_id() + API_SPECTRUM_REPORT);
+        frame.data8[0] = SPECTRUM_PAGE_BANDS;
+        frame.data8[1] = g_log2n;
+        for (size_t b = 0; b < SPECTRUM_BANDS; b++) {
+                uint16_t first = g_bands[b][0];
+                uint16_t last = g_bands[b][1] < bins ? g_bands[b][1] : bins;
+                uint64_t energy = first <= last ? fft_q15_real_energy(work, g_log2n, first, last + 1) : 0;
+                frame.data16[1 + b] = _level(energy);
+        }
+        _send(&frame);
+
+        log_debug(_LOG_PFX "peak %u Hz, %u/16 LSB\r\n", frequency, amplitude_q4);
+}
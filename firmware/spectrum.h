@@ -0,0 +1,38 @@
+/*
+ * AnalogX firmware
+ *
+ * Copyright (C) 2017 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SPECTRUM_H_
+#define SPECTRUM_H_
+#include "ch.h"
+#include "hal.h"
+
+/* Band levels reported per spectrum */
+#define SPECTRUM_BANDS 3
+
+/* Working buffer of spectrum_run(), the samples of the largest transform */
+#define SPECTRUM_WORK_SIZE (1 << SPECTRUM_MAX_LOG2)
+
+void spectrum_configure(CANRxFrame *rx_msg);
+void spectrum_configure_bands(CANRxFrame *rx_msg);
+bool spectrum_due(void);
+void spectrum_run(int16_t *work);
+
+#endif /* SPECTRUM_H_ */
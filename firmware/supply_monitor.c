@@ -0,0 +1,121 @@
+/*
+ * AnalogX firmware
+ *
+ * Copyright (C) 2017 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Supply and die temperature monitoring.
+ *
+ * The ADC measures relative to its 3.3V supply, so readings follow any
+ * drift of the rail. Every SUPPLY_MONITOR_INTERVAL_MS the ADC worker
+ * converts VREFINT and the temperature sensor; the supply they give
+ * corrects the external channels ratiometrically.
+ *
+ * They are converted on their own rather than added to the regular scan:
+ * the F0 has one sample time for all channels and both need at least
+ * 4us, which would slow the external channels down to match.
+ */
+
+#include "supply_monitor.h"
+#include "acquisition.h"
+#include "logging.h"
+#include "settings.h"
+
+#define _LOG_PFX "SUPPLY:      "
+
+/* Factory calibration in system memory, taken at 3.3V: VREFINT at 30C
+ * and the temperature sensor at 30C and 110C */
+#ifndef VREFINT_CAL_ADDR
+#define VREFINT_CAL_ADDR        ((const uint16_t *)0x1FFFF7BA)
+#define TEMPSENSOR_CAL1_ADDR    ((const uint16_t *)0x1FFFF7B8)
+#define TEMPSENSOR_CAL2_ADDR    ((const uint16_t *)0x1FFFF7C2)
+#endif
+
+/* Readings further than this from the calibration are not trusted */
+#define SUPPLY_RATIO_MIN        (65536 * 9 / 10)
+#define SUPPLY_RATIO_MAX        (65536 * 11 / 10)
+#define SUPPLY_RATIO_NOMINAL    65536
+
+static uint32_t g_ratio = SUPPLY_RATIO_NOMINAL;
+static uint16_t g_supply_mv;
+static int16_t g_temperature;
+static systime_t g_last_update;
+static bool g_updated;
+
+/* Temperature sensor then VREFINT, at the longest sample time */
+static adcsample_t g_samples[2];
+static const ADCConversionGroup g_supply_group = {
+        FALSE,
+        2,
+        NULL,
+        NULL,
+        ADC_CFGR1_RES_12BIT,                             /* CFGR1 */
+        ADC_TR(0, 0),                                     /* TR */
+        ADC_SMPR_SMP_239P5,                               /* SMPR */
+        ADC_CHSELR_CHSEL16 | ADC_CHSELR_CHSEL17
+};
+
+void supply_monitor_init(void)
+{
+        adcSTM32SetCCR(ADC_CCR_TSEN | ADC_CCR_VREFEN);
+}
+
+bool supply_monitor_due(void)
+{
+        return !g_updated || chVTTimeElapsedSinceX(g_last_update) >= MS2ST(SUPPLY_MONITOR_INTERVAL_MS);
+}
+
+void supply_monitor_update(void)
+{
+        g_last_update = chVTGetSystemTimeX();
+        g_updated = true;
+        if (adcConvert(&ADCD1, &g_supply_group, g_samples, 1) != MSG_OK)
+                return;
+
+        uint32_t ratio = acquisition_supply_ratio(g_samples[1], *VREFINT_CAL_ADDR);
+        if (ratio < SUPPLY_RATIO_MIN || ratio > SUPPLY_RATIO_MAX) {
+                log_info(_LOG_PFX "VREFINT %u out of range\r\n", g_samples[1]);
+                return;
+        }
+        if (SUPPLY_COMPENSATION)
+                g_ratio = ratio;
+        g_supply_mv = acquisition_supply_mv(ratio);
+        g_temperature = acquisition_die_temperature(g_samples[0], ratio, *TEMPSENSOR_CAL1_ADDR,
+                                                    *TEMPSENSOR_CAL2_ADDR);
+        log_debug(_LOG_PFX "%u mV, %d.%u C\r\n", g_supply_mv,
+                  g_temperature / 10, (g_temperature < 0 ? -g_temperature : g_temperature) % 10);
+}
+
+/* Correction factor for the external channels, Q16 */
+uint32_t supply_monitor_ratio(void)
+{
+        return g_ratio;
+}
+
+/* Measured supply, 0 until known */
+uint16_t supply_monitor_mv(void)
+{
+        return g_supply_mv;
+}
+
+/* Die temperature in 0.1C */
+int16_t supply_monitor_temperature(void)
+{
+        return g_temperature;
+}
@@ -28,6 +28,9 @@
 #include "hal.h"
 #include "logging.h"
 #include "system_CAN.h"
+#include "runtime_stats.h"
+#include "power.h"
+#include "supply_monitor.h"
 
 #define _LOG_PFX "SYS:         "
 
@@ -55,13 +58,20 @@ void broadcast_stats(void)
 
         /* these values reserved for future use */
         can_stats.data8[0] = get_sample_rate();
+        /* die temperature in C and the supply in mV */
+        int16_t temperature = supply_monitor_temperature();
+        can_stats.data8[1] = (int8_t)((temperature + (temperature < 0 ? -5 : 5)) / 10);
+        can_stats.data16[1] = supply_monitor_mv();
 
         can_stats.data8[5] = MAJOR_VER;
         can_stats.data8[6] = MINOR_VER;
         can_stats.data8[7] = PATCH_VER;
         can_stats.DLC = 8;
-        canTransmit(&CAND1, CAN_ANY_MAILBOX, &can_stats, MS2ST(CAN_TRANSMIT_TIMEOUT));
+        if (!power_can_asleep())
+                canTransmit(&CAND1, CAN_ANY_MAILBOX, &can_stats, MS2ST(CAN_TRANSMIT_TIMEOUT));
         log_info(_LOG_PFX "Broadcast stats\r\n");
+
+        runtime_stats_broadcast();
 }
 
 /* perform a soft reset of this processor */
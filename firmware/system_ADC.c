@@ -23,7 +23,26 @@
 #include "logging.h"
 #include "system_CAN.h"
 #include "analogx_api.h"
+#include "boot_timeline.h"
+#include "latency_probe.h"
 #include "settings.h"
+#include "power.h"
+#include "noise_scan.h"
+#include "spectrum.h"
+#include "totalizer.h"
+#include "supply_monitor.h"
+#include "can_stream.h"
+#include "trace.h"
+#if PULSE_CAPTURE
+#include "pulse_capture.h"
+#endif
+#if TELEMETRY_STREAM
+#include "telemetry_stream.h"
+#endif
+#if ANGLE_SYNC
+#include "angle_sync.h"
+#endif
+#include <string.h>
 
 #define _LOG_PFX "ADC:         "
 
@@ -31,9 +50,6 @@
 #define ADC_GRP1_BUF_DEPTH      1
 #define SAMPLE_BUFFER_SIZE ADC_GRP1_NUM_CHANNELS * ADC_GRP1_BUF_DEPTH
 
-/* Scale 12 bits to 5.0v */
-#define ADC_SCALING 1.0 / 0.80688
-
 static adcsample_t internal_samples[SAMPLE_BUFFER_SIZE] = {0};
 
 static struct ADCSamples adc_samples = {0};
@@ -45,6 +61,8 @@ static void adccallback(ADCDriver *adcp, adcsample_t *buffer, size_t n)
         (void)adcp;
         (void)buffer;
         (void)n;
+        latency_probe_conversion_complete();
+        trace_mark(TRACE_MARK_ADC_DONE, 0);
         internal_samples[0] = buffer[0];
         //log_info(_LOG_PFX " ADC %i\r\n", samples1[0]);
 }
@@ -58,10 +76,11 @@ static void adcerrorcallback(ADCDriver *adcp, adcerror_t err)
 
 /*
  * ADC conversion group.
- * Mode:        Continuous, 16 samples of 8 channels, SW triggered.
- * Channels:    IN10, IN11, Sensor, VRef.
+ * Mode:        One scan of 4 channels, SW triggered.
+ * Channels:    IN5, IN6, IN7, IN9.
+ * Sample time, resolution and scan order follow the acquisition profile.
  */
-static const ADCConversionGroup adcgrpcfg1 = {
+static ADCConversionGroup adcgrpcfg1 = {
         FALSE,
         ADC_GRP1_NUM_CHANNELS,
         adccallback,
@@ -72,6 +91,119 @@ static const ADCConversionGroup adcgrpcfg1 = {
         ADC_CHSELR_CHSEL5 | ADC_CHSELR_CHSEL6 | ADC_CHSELR_CHSEL7 | ADC_CHSELR_CHSEL9
 };
 
+/* Circular buffer of scans for continuous acquisition; each half is
+ * processed while the other fills */
+#if TELEMETRY_STREAM
+#define STREAM_HALF_DEPTH       TELEMETRY_MAX_SCANS
+#else
+#define STREAM_HALF_DEPTH       16
+#endif
+#define STREAM_BUF_DEPTH        (2 * STREAM_HALF_DEPTH)
+
+/* The worker runs one of the streams, the noise scan and the spectrum
+ * at a time, so they share a buffer */
+static union {
+        struct {
+                adcsample_t buffer[STREAM_BUF_DEPTH * ADC_GRP1_NUM_CHANNELS];
+#if TELEMETRY_STREAM
+                /* oversampled or interpolated scans on their way out */
+                uint16_t scans[TELEMETRY_MAX_SCANS][ADC_CHANNELS];
+#endif
+        } stream;
+        struct {
+                adcsample_t buffer[STREAM_BUF_DEPTH * ADC_GRP1_NUM_CHANNELS];
+                struct CanStreamScan queue[CAN_STREAM_QUEUE_DEPTH];
+        } can_stream;
+        adcsample_t noise[NOISE_SCAN_DEPTH * ADC_GRP1_NUM_CHANNELS];
+        int16_t spectrum[SPECTRUM_WORK_SIZE];
+} g_scratch;
+static adcsample_t *volatile g_stream_half;
+static BSEMAPHORE_DECL(g_stream_ready, true);
+
+static void _stream_callback(ADCDriver *adcp, adcsample_t *buffer, size_t n)
+{
+        (void)adcp;
+        (void)n;
+        latency_probe_conversion_complete();
+        trace_mark(TRACE_MARK_ADC_DONE, 0);
+        chSysLockFromISR();
+        g_stream_half = buffer;
+        chBSemSignalI(&g_stream_ready);
+        chSysUnlockFromISR();
+}
+
+/*
+ * Continuous conversion group: back to back scans of all channels with
+ * the acquisition profile, set up by _continuous_acquisition().
+ */
+static ADCConversionGroup adcgrp_stream = {
+        TRUE,
+        ADC_GRP1_NUM_CHANNELS,
+        _stream_callback,
+        adcerrorcallback,
+        ADC_CFGR1_CONT | ADC_CFGR1_RES_12BIT,            /* CFGR1 */
+        ADC_TR(0, 0),                                     /* TR */
+        ADC_SMPR_SMP_239P5,                               /* SMPR */
+        ADC_CHSELR_CHSEL5 | ADC_CHSELR_CHSEL6 | ADC_CHSELR_CHSEL7 | ADC_CHSELR_CHSEL9
+};
+
+static void _can_stream_callback(ADCDriver *adcp, adcsample_t *buffer, size_t n)
+{
+        (void)adcp;
+        trace_mark(TRACE_MARK_ADC_DONE, n);
+        chSysLockFromISR();
+        can_stream_push_i(buffer, n);
+        /* for the totalizers */
+        g_stream_half = buffer;
+        chBSemSignalI(&g_stream_ready);
+        chSysUnlockFromISR();
+}
+
+/*
+ * CAN stream conversion group: one scan per TIM1 update, started by its
+ * TRGO (TRG0). At 28.5 cycles a scan takes 11.7us.
+ */
+static const ADCConversionGroup adcgrp_can_stream = {
+        TRUE,
+        ADC_GRP1_NUM_CHANNELS,
+        _can_stream_callback,
+        adcerrorcallback,
+        ADC_CFGR1_EXTEN_RISING | ADC_CFGR1_EXTSEL_SRC(0) | ADC_CFGR1_RES_12BIT, /* CFGR1 */
+        ADC_TR(0, 0),                                     /* TR */
+        ADC_SMPR_SMP_28P5,                                /* SMPR */
+        ADC_CHSELR_CHSEL5 | ADC_CHSELR_CHSEL6 | ADC_CHSELR_CHSEL7 | ADC_CHSELR_CHSEL9
+};
+
+#if ANGLE_SYNC
+static void _angle_callback(ADCDriver *adcp, adcsample_t *buffer, size_t n)
+{
+        (void)adcp;
+        (void)n;
+        chSysLockFromISR();
+        /* the second half completes as the DMA wraps */
+        if (buffer != g_scratch.stream.buffer)
+                angle_sync_buffer_wrapped_i();
+        g_stream_half = buffer;
+        chBSemSignalI(&g_stream_ready);
+        chSysUnlockFromISR();
+}
+
+/*
+ * Angle conversion group: one scan per tooth, started by TIM3 TRGO (TRG3).
+ * At 28.5 cycles a scan takes 11.7us, good for 85k teeth/s.
+ */
+static const ADCConversionGroup adcgrp_angle = {
+        TRUE,
+        ADC_GRP1_NUM_CHANNELS,
+        _angle_callback,
+        adcerrorcallback,
+        ADC_CFGR1_EXTEN_RISING | ADC_CFGR1_EXTSEL_SRC(3) | ADC_CFGR1_RES_12BIT, /* CFGR1 */
+        ADC_TR(0, 0),                                     /* TR */
+        ADC_SMPR_SMP_28P5,                                /* SMPR */
+        ADC_CHSELR_CHSEL5 | ADC_CHSELR_CHSEL6 | ADC_CHSELR_CHSEL7 | ADC_CHSELR_CHSEL9
+};
+#endif
+
 void system_adc_init(void)
 {
         /*
@@ -90,51 +222,307 @@ void system_adc_init(void)
         palSetGroupMode(GPIOA, PAL_PORT_BIT(5), 0, PAL_MODE_INPUT_ANALOG);
 
         adcStart(&ADCD1, NULL);
-
-        //  adcSTM32SetCCR(ADC_CCR_VBATEN | ADC_CCR_TSEN | ADC_CCR_VREFEN);
+        supply_monitor_init();
         /* start continuous conversion */
 }
 
-static uint16_t scale_0_to_5_volts(uint16_t raw_value)
-{
-    float scaled = raw_value * ADC_SCALING;
-    return (uint16_t)scaled;
-}
+static const uint32_t g_resolutions[ACQUISITION_RESOLUTIONS] = {
+        ADC_CFGR1_RES_12BIT, ADC_CFGR1_RES_10BIT, ADC_CFGR1_RES_8BIT, ADC_CFGR1_RES_6BIT
+};
 
 struct ADCSamples * system_adc_sample(void)
 {
-        adcStartConversion(&ADCD1, &adcgrpcfg1, internal_samples, ADC_GRP1_BUF_DEPTH);
+        const struct ConfigGroup2 *profile = get_acquisition_profile();
+        adcgrpcfg1.cfgr1 = g_resolutions[profile->resolution] |
+                (profile->scan_order == ACQUISITION_SCAN_DESCENDING ? ADC_CFGR1_SCANDIR : 0);
+        adcgrpcfg1.smpr = profile->sample_time;
+
+        adcConvert(&ADCD1, &adcgrpcfg1, internal_samples, ADC_GRP1_BUF_DEPTH);
+        boot_timeline_mark(BOOT_PHASE_FIRST_CONVERSION);
 
-        /* re-map samples */
-        adc_samples.raw_samples[0] = internal_samples[3];
-        adc_samples.raw_samples[1] = internal_samples[2];
-        adc_samples.raw_samples[2] = internal_samples[1];
-        adc_samples.raw_samples[3] = internal_samples[0];
+        acquisition_normalize_scan(internal_samples, profile->scan_order, profile->resolution);
+        acquisition_remap_scan(internal_samples, adc_samples.raw_samples);
         return &adc_samples;
 }
 
-void system_adc_worker(void)
+/* The mailbox the LLD fills next, so the probe knows where its frame went */
+static canmbx_t _next_tx_mailbox(void)
 {
-        while(!chThdShouldTerminateX()) {
-                systime_t start = chVTGetSystemTimeX();
-                struct ADCSamples * adc_samples = system_adc_sample();
+        return ((CAND1.can->TSR & CAN_TSR_CODE) >> 24) + 1;
+}
 
-                CANTxFrame analog_sample;
-                prepare_can_tx_message(&analog_sample, CAN_IDE_EXT, get_can_base_id() + API_BROADCAST_SENSORS);
+/* Wait until our sample has left its mailbox */
+static void _wait_tx_complete(canmbx_t mailbox)
+{
+        while (!(CAND1.can->TSR & (CAN_TSR_TME0 << (mailbox - 1)))) {
+                if (chEvtWaitAnyTimeout(EVENT_MASK(0), MS2ST(LATENCY_TX_COMPLETE_TIMEOUT)) == 0)
+                        return;
+        }
+        latency_probe_tx_complete();
+}
 
-                analog_sample.data16[0] = scale_0_to_5_volts(adc_samples->raw_samples[0]);
-                analog_sample.data16[1] = scale_0_to_5_volts(adc_samples->raw_samples[1]);
-                analog_sample.data16[2] = scale_0_to_5_volts(adc_samples->raw_samples[2]);
-                analog_sample.data16[3] = scale_0_to_5_volts(adc_samples->raw_samples[3]);
+/*
+ * Derive the virtual channels from the values of a sensor frame. Those
+ * with a channel as output take its place, the others fill the virtual
+ * channels frame by index. Returns whether that frame is in use. Every
+ * mode broadcasts through here; the streamed scans are left raw.
+ */
+static bool _virtual_channels(uint16_t *values, int16_t *virtual_values)
+{
+        const struct VirtualChannel *channels = get_virtual_channels();
+        uint16_t physical[ADC_CHANNELS];
+        bool in_frame = false;
 
-                canTransmit(&CAND1, CAN_ANY_MAILBOX, &analog_sample, MS2ST(CAN_TRANSMIT_TIMEOUT));
+        memcpy(physical, values, sizeof(physical));
+        for (size_t v = 0; v < VIRTUAL_CHANNELS; v++) {
+                const struct VirtualChannel *channel = &channels[v];
+                virtual_values[v] = 0;
+                if (channel->op == VIRTUAL_OP_OFF)
+                        continue;
+                int16_t value = acquisition_virtual_value(channel, physical);
+                if (channel->output == VIRTUAL_OUTPUT_FRAME) {
+                        virtual_values[v] = value;
+                        in_frame = true;
+                } else {
+                        values[channel->output - 1] = value;
+                }
+        }
+        return in_frame;
+}
 
-                log_debug("Sample ADC %d, %d, %d, %d\r\n", analog_sample.data16[0], analog_sample.data16[1], analog_sample.data16[2], analog_sample.data16[3]);
+static void _broadcast_samples(struct ADCSamples *adc_samples)
+{
+        CANTxFrame analog_sample;
+        CANTxFrame virtual_sample;
+        prepare_can_tx_message(&analog_sample, CAN_IDE_EXT, get_can_base_id() + API_BROADCAST_SENSORS);
+        prepare_can_tx_message(&virtual_sample, CAN_IDE_EXT, get_can_base_id() + API_BROADCAST_VIRTUAL);
 
-                /* Compensate for amount of time needed for sampling and broadcasting CAN message */
-                systime_t work_time = chVTGetSystemTimeX() - start;
+        uint16_t samples[ADC_CHANNELS];
+        acquisition_correct_scan(adc_samples->raw_samples, supply_monitor_ratio(), samples);
+        acquisition_scale_scan(samples, analog_sample.data16);
+#if PULSE_CAPTURE
+        pulse_capture_update(analog_sample.data16);
+#endif
+        bool send_virtual = _virtual_channels(analog_sample.data16, (int16_t *)virtual_sample.data16);
 
-                chThdSleep(MS2ST(1000 / get_sample_rate()) - work_time);
+        chEvtGetAndClearEvents(EVENT_MASK(0));
+        canmbx_t mailbox = LATENCY_PROBE_ENABLED ? _next_tx_mailbox() : CAN_ANY_MAILBOX;
+        msg_t result = canTransmit(&CAND1, mailbox, &analog_sample, MS2ST(CAN_TRANSMIT_TIMEOUT));
+        trace_mark(TRACE_MARK_SENSOR_TX, result);
+        if (result == MSG_OK) {
+                boot_timeline_mark(BOOT_PHASE_FIRST_TX);
+                if (LATENCY_PROBE_ENABLED) {
+                        latency_probe_queued();
+                        _wait_tx_complete(mailbox);
+                }
         }
+        if (send_virtual)
+                canTransmit(&CAND1, CAN_ANY_MAILBOX, &virtual_sample, MS2ST(CAN_TRANSMIT_TIMEOUT));
+
+        log_debug("Sample ADC %d, %d, %d, %d\r\n", analog_sample.data16[0], analog_sample.data16[1], analog_sample.data16[2], analog_sample.data16[3]);
+}
+
+/*
+ * Continuous acquisition is needed by the telemetry stream and by the
+ * totalizers; without a stream it gives way to the spectrum analysis and
+ * the supply measurement, which have the ADC to themselves.
+ */
+static bool _continuous_wanted(void)
+{
+#if TELEMETRY_STREAM
+        if (telemetry_stream_get_mode() != TELEMETRY_MODE_OFF)
+                return true;
+#endif
+        return totalizer_active() && !spectrum_due() && !supply_monitor_due();
 }
 
+/*
+ * Continuous acquisition for the telemetry stream and the totalizers.
+ * CAN broadcasts carry on at the configured rate using the latest scan.
+ */
+static void _continuous_acquisition(void)
+{
+        const struct ConfigGroup2 *profile = get_acquisition_profile();
+        uint8_t scan_order = profile->scan_order;
+        uint8_t resolution = profile->resolution;
+        systime_t last_broadcast = chVTGetSystemTimeX();
+
+        adcgrp_stream.cfgr1 = ADC_CFGR1_CONT | g_resolutions[resolution] |
+                (scan_order == ACQUISITION_SCAN_DESCENDING ? ADC_CFGR1_SCANDIR : 0);
+        adcgrp_stream.smpr = profile->sample_time;
+        chBSemReset(&g_stream_ready, true);
+        adcStartConversion(&ADCD1, &adcgrp_stream, g_scratch.stream.buffer, STREAM_BUF_DEPTH);
+
+        while (_continuous_wanted() && !noise_scan_pending() && !chThdShouldTerminateX()) {
+                if (chBSemWaitTimeout(&g_stream_ready, MS2ST(100)) != MSG_OK)
+                        continue;
+
+                adcsample_t *half = g_stream_half;
+                for (size_t i = 0; i < STREAM_HALF_DEPTH; i++)
+                        acquisition_normalize_scan(half + i * ADC_GRP1_NUM_CHANNELS, scan_order, resolution);
+                if (totalizer_active())
+                        totalizer_integrate(half, STREAM_HALF_DEPTH);
+#if TELEMETRY_STREAM
+                if (telemetry_stream_get_mode() != TELEMETRY_MODE_OFF) {
+                        size_t count = acquisition_oversample(half, STREAM_HALF_DEPTH,
+                                                              telemetry_stream_get_oversample_shift(),
+                                                              g_scratch.stream.scans);
+                        telemetry_stream_send_samples(g_scratch.stream.scans, count);
+                }
+#endif
+
+                if (chVTTimeElapsedSinceX(last_broadcast) >= MS2ST(1000 / get_sample_rate())) {
+                        last_broadcast = chVTGetSystemTimeX();
+                        acquisition_remap_scan(half + (STREAM_HALF_DEPTH - 1) * ADC_GRP1_NUM_CHANNELS, adc_samples.raw_samples);
+                        if (!power_can_asleep())
+                                _broadcast_samples(&adc_samples);
+                }
+        }
+        adcStopConversion(&ADCD1);
+}
+
+/*
+ * Stream every scan over CAN: sleep until scans are queued or a mailbox
+ * empties, then fill the mailboxes, and integrate the latest half buffer
+ * into the totalizers. Sensor broadcasts and the periodic work wait
+ * while the stream has the bus. The worker drops below the
+ * other threads meanwhile: they wait for a mailbox in canTransmit, and
+ * would never get one if it refilled each first; the queue covers the
+ * delay.
+ */
+static void _can_stream_acquisition(event_listener_t *tx_listener)
+{
+        tprio_t priority = chThdSetPriority(NORMALPRIO - 1);
+        chEvtGetAndClearEvents(EVENT_MASK(0) | CAN_STREAM_EVENT);
+        chEvtGetAndClearFlags(tx_listener);
+        chBSemReset(&g_stream_ready, true);
+        can_stream_start(g_scratch.can_stream.queue);
+        adcStartConversion(&ADCD1, &adcgrp_can_stream, g_scratch.can_stream.buffer, STREAM_BUF_DEPTH);
+
+        while (can_stream_enabled() && !power_can_asleep() && !noise_scan_pending() &&
+               !chThdShouldTerminateX()) {
+                chEvtWaitAnyTimeout(EVENT_MASK(0) | CAN_STREAM_EVENT, MS2ST(100));
+                can_stream_feed(chEvtGetAndClearFlags(tx_listener));
+                if (chBSemWaitTimeout(&g_stream_ready, TIME_IMMEDIATE) == MSG_OK && totalizer_active())
+                        totalizer_integrate(g_stream_half, STREAM_HALF_DEPTH);
+        }
+        adcStopConversion(&ADCD1);
+        can_stream_stop();
+        chThdSetPriority(priority);
+}
+
+#if ANGLE_SYNC
+/*
+ * Crank angle synchronous acquisition: stream the scans of each half
+ * buffer, tagged with their tooth, with steps - 1 interpolated scans
+ * between teeth. A scan is sent once the next one is in, to interpolate
+ * towards it. Scans are counted here, so the worker has to keep up with
+ * the buffer; the tooth check of each revolution shows when it did not.
+ */
+static void _angle_acquisition(void)
+{
+        uint16_t (*scans)[ADC_CHANNELS] = g_scratch.stream.scans;
+        uint16_t last[ADC_CHANNELS];
+        uint8_t last_tooth = ANGLE_NOT_SYNCED;
+        bool have_last = false;
+        uint32_t scan_number = 0;
+        uint32_t checked_revolution = 0;
+        systime_t last_broadcast = chVTGetSystemTimeX();
+
+        chBSemReset(&g_stream_ready, true);
+        angle_sync_start(STREAM_BUF_DEPTH);
+        adcStartConversion(&ADCD1, &adcgrp_angle, g_scratch.stream.buffer, STREAM_BUF_DEPTH);
+
+        while (angle_sync_get_teeth() && !noise_scan_pending() && !chThdShouldTerminateX()) {
+                /* no teeth, no scans: the engine is not turning */
+                if (chBSemWaitTimeout(&g_stream_ready, MS2ST(100)) != MSG_OK)
+                        continue;
+
+                const adcsample_t *half = g_stream_half;
+                if (totalizer_active())
+                        totalizer_integrate(half, STREAM_HALF_DEPTH);
+                uint8_t teeth = angle_sync_get_teeth();
+                uint8_t steps = angle_sync_get_steps();
+                uint8_t first_tooth = ANGLE_NOT_SYNCED;
+                size_t count = 0;
+
+                for (size_t i = 0; i < STREAM_HALF_DEPTH; i++, scan_number++) {
+                        uint16_t scan[ADC_CHANNELS];
+                        acquisition_remap_scan(half + i * ADC_CHANNELS, scan);
+                        if (have_last) {
+                                if (count + steps > TELEMETRY_MAX_SCANS) {
+                                        telemetry_stream_send_angle(first_tooth, teeth, steps, scans, count);
+                                        count = 0;
+                                }
+                                if (!count)
+                                        first_tooth = last_tooth;
+                                acquisition_interpolate(last, scan, steps, scans + count);
+                                count += steps;
+                        }
+                        memcpy(last, scan, sizeof(last));
+                        last_tooth = angle_sync_tooth(scan_number);
+                        have_last = true;
+                }
+                if (count)
+                        telemetry_stream_send_angle(first_tooth, teeth, steps, scans, count);
+
+                uint32_t revolution = angle_sync_revolution_scans();
+                if (revolution && revolution != checked_revolution) {
+                        if (revolution != teeth)
+                                log_info(_LOG_PFX "%u scans between index pulses, expected %u\r\n", revolution, teeth);
+                        checked_revolution = revolution;
+                }
+
+                if (chVTTimeElapsedSinceX(last_broadcast) >= MS2ST(1000 / get_sample_rate())) {
+                        last_broadcast = chVTGetSystemTimeX();
+                        memcpy(adc_samples.raw_samples, last, sizeof(last));
+                        _broadcast_samples(&adc_samples);
+                        log_debug(_LOG_PFX "%u rpm\r\n", angle_sync_rpm());
+                }
+        }
+        adcStopConversion(&ADCD1);
+        angle_sync_stop();
+}
+#endif
+
+void system_adc_worker(void)
+{
+        event_listener_t tx_listener;
+        chEvtRegisterMask(&CAND1.txempty_event, &tx_listener, EVENT_MASK(0));
+
+        while(!chThdShouldTerminateX()) {
+                if (noise_scan_pending())
+                        noise_scan_run(g_scratch.noise);
+                if (supply_monitor_due())
+                        supply_monitor_update();
+                if (can_stream_enabled() && !power_can_asleep()) {
+                        _can_stream_acquisition(&tx_listener);
+                        continue;
+                }
+#if ANGLE_SYNC
+                if (angle_sync_get_teeth()) {
+                        _angle_acquisition();
+                        continue;
+                }
+#endif
+                if (_continuous_wanted()) {
+                        _continuous_acquisition();
+                        continue;
+                }
+                systime_t start = chVTGetSystemTimeX();
+                /* nobody is listening while CAN sleeps */
+                if (!power_can_asleep()) {
+                        _broadcast_samples(system_adc_sample());
+                        if (spectrum_due())
+                                spectrum_run(g_scratch.spectrum);
+                }
+
+                /* Compensate for amount of time needed for sampling and broadcasting CAN message;
+                 * a pass that overran the period (a spectrum at a high rate) still sleeps a tick */
+                systime_t period = MS2ST(1000 / get_sample_rate());
+                systime_t work_time = chVTGetSystemTimeX() - start;
+
+                chThdSleep(work_time < period ? period - work_time : 1);
+        }
+        chEvtUnregister(&CAND1.txempty_event, &tx_listener);
+}
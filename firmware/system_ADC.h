@@ -23,8 +23,8 @@
 #define ADC_H_
 #include "ch.h"
 #include "hal.h"
+#include "acquisition.h"
 
-#define ADC_CHANNELS 4
 struct ADCSamples{
         uint16_t raw_samples[ADC_CHANNELS];
 };
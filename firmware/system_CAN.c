@@ -25,7 +25,23 @@
 #include "system_serial.h"
 #include "settings.h"
 #include "system.h"
+#include "system_timer.h"
+#include "boot_timeline.h"
+#include "latency_probe.h"
+#include "power.h"
+#include "noise_scan.h"
+#include "spectrum.h"
+#include "totalizer.h"
+#include "can_stream.h"
+#include "integrity.h"
+#include "trace.h"
+#if ANGLE_SYNC
+#include "angle_sync.h"
+#endif
 #include "stm32f042x6.h"
+#if TELEMETRY_STREAM
+#include "telemetry_stream.h"
+#endif
 
 #define _LOG_PFX "SYS_CAN:     "
 
@@ -34,9 +50,115 @@
 #define ADR2_ADDRESS_PORT           4
 #define BAUD_RATE_PORT              2
 #define CAN_RX_CONTROL_PORT         1
+#define INPUT_SETTLE_TIME_US        100
 
 static uint32_t g_can_base_address = ANALOGX_CAN_BASE_ID;
 static const CANConfig * g_selected_can_config = NULL;
+
+/*
+ * API message handlers. Fast handlers are I-class: they run with the
+ * kernel locked as soon as the frame is read, ahead of logging, for
+ * commands that must not wait behind anything else.
+ */
+#define API_HANDLER_FAST        0x01
+#define API_HANDLER_CONFIG      0x02    /* receiving it provisions us */
+
+struct ApiHandler {
+        void (*handler)(CANRxFrame *rx_msg);
+        uint8_t min_dlc;
+        uint8_t flags;
+};
+
+enum api_slot {
+        API_SLOT_NONE,
+        API_SLOT_RESET_DEVICE,
+        API_SLOT_SET_CONFIG_GROUP_1,
+        API_SLOT_SET_CONFIG_GROUP_2,
+        API_SLOT_NOISE_SCAN,
+        API_SLOT_SET_SPECTRUM_MODE,
+        API_SLOT_SET_SPECTRUM_BANDS,
+        API_SLOT_SET_CONFIG_GROUP_4,
+        API_SLOT_SET_TOTAL,
+        API_SLOT_SET_CONFIG_GROUP_5,
+        API_SLOT_SET_CAN_STREAM,
+        API_SLOT_GET_IMAGE_CRC,
+#if PULSE_CAPTURE
+        API_SLOT_SET_CONFIG_GROUP_3,
+#endif
+#if TELEMETRY_STREAM
+        API_SLOT_SET_STREAM_MODE,
+#endif
+#if ANGLE_SYNC
+        API_SLOT_SET_ANGLE_MODE,
+#endif
+#if TRACE_ENABLED
+        API_SLOT_TRACE_CONTROL,
+#endif
+#if LATENCY_PROBE_ENABLED
+        API_SLOT_GET_LATENCY_STATS,
+#endif
+};
+
+static const struct ApiHandler g_api_handlers[] = {
+        [API_SLOT_NONE]                 = {NULL, 0, 0},
+        [API_SLOT_RESET_DEVICE]         = {api_reset_device_i, 0, API_HANDLER_FAST},
+        [API_SLOT_SET_CONFIG_GROUP_1]   = {api_set_config_group_1, 1, API_HANDLER_CONFIG},
+        [API_SLOT_SET_CONFIG_GROUP_2]   = {api_set_config_group_2, 0, 0},
+        [API_SLOT_NOISE_SCAN]           = {noise_scan_request, 0, 0},
+        [API_SLOT_SET_SPECTRUM_MODE]    = {spectrum_configure, 4, 0},
+        [API_SLOT_SET_SPECTRUM_BANDS]   = {spectrum_configure_bands, 2 * SPECTRUM_BANDS, 0},
+        [API_SLOT_SET_CONFIG_GROUP_4]   = {api_set_config_group_4, 8, 0},
+        [API_SLOT_SET_TOTAL]            = {totalizer_preset, 1, 0},
+        [API_SLOT_SET_CONFIG_GROUP_5]   = {api_set_config_group_5, 8, 0},
+        [API_SLOT_SET_CAN_STREAM]       = {can_stream_configure, 1, 0},
+        [API_SLOT_GET_IMAGE_CRC]        = {integrity_report_image, 0, 0},
+#if PULSE_CAPTURE
+        [API_SLOT_SET_CONFIG_GROUP_3]   = {api_set_config_group_3, ADC_CHANNELS, 0},
+#endif
+#if TELEMETRY_STREAM
+        [API_SLOT_SET_STREAM_MODE]      = {telemetry_stream_configure, 2, 0},
+#endif
+#if ANGLE_SYNC
+        [API_SLOT_SET_ANGLE_MODE]       = {angle_sync_configure, 2, 0},
+#endif
+#if TRACE_ENABLED
+        [API_SLOT_TRACE_CONTROL]        = {trace_control, 1, 0},
+#endif
+#if LATENCY_PROBE_ENABLED
+        [API_SLOT_GET_LATENCY_STATS]    = {latency_probe_report, 0, 0},
+#endif
+};
+
+/* Handler slot by offset within our API range; a byte per offset keeps
+ * the lookup O(1) without a full table of handlers in flash */
+static const uint8_t g_api_slots[ANALOGX_CAN_API_RANGE] = {
+        [API_RESET_DEVICE]              = API_SLOT_RESET_DEVICE,
+        [API_SET_CONFIG_GROUP_1]        = API_SLOT_SET_CONFIG_GROUP_1,
+        [API_SET_CONFIG_GROUP_2]        = API_SLOT_SET_CONFIG_GROUP_2,
+        [API_NOISE_SCAN]                = API_SLOT_NOISE_SCAN,
+        [API_SET_SPECTRUM_MODE]         = API_SLOT_SET_SPECTRUM_MODE,
+        [API_SET_SPECTRUM_BANDS]        = API_SLOT_SET_SPECTRUM_BANDS,
+        [API_SET_CONFIG_GROUP_4]        = API_SLOT_SET_CONFIG_GROUP_4,
+        [API_SET_TOTAL]                 = API_SLOT_SET_TOTAL,
+        [API_SET_CONFIG_GROUP_5]        = API_SLOT_SET_CONFIG_GROUP_5,
+        [API_SET_CAN_STREAM]            = API_SLOT_SET_CAN_STREAM,
+        [API_GET_IMAGE_CRC]             = API_SLOT_GET_IMAGE_CRC,
+#if PULSE_CAPTURE
+        [API_SET_CONFIG_GROUP_3]        = API_SLOT_SET_CONFIG_GROUP_3,
+#endif
+#if TELEMETRY_STREAM
+        [API_SET_STREAM_MODE]           = API_SLOT_SET_STREAM_MODE,
+#endif
+#if ANGLE_SYNC
+        [API_SET_ANGLE_MODE]            = API_SLOT_SET_ANGLE_MODE,
+#endif
+#if TRACE_ENABLED
+        [API_TRACE_CONTROL]             = API_SLOT_TRACE_CONTROL,
+#endif
+#if LATENCY_PROBE_ENABLED
+        [API_GET_LATENCY_STATS]         = API_SLOT_GET_LATENCY_STATS,
+#endif
+};
 /*
  * 500K baud; 36MHz clock
  */
@@ -55,8 +177,13 @@ static const CANConfig cancfg_1MB = {
         CAN_BTR_TS1(11) | CAN_BTR_TS2(2) | CAN_BTR_BRP(2)
 };
 
-static void _spin_wait(void)
+/* Allow the pull-ups on the jumper inputs to settle */
+static void _settle_inputs(void)
 {
+        if (FAST_BOOT) {
+                system_timer_delay_us(INPUT_SETTLE_TIME_US);
+                return;
+        }
         for (uint32_t i = 0; i < 100000; i++) {
                 asm("");
         }
@@ -64,8 +191,6 @@ static void _spin_wait(void)
 
 static const CANConfig * _select_can_configuration(void)
 {
-        palSetPadMode(GPIOA, BAUD_RATE_PORT, PAL_STM32_MODE_INPUT | PAL_STM32_PUPDR_PULLUP);
-        _spin_wait();
         return palReadPad(GPIOA, BAUD_RATE_PORT) == PAL_HIGH ? &cancfg_1MB : &cancfg_500K;
 }
 
@@ -100,16 +225,17 @@ static void init_can_gpio(void)
  */
 static void init_can_operating_parameters(void)
 {
-        /* Init CAN jumper GPIOs for determining base address offset */
+        /* Init CAN jumper GPIOs for determining base address offset and baud rate */
         palSetPadMode(GPIOA, ADR1_ADDRESS_PORT, PAL_STM32_MODE_INPUT | PAL_STM32_PUPDR_PULLUP);
         palSetPadMode(GPIOA, ADR2_ADDRESS_PORT, PAL_STM32_MODE_INPUT | PAL_STM32_PUPDR_PULLUP);
-        _spin_wait();
+        palSetPadMode(GPIOA, BAUD_RATE_PORT, PAL_STM32_MODE_INPUT | PAL_STM32_PUPDR_PULLUP);
+        _settle_inputs();
 
         uint32_t offset = 0;
         offset |= palReadPad(GPIOA, ADR1_ADDRESS_PORT) == PAL_HIGH ? 0x01 : 0x00;
         offset |= palReadPad(GPIOA, ADR2_ADDRESS_PORT) == PAL_HIGH ? 0x02 : 0x00;
 
-        g_can_base_address += (ANALOGX_CAN_API_RANGE * offset);
+        g_can_base_address = api_protocol_base_id(offset);
 
         g_selected_can_config = _select_can_configuration();
 }
@@ -118,26 +244,40 @@ void system_can_init(void)
 {
         init_can_operating_parameters();
         init_can_gpio();
+        boot_timeline_mark(BOOT_PHASE_CAN_READY);
 }
 
 /*
- * Dispatch an incoming CAN message
+ * Dispatch an incoming CAN message to its API handler, if it has one.
+ * Returns false for messages that are not ours or not handled.
  */
-static bool dispatch_can_rx(CANRxFrame *rx_msg)
+bool dispatch_can_rx(CANRxFrame *rx_msg)
 {
-        int32_t can_id = rx_msg->IDE == CAN_IDE_EXT ? rx_msg->EID : rx_msg->SID;
-        bool got_config_message = false;
-        switch (can_id - g_can_base_address) {
-        case API_SET_CONFIG_GROUP_1:
-                api_set_config_group_1(rx_msg);
-                got_config_message = true;
-                break;
-        default:
+        uint32_t can_id = rx_msg->IDE == CAN_IDE_EXT ? rx_msg->EID : rx_msg->SID;
+        int32_t offset = api_protocol_offset(can_id, g_can_base_address);
+        if (offset == API_OFFSET_NONE)
+                return false;
+
+        const struct ApiHandler *api = &g_api_handlers[g_api_slots[offset]];
+        if (!api->handler)
                 return false;
+
+        if (rx_msg->DLC < api->min_dlc) {
+                log_info(_LOG_PFX "Short message for API %u (DLC %u)\r\n", offset, rx_msg->DLC);
+                return true;
+        }
+
+        if (api->flags & API_HANDLER_FAST) {
+                chSysLock();
+                api->handler(rx_msg);
+                chSysUnlock();
+        } else {
+                api->handler(rx_msg);
         }
+
         /* if we received a configuration message then we are provisioned */
-        if (got_config_message)
-                set_api_is_provisioned(got_config_message);
+        if (api->flags & API_HANDLER_CONFIG)
+                set_api_is_provisioned(true);
         return true;
 }
 
@@ -146,6 +286,12 @@ uint32_t get_can_base_id(void)
         return g_can_base_address;
 }
 
+/* Bits per second of the selected configuration */
+uint32_t get_can_bitrate(void)
+{
+        return g_selected_can_config == &cancfg_1MB ? 1000000 : 500000;
+}
+
 /* Main worker for receiving CAN messages */
 void can_worker(void)
 {
@@ -154,7 +300,8 @@ void can_worker(void)
         chRegSetThreadName("CAN receiver");
         chEvtRegister(&CAND1.rxfull_event, &el, 0);
 
-        chThdSleepMilliseconds(CAN_WORKER_STARTUP_DELAY);
+        if (!FAST_BOOT)
+                chThdSleepMilliseconds(CAN_WORKER_STARTUP_DELAY);
         log_info(_LOG_PFX "CAN base address: %u\r\n", g_can_base_address);
 
         if (g_selected_can_config == &cancfg_500K) {
@@ -173,14 +320,15 @@ void can_worker(void)
 
                 if (chEvtWaitAnyTimeout(ALL_EVENTS, MS2ST(1000)) == 0) {
                         /* continue to send announcements until we are provisioned */
-                        if (!api_is_provisoned())
+                        if (!api_is_provisoned() && !power_can_asleep())
                                 api_send_announcement();
                         continue;
                 }
                 while (canReceive(&CAND1, CAN_ANY_MAILBOX, &rx_msg, TIME_IMMEDIATE) == MSG_OK) {
-                        /* Process message.*/
-                        log_CAN_rx_message(_LOG_PFX, &rx_msg);
+                        /* Process message; logged after, so fast handlers act first */
+                        trace_mark(TRACE_MARK_CAN_RX, rx_msg.EID);
                         dispatch_can_rx(&rx_msg);
+                        log_CAN_rx_message(_LOG_PFX, &rx_msg);
                 }
         }
         chEvtUnregister(&CAND1.rxfull_event, &el);
@@ -0,0 +1,114 @@
+/*
+ * AnalogX firmware
+ *
+ * Copyright (C) 2017 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "system_flash.h"
+#include "stm32f042x6.h"
+
+static void _wait_not_busy(void)
+{
+        while (FLASH->SR & FLASH_SR_BSY);
+}
+
+/* Check and clear the result of the last flash operation */
+static bool _operation_succeeded(void)
+{
+        uint32_t status = FLASH->SR;
+        FLASH->SR = FLASH_SR_EOP | FLASH_SR_PGERR | FLASH_SR_WRPRTERR;
+        return !(status & (FLASH_SR_PGERR | FLASH_SR_WRPRTERR));
+}
+
+static void _unlock(void)
+{
+        _wait_not_busy();
+        if (FLASH->CR & FLASH_CR_LOCK) {
+                FLASH->KEYR = FLASH_KEY1;
+                FLASH->KEYR = FLASH_KEY2;
+        }
+}
+
+static void _lock(void)
+{
+        FLASH->CR |= FLASH_CR_LOCK;
+}
+
+const uint8_t * system_flash_config_area(void)
+{
+        return (const uint8_t *)SYSTEM_FLASH_CONFIG_BASE;
+}
+
+/* From the linker script: where the initial values of .data sit in flash */
+extern uint8_t _textdata[], _data[], _edata[];
+
+/*
+ * The application image as programmed: vectors, code, constants and the
+ * initial values of .data, the extent of the .bin file.
+ */
+const uint8_t * system_flash_image(size_t *length)
+{
+        const uint8_t *base = (const uint8_t *)SYSTEM_FLASH_IMAGE_BASE;
+        *length = (size_t)(_textdata - base) + (size_t)(_edata - _data);
+        return base;
+}
+
+/*
+ * Erase one of the configuration pages.
+ * Note the CPU stalls on instruction fetch while the erase is in progress.
+ */
+bool system_flash_erase_config_page(uint32_t page)
+{
+        if (page >= SYSTEM_FLASH_CONFIG_PAGES)
+                return false;
+
+        _unlock();
+        FLASH->CR |= FLASH_CR_PER;
+        FLASH->AR = SYSTEM_FLASH_CONFIG_BASE + page * SYSTEM_FLASH_PAGE_SIZE;
+        FLASH->CR |= FLASH_CR_STRT;
+        _wait_not_busy();
+        FLASH->CR &= ~FLASH_CR_PER;
+        bool success = _operation_succeeded();
+        _lock();
+        return success;
+}
+
+/*
+ * Program data into the configuration area, one half-word at a time.
+ * offset and len must be half-word aligned and the target erased.
+ */
+bool system_flash_program_config(uint32_t offset, const void *data, size_t len)
+{
+        if ((offset & 1) || (len & 1) ||
+            offset + len > SYSTEM_FLASH_CONFIG_PAGES * SYSTEM_FLASH_PAGE_SIZE)
+                return false;
+
+        const uint16_t *src = data;
+        volatile uint16_t *dest = (volatile uint16_t *)(SYSTEM_FLASH_CONFIG_BASE + offset);
+        bool success = true;
+
+        _unlock();
+        FLASH->CR |= FLASH_CR_PG;
+        for (size_t i = 0; i < len / 2 && success; i++) {
+                dest[i] = src[i];
+                _wait_not_busy();
+                success = _operation_succeeded() && dest[i] == src[i];
+        }
+        FLASH->CR &= ~FLASH_CR_PG;
+        _lock();
+        return success;
+}
@@ -0,0 +1,39 @@
+/*
+ * AnalogX firmware
+ *
+ * Copyright (C) 2017 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SYSTEM_FLASH_H_
+#define SYSTEM_FLASH_H_
+#include "ch.h"
+#include "hal.h"
+
+/* The last pages of the STM32F042's 32K flash are reserved for
+ * persistent configuration; see board/STM32F042x6.ld */
+#define SYSTEM_FLASH_PAGE_SIZE          1024
+#define SYSTEM_FLASH_CONFIG_PAGES       2
+#define SYSTEM_FLASH_CONFIG_BASE        0x08007800
+#define SYSTEM_FLASH_IMAGE_BASE         0x08000000
+
+const uint8_t * system_flash_config_area(void);
+const uint8_t * system_flash_image(size_t *length);
+bool system_flash_erase_config_page(uint32_t page);
+bool system_flash_program_config(uint32_t offset, const void *data, size_t len);
+
+#endif /* SYSTEM_FLASH_H_ */
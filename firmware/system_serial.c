@@ -19,7 +19,11 @@
  * this code. If not, see <http://www.gnu.org/licenses/>.
  */
 #include "system_serial.h"
+#if TELEMETRY_STREAM
+#include "telemetry_stream.h"
+#endif
 
+#if !TELEMETRY_STREAM
 /*
  * Read a line from the specified serial connection into the specified
  * buffer buf with a length of buf_len
@@ -56,9 +60,15 @@ void system_serial_init_SD2(uint32_t speed)
         palSetPadMode(GPIOA, 3, PAL_STM32_MODE_ALTERNATE | PAL_STM32_PUPDR_PULLUP | PAL_STM32_ALTERNATE(1));
         sdStart(&SD2, &uart_cfg);
 }
+#endif
 
 /* Initialize our serial subsystem */
 void system_serial_init()
 {
+#if TELEMETRY_STREAM
+        /* USART2 carries the telemetry stream instead of SD2 */
+        telemetry_stream_init();
+#else
         system_serial_init_SD2(SD2_BAUD);
+#endif
 }
@@ -24,12 +24,13 @@
 #include "ch.h"
 #include "hal.h"
 
-#define SD1_BAUD 115200
 #define SD2_BAUD 115200
 
+/* SD2 is the only serial driver; the telemetry stream takes it over */
+#if !TELEMETRY_STREAM
 size_t serial_getline(SerialDriver *sdp, uint8_t *buf, size_t buf_len);
-void system_serial_init_SD1(uint32_t speed);
 void system_serial_init_SD2(uint32_t speed);
+#endif
 void system_serial_init(void);
 
 #endif /* SERIAL_H_ */
@@ -0,0 +1,37 @@
+/*
+ * AnalogX firmware
+ *
+ * Copyright (C) 2017 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "system_timer.h"
+
+/* Start SysTick free running at HCLK with interrupts disabled */
+void system_timer_init(void)
+{
+        SysTick->LOAD = SYSTEM_TIMER_MASK;
+        SysTick->VAL = 0;
+        SysTick->CTRL = SysTick_CTRL_CLKSOURCE_Msk | SysTick_CTRL_ENABLE_Msk;
+}
+
+/* Busy wait; for short settling delays where sleeping is not an option */
+void system_timer_delay_us(uint32_t us)
+{
+        uint32_t start = system_timer_cycles();
+        uint32_t cycles = us * SYSTEM_TIMER_CYCLES_PER_US;
+        while (system_timer_elapsed(start) < cycles);
+}
@@ -0,0 +1,58 @@
+/*
+ * AnalogX firmware
+ *
+ * Copyright (C) 2017 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SYSTEM_TIMER_H_
+#define SYSTEM_TIMER_H_
+#include "ch.h"
+#include "hal.h"
+
+/*
+ * High resolution cycle counter.
+ *
+ * The kernel's system time runs on TIM2 at CH_CFG_ST_FREQUENCY, which is
+ * too coarse for profiling; SysTick is otherwise unused in tickless mode
+ * so we run it free at HCLK as a 24 bit cycle counter. Intervals longer
+ * than SYSTEM_TIMER_MASK cycles (~349ms at 48MHz) wrap.
+ */
+#define SYSTEM_TIMER_MASK               0x00FFFFFF
+#define SYSTEM_TIMER_CYCLES_PER_US      (STM32_HCLK / 1000000)
+
+void system_timer_init(void);
+void system_timer_delay_us(uint32_t us);
+
+/* Current cycle count; counts up, modulo SYSTEM_TIMER_MASK + 1 */
+static inline uint32_t system_timer_cycles(void)
+{
+        return SYSTEM_TIMER_MASK - SysTick->VAL;
+}
+
+/* Cycles elapsed since a previous call to system_timer_cycles() */
+static inline uint32_t system_timer_elapsed(uint32_t start)
+{
+        return (system_timer_cycles() - start) & SYSTEM_TIMER_MASK;
+}
+
+static inline uint32_t system_timer_cycles_to_us(uint32_t cycles)
+{
+        return cycles / SYSTEM_TIMER_CYCLES_PER_US;
+}
+
+#endif /* SYSTEM_TIMER_H_ */
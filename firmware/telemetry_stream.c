@@ -0,0 +1,287 @@
+/*
+ * AnalogX firmware
+ *
+ * Copyright (C) 2017 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "telemetry_stream.h"
+#include "cobs.h"
+#include "integrity.h"
+#include "logging.h"
+#include "modp_numtoa.h"
+#include "settings.h"
+#include <string.h>
+
+#define _LOG_PFX "STREAM:      "
+
+/* type (1) + sequence (2) + payload + CRC32 (4) */
+#define TELEMETRY_FRAME_MAX     (3 + TELEMETRY_MAX_PAYLOAD + 4)
+/* Must be a power of 2 */
+#define TELEMETRY_TX_BUFFERS    2
+#define TELEMETRY_TX_MASK       (TELEMETRY_TX_BUFFERS - 1)
+#define TELEMETRY_TX_SIZE       (COBS_ENCODED_MAX(TELEMETRY_FRAME_MAX) + 1)
+/* A binary frame is built this far into its buffer and encoded in place */
+#define TELEMETRY_FRAME_OFFSET  (COBS_ENCODED_MAX(TELEMETRY_FRAME_MAX) - TELEMETRY_FRAME_MAX)
+
+struct TelemetryBuffer {
+        size_t length;
+        uint8_t data[TELEMETRY_TX_SIZE];
+};
+
+static struct TelemetryBuffer g_tx_buffers[TELEMETRY_TX_BUFFERS];
+static uint8_t g_tx_head = 0;
+static uint8_t g_tx_count = 0;
+
+/* Claimed by _claim_payload(), filled and queued under the lock */
+static struct TelemetryBuffer *g_claimed;
+static uint16_t g_sequence = 0;
+static uint32_t g_dropped = 0;
+static MUTEX_DECL(g_stream_lock);
+
+static enum telemetry_mode g_mode = TELEMETRY_MODE_OFF;
+static uint8_t g_oversample_shift = TELEMETRY_DEFAULT_OVERSAMPLE_SHIFT;
+
+/* A buffer left the DMA; start on the next queued one, if any */
+static void _tx_end(UARTDriver *uartp)
+{
+        chSysLockFromISR();
+        g_tx_head = (g_tx_head + 1) & TELEMETRY_TX_MASK;
+        g_tx_count--;
+        if (g_tx_count > 0) {
+                struct TelemetryBuffer *buffer = &g_tx_buffers[g_tx_head];
+                uartStartSendI(uartp, buffer->length, buffer->data);
+        }
+        chSysUnlockFromISR();
+}
+
+static const UARTConfig g_uart_cfg = {
+        _tx_end,                /* txend1_cb */
+        NULL,                   /* txend2_cb */
+        NULL,                   /* rxend_cb */
+        NULL,                   /* rxchar_cb */
+        NULL,                   /* rxerr_cb */
+        TELEMETRY_BAUD,
+        0,                      /* CR1 */
+        0,                      /* CR2 */
+        0                       /* CR3 */
+};
+
+void telemetry_stream_init(void)
+{
+        /* USART2 TX.       */
+        palSetPadMode(GPIOA, 2, PAL_STM32_MODE_ALTERNATE | PAL_STM32_OTYPE_PUSHPULL | PAL_STM32_OSPEED_HIGHEST | PAL_STM32_ALTERNATE(1));
+        /* USART2 RX.       */
+        palSetPadMode(GPIOA, 3, PAL_STM32_MODE_ALTERNATE | PAL_STM32_PUPDR_PULLUP | PAL_STM32_ALTERNATE(1));
+        uartStart(&UARTD2, &g_uart_cfg);
+}
+
+/*
+ * Claim the tail buffer and lock the stream; returns where the payload
+ * goes, to be queued by _send_claimed(). Never blocks on the UART: when
+ * both buffers are in flight the frame is dropped, counted and NULL
+ * returned, unlocked.
+ */
+static uint8_t * _claim_payload(bool binary)
+{
+        chMtxLock(&g_stream_lock);
+
+        chSysLock();
+        bool full = g_tx_count == TELEMETRY_TX_BUFFERS;
+        chSysUnlock();
+        if (full) {
+                g_sequence++;
+                g_dropped++;
+                chMtxUnlock(&g_stream_lock);
+                return NULL;
+        }
+
+        /* only the owner of the mutex fills the tail buffer */
+        g_claimed = &g_tx_buffers[(g_tx_head + g_tx_count) & TELEMETRY_TX_MASK];
+        return binary ? g_claimed->data + TELEMETRY_FRAME_OFFSET + 3 : g_claimed->data;
+}
+
+/* Frame the claimed payload of len bytes, queue it and unlock the stream */
+static void _send_claimed(uint8_t type, size_t len, bool binary)
+{
+        struct TelemetryBuffer *buffer = g_claimed;
+        uint16_t sequence = g_sequence++;
+
+        if (binary) {
+                uint8_t *frame = buffer->data + TELEMETRY_FRAME_OFFSET;
+                frame[0] = type;
+                frame[1] = sequence;
+                frame[2] = sequence >> 8;
+                uint32_t crc = integrity_crc32(frame, 3 + len);
+                uint8_t *p = frame + 3 + len;
+                *p++ = crc;
+                *p++ = crc >> 8;
+                *p++ = crc >> 16;
+                *p++ = crc >> 24;
+                buffer->length = cobs_encode(frame, p - frame, buffer->data);
+                buffer->data[buffer->length++] = 0;
+        } else {
+                buffer->length = len;
+        }
+
+        chSysLock();
+        g_tx_count++;
+        if (g_tx_count == 1)
+                uartStartSendI(&UARTD2, buffer->length, buffer->data);
+        chSysUnlock();
+
+        chMtxUnlock(&g_stream_lock);
+}
+
+/*
+ * Frame and queue a payload for DMA transmission. Never blocks on the
+ * UART; when both buffers are in flight the frame is dropped and counted.
+ */
+bool telemetry_stream_send(uint8_t type, const void *payload, size_t len)
+{
+        if (len > TELEMETRY_MAX_PAYLOAD)
+                len = TELEMETRY_MAX_PAYLOAD;
+
+        bool binary = g_mode == TELEMETRY_MODE_BINARY;
+        uint8_t *p = _claim_payload(binary);
+        if (!p)
+                return false;
+        memcpy(p, payload, len);
+        _send_claimed(type, len, binary);
+        return true;
+}
+
+/* Append a decimal value and a separator, without chprintf */
+static char * _append_value(char *p, uint16_t value, char separator)
+{
+        modp_uitoa10(value, p);
+        p += strlen(p);
+        *p++ = separator;
+        return p;
+}
+
+/*
+ * Stream a block of oversampled scans. Binary mode sends them all as
+ * one samples frame: oversample shift, scan count, channel count, then
+ * the values scan by scan, written straight into the transmit buffer.
+ * Text mode sends one CSV line with the mean
+ * of the block, slow enough to read on a terminal.
+ */
+void telemetry_stream_send_samples(uint16_t (*scans)[ADC_CHANNELS], size_t count)
+{
+        if (count > TELEMETRY_MAX_SCANS)
+                count = TELEMETRY_MAX_SCANS;
+
+        if (g_mode == TELEMETRY_MODE_BINARY) {
+                uint8_t *payload = _claim_payload(true);
+                if (!payload)
+                        return;
+                uint8_t *p = payload;
+                *p++ = g_oversample_shift;
+                *p++ = count;
+                *p++ = ADC_CHANNELS;
+                for (size_t i = 0; i < count; i++) {
+                        for (size_t c = 0; c < ADC_CHANNELS; c++) {
+                                *p++ = scans[i][c];
+                                *p++ = scans[i][c] >> 8;
+                        }
+                }
+                _send_claimed(TELEMETRY_FRAME_SAMPLES, p - payload, true);
+        } else if (g_mode == TELEMETRY_MODE_TEXT) {
+                char line[ADC_CHANNELS * 6 + 2];
+                char *p = line;
+                for (size_t c = 0; c < ADC_CHANNELS; c++) {
+                        uint32_t sum = 0;
+                        for (size_t i = 0; i < count; i++)
+                                sum += scans[i][c];
+                        p = _append_value(p, sum / count, c == ADC_CHANNELS - 1 ? '\r' : ',');
+                }
+                *p++ = '\n';
+                telemetry_stream_send(TELEMETRY_FRAME_SAMPLES, line, p - line);
+        }
+}
+
+/*
+ * Stream a block of crank angle synchronous scans, steps per tooth. Binary
+ * mode sends one angle frame: tooth of the first scan (0xFF before the
+ * index is seen), teeth per revolution, steps per tooth, scan count,
+ * channel count, then the values scan by scan, written straight into the
+ * transmit buffer. Text mode sends one CSV
+ * line with the first scan, prefixed by its tooth.
+ */
+void telemetry_stream_send_angle(uint8_t first_tooth, uint8_t teeth, uint8_t steps,
+                                 uint16_t (*scans)[ADC_CHANNELS], size_t count)
+{
+        if (count > TELEMETRY_MAX_SCANS)
+                count = TELEMETRY_MAX_SCANS;
+
+        if (g_mode == TELEMETRY_MODE_BINARY) {
+                uint8_t *payload = _claim_payload(true);
+                if (!payload)
+                        return;
+                uint8_t *p = payload;
+                *p++ = first_tooth;
+                *p++ = teeth;
+                *p++ = steps;
+                *p++ = count;
+                *p++ = ADC_CHANNELS;
+                for (size_t i = 0; i < count; i++) {
+                        for (size_t c = 0; c < ADC_CHANNELS; c++) {
+                                *p++ = scans[i][c];
+                                *p++ = scans[i][c] >> 8;
+                        }
+                }
+                _send_claimed(TELEMETRY_FRAME_ANGLE, p - payload, true);
+        } else if (g_mode == TELEMETRY_MODE_TEXT && count) {
+                char line[(ADC_CHANNELS + 1) * 6 + 2];
+                char *p = _append_value(line, first_tooth, ',');
+                for (size_t c = 0; c < ADC_CHANNELS; c++)
+                        p = _append_value(p, scans[0][c], c == ADC_CHANNELS - 1 ? '\r' : ',');
+                *p++ = '\n';
+                telemetry_stream_send(TELEMETRY_FRAME_ANGLE, line, p - line);
+        }
+}
+
+/*
+ * Select the stream mode from CAN: data8[0] is the telemetry_mode,
+ * data8[1] the oversampling shift (2^n conversions per streamed value).
+ */
+void telemetry_stream_configure(CANRxFrame *rx_msg)
+{
+        if (rx_msg->DLC < 2 || rx_msg->data8[0] > TELEMETRY_MODE_TEXT ||
+            rx_msg->data8[1] > TELEMETRY_MAX_OVERSAMPLE_SHIFT) {
+                log_info(_LOG_PFX "Invalid params for set stream mode\r\n");
+                return;
+        }
+        g_oversample_shift = rx_msg->data8[1];
+        g_mode = rx_msg->data8[0];
+        log_info(_LOG_PFX "mode %u oversample shift %u\r\n", g_mode, g_oversample_shift);
+}
+
+enum telemetry_mode telemetry_stream_get_mode(void)
+{
+        return g_mode;
+}
+
+uint8_t telemetry_stream_get_oversample_shift(void)
+{
+        return g_oversample_shift;
+}
+
+uint32_t telemetry_stream_get_dropped(void)
+{
+        return g_dropped;
+}
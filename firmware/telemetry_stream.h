@@ -0,0 +1,69 @@
+/*
+ * AnalogX firmware
+ *
+ * Copyright (C) 2017 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TELEMETRY_STREAM_H_
+#define TELEMETRY_STREAM_H_
+#include "ch.h"
+#include "hal.h"
+#include "system_ADC.h"
+
+/*
+ * Framed binary telemetry over USART2, built with make USE_UART_STREAM=yes.
+ * In binary mode every frame is COBS encoded and ends with a 0x00 byte:
+ * type (u8), sequence (u16), payload, CRC32 of the preceding bytes (u32),
+ * all little endian. The sequence advances for dropped frames too, so
+ * the host can detect gaps. In the other modes payloads are sent as is.
+ * Samples and angle frames carry the physical channels in ADC counts;
+ * virtual channels are only in the CAN sensor frames.
+ */
+#define TELEMETRY_FRAME_SAMPLES     1
+#define TELEMETRY_FRAME_LOG         2
+#define TELEMETRY_FRAME_ANGLE       3
+
+/* Scans per samples or angle frame, and the largest payload */
+#define TELEMETRY_MAX_SCANS         16
+#define TELEMETRY_MAX_PAYLOAD       (5 + TELEMETRY_MAX_SCANS * 4 * 2)
+#define TELEMETRY_MAX_OVERSAMPLE_SHIFT 4
+
+enum telemetry_mode {
+        TELEMETRY_MODE_OFF,
+        TELEMETRY_MODE_BINARY,
+        TELEMETRY_MODE_TEXT
+};
+
+void telemetry_stream_init(void);
+
+bool telemetry_stream_send(uint8_t type, const void *payload, size_t len);
+
+void telemetry_stream_send_samples(uint16_t (*scans)[ADC_CHANNELS], size_t count);
+
+void telemetry_stream_send_angle(uint8_t first_tooth, uint8_t teeth, uint8_t steps,
+                                 uint16_t (*scans)[ADC_CHANNELS], size_t count);
+
+void telemetry_stream_configure(CANRxFrame *rx_msg);
+
+enum telemetry_mode telemetry_stream_get_mode(void);
+
+uint8_t telemetry_stream_get_oversample_shift(void);
+
+uint32_t telemetry_stream_get_dropped(void);
+
+#endif /* TELEMETRY_STREAM_H_ */
@@ -0,0 +1,119 @@
+/*
+ * AnalogX firmware
+ *
+ * Copyright (C) 2017 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Host microbenchmarks for the acquisition pipeline. Figures are host
+ * nanoseconds: use them to compare changes to the pure logic, and the
+ * on-target bench image (../bench) for absolute cycle counts.
+ */
+#include "acquisition.h"
+#include "api_protocol.h"
+#include "cobs.h"
+#include "crc32.h"
+#include "fft_q15.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define BENCH_RUNS              5
+#define BENCH_ITERATIONS        1000000
+#define STREAM_SCANS            16
+
+static volatile uint32_t g_sink;
+
+static uint64_t _now_ns(void)
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Best of BENCH_RUNS, reported per unit of work and as a rate */
+#define BENCH(name, unit, units_per_iter, iterations, body) do { \
+        uint64_t best = UINT64_MAX; \
+        for (int _run = 0; _run < BENCH_RUNS; _run++) { \
+                uint64_t _start = _now_ns(); \
+                for (uint32_t i = 0; i < (iterations); i++) { \
+                        body; \
+                } \
+                uint64_t _elapsed = _now_ns() - _start; \
+                if (_elapsed < best) \
+                        best = _elapsed; \
+        } \
+        double per_unit = (double)best / ((double)(iterations) * (units_per_iter)); \
+        printf("%-24s %10.2f ns/%-7s %12.0f %s/s\n", name, per_unit, unit, 1e9 / per_unit, unit); \
+} while (0)
+
+int main(void)
+{
+        uint16_t buffer[STREAM_SCANS * ADC_CHANNELS];
+        uint16_t samples[ADC_CHANNELS];
+        uint16_t scaled[ADC_CHANNELS];
+        uint16_t scans[STREAM_SCANS][ADC_CHANNELS];
+        uint8_t payload[3 + STREAM_SCANS * ADC_CHANNELS * 2 + 4];
+        uint8_t encoded[COBS_ENCODED_MAX(sizeof(payload))];
+
+        for (size_t i = 0; i < STREAM_SCANS * ADC_CHANNELS; i++)
+                buffer[i] = (i * 2654435761u) >> 20;
+
+        BENCH("scale_sample", "sample", 1, BENCH_ITERATIONS,
+              g_sink += scale_0_to_5_volts(i & 0x0FFF));
+
+        /* a CAN broadcast: remap one scan and scale it into the payload */
+        BENCH("broadcast_scan", "frame", 1, BENCH_ITERATIONS,
+              buffer[0] = i & 0x0FFF;
+              acquisition_remap_scan(buffer, samples);
+              acquisition_scale_scan(samples, scaled);
+              g_sink += scaled[3]);
+
+        for (uint8_t shift = 0; shift <= 4; shift += 2) {
+                char name[32];
+                snprintf(name, sizeof(name), "oversample_shift_%u", shift);
+                BENCH(name, "sample", STREAM_SCANS * ADC_CHANNELS, BENCH_ITERATIONS / 10,
+                      buffer[0] = i & 0x0FFF;
+                      g_sink += acquisition_oversample(buffer, STREAM_SCANS, shift, scans));
+        }
+
+        /* a binary telemetry frame of 16 scans: CRC and COBS */
+        memcpy(payload + 3, buffer, sizeof(buffer));
+        BENCH("stream_frame", "frame", 1, BENCH_ITERATIONS / 10,
+              payload[0] = i;
+              uint32_t crc = crc32(payload, sizeof(payload) - 4);
+              memcpy(payload + sizeof(payload) - 4, &crc, 4);
+              g_sink += cobs_encode(payload, sizeof(payload), encoded));
+
+        /* a spectrum block: Hann window and 256 point transform */
+        int16_t re[FFT_MAX_POINTS];
+        int16_t im[FFT_MAX_POINTS];
+        BENCH("fft_256_hann", "block", 1, BENCH_ITERATIONS / 100,
+              for (uint16_t k = 0; k < FFT_MAX_POINTS; k++) {
+                      re[k] = (int16_t)(buffer[k & 63] << 2) - 8192;
+                      im[k] = 0;
+              }
+              fft_q15_window(re, FFT_MAX_LOG2, FFT_WINDOW_HANN);
+              fft_q15(re, im, FFT_MAX_LOG2);
+              g_sink += re[1]);
+
+        uint32_t base = api_protocol_base_id(0);
+        BENCH("decode_can_id", "frame", 1, BENCH_ITERATIONS,
+              g_sink += api_protocol_offset(base - 512 + (i & 0x3FF), base));
+        return 0;
+}
@@ -0,0 +1,363 @@
+/*
+ * AnalogX firmware
+ *
+ * Copyright (C) 2017 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "unit_test.h"
+#include "acquisition.h"
+
+static void _test_remap(void)
+{
+        /* conversion order is channels 5, 6, 7, 9 = analog 4, 3, 2, 1 */
+        const uint16_t scan[ADC_CHANNELS] = {4, 3, 2, 1};
+        uint16_t samples[ADC_CHANNELS];
+        acquisition_remap_scan(scan, samples);
+        CHECK_EQ(samples[0], 1);
+        CHECK_EQ(samples[1], 2);
+        CHECK_EQ(samples[2], 3);
+        CHECK_EQ(samples[3], 4);
+}
+
+static void _test_normalize(void)
+{
+        uint16_t scan[ADC_CHANNELS] = {1, 2, 3, 4};
+        acquisition_normalize_scan(scan, ACQUISITION_SCAN_ASCENDING, 0);
+        CHECK_EQ(scan[0], 1);
+        CHECK_EQ(scan[3], 4);
+
+        /* descending scans are put back in ascending order */
+        acquisition_normalize_scan(scan, ACQUISITION_SCAN_DESCENDING, 0);
+        CHECK_EQ(scan[0], 4);
+        CHECK_EQ(scan[1], 3);
+        CHECK_EQ(scan[2], 2);
+        CHECK_EQ(scan[3], 1);
+
+        /* 8 bit full scale reads as 12 bit full scale less the lost bits */
+        uint16_t low[ADC_CHANNELS] = {255, 128, 1, 0};
+        acquisition_normalize_scan(low, ACQUISITION_SCAN_ASCENDING, 2);
+        CHECK_EQ(low[0], 4080);
+        CHECK_EQ(low[1], 2048);
+        CHECK_EQ(low[2], 16);
+        CHECK_EQ(low[3], 0);
+}
+
+static void _test_max_scan_rate(void)
+{
+        /* 28.5 + 12.5 cycles at 14MHz, four conversions per scan */
+        CHECK_EQ(acquisition_max_scan_rate(3, 0), 14000000 / (41 * 4));
+        /* 1.5 + 6.5 cycles is the fastest */
+        CHECK_EQ(acquisition_max_scan_rate(0, 3), 14000000 / (8 * 4));
+        CHECK_EQ(acquisition_max_scan_rate(7, 0), 14000000 / (252 * 4));
+
+        /* longer sample times and more bits are never faster */
+        for (uint8_t r = 0; r < ACQUISITION_RESOLUTIONS; r++) {
+                for (uint8_t s = 1; s < ACQUISITION_SAMPLE_TIMES; s++)
+                        CHECK(acquisition_max_scan_rate(s, r) < acquisition_max_scan_rate(s - 1, r));
+                if (r > 0)
+                        CHECK(acquisition_max_scan_rate(0, r) > acquisition_max_scan_rate(0, r - 1));
+        }
+
+        CHECK_EQ(acquisition_max_scan_rate(ACQUISITION_SAMPLE_TIMES, 0), 0);
+        CHECK_EQ(acquisition_max_scan_rate(0, ACQUISITION_RESOLUTIONS), 0);
+}
+
+static void _test_interpolate(void)
+{
+        const uint16_t from[ADC_CHANNELS] = {100, 200, 4095, 7};
+        const uint16_t to[ADC_CHANNELS] = {200, 100, 0, 7};
+        uint16_t scans[4][ADC_CHANNELS];
+
+        acquisition_interpolate(from, to, 4, scans);
+        CHECK_EQ(scans[0][0], 100);
+        CHECK_EQ(scans[1][0], 125);
+        CHECK_EQ(scans[3][0], 175);
+        /* falling values */
+        CHECK_EQ(scans[1][1], 175);
+        CHECK_EQ(scans[3][1], 125);
+        CHECK_EQ(scans[2][2], 2048);
+        CHECK_EQ(scans[3][3], 7);
+
+        /* a single step is the first scan */
+        acquisition_interpolate(from, to, 1, scans);
+        for (size_t c = 0; c < ADC_CHANNELS; c++)
+                CHECK_EQ(scans[0][c], from[c]);
+}
+
+static void _test_pulse_value(void)
+{
+        /* 1kHz at 25% duty */
+        CHECK_EQ(acquisition_pulse_value(CHANNEL_MODE_FREQUENCY, 1000, 250), 10000);
+        CHECK_EQ(acquisition_pulse_value(CHANNEL_MODE_PERIOD, 1000, 250), 1000);
+        CHECK_EQ(acquisition_pulse_value(CHANNEL_MODE_DUTY, 1000, 250), 250);
+
+        /* rounded to the nearest unit */
+        CHECK_EQ(acquisition_pulse_value(CHANNEL_MODE_FREQUENCY, 333333, 1), 30);
+        CHECK_EQ(acquisition_pulse_value(CHANNEL_MODE_DUTY, 3, 2), 667);
+
+        /* slow signals saturate the period, fast ones the frequency */
+        CHECK_EQ(acquisition_pulse_value(CHANNEL_MODE_PERIOD, 100000, 50000), UINT16_MAX);
+        CHECK_EQ(acquisition_pulse_value(CHANNEL_MODE_FREQUENCY, 100, 50), UINT16_MAX);
+        CHECK_EQ(acquisition_pulse_value(CHANNEL_MODE_FREQUENCY, 153, 50), 65359);
+
+        /* no pulses */
+        CHECK_EQ(acquisition_pulse_value(CHANNEL_MODE_FREQUENCY, 0, 0), 0);
+        CHECK_EQ(acquisition_pulse_value(CHANNEL_MODE_PERIOD, 0, 0), UINT16_MAX);
+        CHECK_EQ(acquisition_pulse_value(CHANNEL_MODE_DUTY, 0, 0), 0);
+        CHECK_EQ(acquisition_pulse_value(CHANNEL_MODE_ANALOG, 1000, 250), 0);
+}
+
+static void _test_scale(void)
+{
+        CHECK_EQ(scale_0_to_5_volts(0), 0);
+        CHECK_EQ(scale_0_to_5_volts(4095), 5075);
+        CHECK_EQ(scale_0_to_5_volts(2048), 2538);
+
+        /* monotonic over the full 12 bit range */
+        uint16_t last = 0;
+        for (uint16_t raw = 1; raw < 4096; raw++) {
+                uint16_t mv = scale_0_to_5_volts(raw);
+                CHECK(mv >= last);
+                last = mv;
+        }
+
+        const uint16_t samples[ADC_CHANNELS] = {0, 1000, 2048, 4095};
+        uint16_t scaled[ADC_CHANNELS];
+        acquisition_scale_scan(samples, scaled);
+        for (size_t c = 0; c < ADC_CHANNELS; c++)
+                CHECK_EQ(scaled[c], scale_0_to_5_volts(samples[c]));
+}
+
+static void _test_oversample(void)
+{
+        uint16_t buffer[16 * ADC_CHANNELS];
+        uint16_t scans[16][ADC_CHANNELS];
+        for (size_t i = 0; i < 16; i++) {
+                for (size_t c = 0; c < ADC_CHANNELS; c++)
+                        buffer[i * ADC_CHANNELS + c] = 100 * (c + 1) + i;
+        }
+
+        /* shift 0 passes scans through, remapped */
+        CHECK_EQ(acquisition_oversample(buffer, 16, 0, scans), 16);
+        CHECK_EQ(scans[5][0], 405);
+        CHECK_EQ(scans[5][3], 105);
+
+        /* shift 2 sums groups of four */
+        CHECK_EQ(acquisition_oversample(buffer, 16, 2, scans), 4);
+        CHECK_EQ(scans[0][0], 4 * 400 + 0 + 1 + 2 + 3);
+        CHECK_EQ(scans[3][3], 4 * 100 + 12 + 13 + 14 + 15);
+
+        /* beyond 16 bits the sum is shifted down */
+        for (size_t i = 0; i < 16 * ADC_CHANNELS; i++)
+                buffer[i] = 4095;
+        CHECK_EQ(acquisition_oversample(buffer, 16, 4, scans), 1);
+        CHECK_EQ(scans[0][0], 16 * 4095);
+
+        /* a partial group at the end is not emitted */
+        CHECK_EQ(acquisition_oversample(buffer, 15, 2, scans), 3);
+        CHECK_EQ(acquisition_oversample(buffer, 0, 0, scans), 0);
+}
+
+static void _test_noise(void)
+{
+        uint16_t buffer[64 * ADC_CHANNELS];
+        struct NoiseStats stats[ADC_CHANNELS];
+        for (size_t i = 0; i < 64; i++) {
+                /* conversion order, analog 4 first */
+                buffer[i * ADC_CHANNELS + 3] = 1000;
+                buffer[i * ADC_CHANNELS + 2] = i & 1 ? 2002 : 2000;
+                buffer[i * ADC_CHANNELS + 1] = i;
+                buffer[i * ADC_CHANNELS + 0] = i & 1 ? 4095 : 0;
+        }
+        acquisition_noise(buffer, 64, stats);
+
+        /* a steady input has the converter's full resolution */
+        CHECK_EQ(stats[0].mean_q4, 1000 * 16);
+        CHECK_EQ(stats[0].stddev_q4, 0);
+        CHECK_EQ(stats[0].peak_to_peak, 0);
+        CHECK_EQ(stats[0].enob_q8, 12 << 8);
+
+        /* 1 LSB rms: 12 - log2(sqrt(12)) = 10.21 bits */
+        CHECK_EQ(stats[1].mean_q4, 2001 * 16);
+        CHECK_EQ(stats[1].stddev_q4, 16);
+        CHECK_EQ(stats[1].peak_to_peak, 2);
+        CHECK(stats[1].enob_q8 >= 2612 && stats[1].enob_q8 <= 2618);
+
+        /* a ramp over 64 codes is uniform noise of 6 bits */
+        CHECK_EQ(stats[2].mean_q4, 504);
+        CHECK_EQ(stats[2].stddev_q4, 295);
+        CHECK_EQ(stats[2].peak_to_peak, 63);
+        CHECK(stats[2].enob_q8 >= (6 << 8) - 3 && stats[2].enob_q8 <= (6 << 8) + 3);
+
+        /* noise beyond full scale saturates at no bits */
+        CHECK_EQ(stats[3].peak_to_peak, 4095);
+        CHECK_EQ(stats[3].enob_q8, 0);
+
+        acquisition_noise(buffer, 0, stats);
+        CHECK_EQ(stats[0].enob_q8, 0);
+}
+
+static void _test_supply(void)
+{
+        /* VREFINT reads its calibration value at 3.3V, proportionally more below */
+        uint32_t nominal = acquisition_supply_ratio(1500, 1500);
+        CHECK_EQ(nominal, 65536);
+        CHECK_EQ(acquisition_supply_mv(nominal), 3300);
+        uint32_t low = acquisition_supply_ratio(1650, 1500);
+        CHECK_EQ(acquisition_supply_mv(low), 3000);
+        CHECK_EQ(acquisition_supply_ratio(0, 1500), 0);
+
+        /* 1.5V read at 3.0V supply is 2048 codes, 1862 at 3.3V */
+        uint16_t samples[ADC_CHANNELS] = {2048, 0, 4095, 1000};
+        uint16_t corrected[ADC_CHANNELS];
+        acquisition_correct_scan(samples, low, corrected);
+        CHECK_EQ(corrected[0], 1862);
+        CHECK_EQ(corrected[1], 0);
+        CHECK_EQ(corrected[2], 3723);
+        acquisition_correct_scan(samples, nominal, corrected);
+        CHECK_EQ(corrected[3], 1000);
+        acquisition_correct_scan(samples, 65536 * 20, corrected);
+        CHECK_EQ(corrected[2], UINT16_MAX);
+
+        CHECK_EQ(acquisition_correct_total(1000000000000LL, nominal), 1000000000000LL);
+        CHECK_EQ(acquisition_correct_total(-1000000000000LL, nominal / 2), -500000000000LL);
+        CHECK_EQ(acquisition_correct_total(1LL << 60, 2 * nominal), 1LL << 61);
+
+        /* the calibration points themselves, and between them */
+        CHECK_EQ(acquisition_die_temperature(1723, nominal, 1723, 1296), 300);
+        CHECK_EQ(acquisition_die_temperature(1296, nominal, 1723, 1296), 1100);
+        CHECK_EQ(acquisition_die_temperature(1750, nominal, 1723, 1296), 250);
+        /* the same sensor voltage read at 3.0V */
+        CHECK_EQ(acquisition_die_temperature(1925, low, 1723, 1296), 250);
+        /* no second point: typical slope */
+        CHECK_EQ(acquisition_die_temperature(1723 - 53, nominal, 1723, 0xFFFF), 399);
+}
+
+static void _test_virtual(void)
+{
+        const uint16_t values[ADC_CHANNELS] = {2500, 1000, 0, 65535};
+        struct VirtualChannel channel = {VIRTUAL_OP_DIFFERENCE, 0, 1, VIRTUAL_OUTPUT_FRAME, 256, 0};
+
+        CHECK_EQ(acquisition_virtual_value(&channel, values), 1500);
+        channel.b = 0;
+        channel.a = 1;
+        CHECK_EQ(acquisition_virtual_value(&channel, values), -1500);
+
+        channel = (struct VirtualChannel){VIRTUAL_OP_SUM, 0, 1, 1, 128, -50};
+        CHECK_EQ(acquisition_virtual_value(&channel, values), 1700);
+
+        channel = (struct VirtualChannel){VIRTUAL_OP_RATIO, 1, 0, 2, 256, 0};
+        CHECK_EQ(acquisition_virtual_value(&channel, values), 400);
+        channel.b = 2;
+        CHECK_EQ(acquisition_virtual_value(&channel, values), INT16_MAX);
+
+        /* saturation both ways */
+        channel = (struct VirtualChannel){VIRTUAL_OP_SCALE, 3, 0, 0, 256, 0};
+        CHECK_EQ(acquisition_virtual_value(&channel, values), INT16_MAX);
+        channel.gain_q8 = -512;
+        CHECK_EQ(acquisition_virtual_value(&channel, values), INT16_MIN);
+        channel = (struct VirtualChannel){VIRTUAL_OP_RATIO, 3, 1, 0, -256, 0};
+        CHECK_EQ(acquisition_virtual_value(&channel, values), INT16_MIN);
+
+        channel.op = VIRTUAL_OP_OFF;
+        CHECK_EQ(acquisition_virtual_value(&channel, values), 0);
+}
+
+static void _test_integrate(void)
+{
+        const uint32_t tick_hz = 10000;
+        struct TotalizerChannel channels[ADC_CHANNELS] = {
+                {1, 0, 65536},          /* 1 unit/s per LSB */
+                {1, 2000, -65536 / 4},  /* around a zero point, negative */
+                {0, 0, 65536},
+                {1, 100, 1},            /* tiny gain */
+        };
+        int64_t totals[ADC_CHANNELS] = {0};
+        uint16_t buffer[16 * ADC_CHANNELS];
+        for (size_t i = 0; i < 16; i++) {
+                /* conversion order, analog 4 first */
+                buffer[i * ADC_CHANNELS + 3] = 1000 + (i & 1);
+                buffer[i * ADC_CHANNELS + 2] = 3000;
+                buffer[i * ADC_CHANNELS + 1] = 4095;
+                buffer[i * ADC_CHANNELS + 0] = 101;
+        }
+
+        /* one hour of 1ms blocks */
+        for (uint32_t b = 0; b < 3600 * 1000; b++)
+                acquisition_integrate(buffer, 16, 10, channels, totals);
+
+        int32_t whole;
+        uint16_t fraction;
+        acquisition_total_split(totals[0], tick_hz, &whole, &fraction);
+        CHECK_EQ(whole, 1000 * 3600 + 1800);
+        CHECK_EQ(fraction, 0);
+        acquisition_total_split(totals[1], tick_hz, &whole, &fraction);
+        CHECK_EQ(whole, -250 * 3600);
+        CHECK_EQ(totals[2], 0);
+        acquisition_total_split(totals[3], tick_hz, &whole, &fraction);
+        CHECK_EQ(whole, 0);
+        CHECK_EQ(fraction, 3600);
+
+        /* negative totals round down */
+        acquisition_total_split(-1, tick_hz, &whole, &fraction);
+        CHECK_EQ(whole, -1);
+        CHECK_EQ(fraction, 0xFFFF);
+
+        CHECK_EQ(acquisition_total_preset(-42, tick_hz), -42LL * 65536 * tick_hz);
+        acquisition_total_split(acquisition_total_preset(123456, tick_hz), tick_hz, &whole, &fraction);
+        CHECK_EQ(whole, 123456);
+        CHECK_EQ(fraction, 0);
+}
+
+static void _test_pack_scan(void)
+{
+        const uint16_t samples[ADC_CHANNELS] = {0x123, 0xABC, 0xFFF, 0x1000};
+        uint8_t data[8];
+        acquisition_pack_scan(samples, 0xBEEF, data);
+        CHECK_EQ(data[0], 0xEF);
+        CHECK_EQ(data[1], 0xBE);
+        CHECK_EQ(data[2], 0x23);
+        CHECK_EQ(data[3], 0xC1);
+        CHECK_EQ(data[4], 0xAB);
+        CHECK_EQ(data[5], 0xFF);
+        /* out of range samples are masked to 12 bits */
+        CHECK_EQ(data[6], 0x0F);
+        CHECK_EQ(data[7], 0x00);
+
+        /* as tools/can_stream_decode.py unpacks it */
+        uint64_t bits = 0;
+        for (size_t i = 2; i < 8; i++)
+                bits |= (uint64_t)data[i] << (8 * (i - 2));
+        for (size_t c = 0; c < ADC_CHANNELS; c++)
+                CHECK_EQ((bits >> (12 * c)) & 0xFFF, samples[c] & 0xFFF);
+}
+
+void test_acquisition(void)
+{
+        _test_remap();
+        _test_normalize();
+        _test_max_scan_rate();
+        _test_interpolate();
+        _test_pulse_value();
+        _test_scale();
+        _test_oversample();
+        _test_noise();
+        _test_supply();
+        _test_virtual();
+        _test_integrate();
+        _test_pack_scan();
+}
@@ -0,0 +1,50 @@
+/*
+ * AnalogX firmware
+ *
+ * Copyright (C) 2017 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "unit_test.h"
+#include "api_protocol.h"
+
+static void _test_base_id(void)
+{
+        CHECK_EQ(api_protocol_base_id(0), ANALOGX_CAN_BASE_ID);
+        CHECK_EQ(api_protocol_base_id(1), ANALOGX_CAN_BASE_ID + 0x100);
+        CHECK_EQ(api_protocol_base_id(3), ANALOGX_CAN_BASE_ID + 0x300);
+        CHECK_EQ(api_protocol_base_id(7), api_protocol_base_id(3));
+}
+
+static void _test_offset(void)
+{
+        uint32_t base = api_protocol_base_id(1);
+        CHECK_EQ(api_protocol_offset(base, base), API_ANNOUNCEMENT);
+        CHECK_EQ(api_protocol_offset(base + API_SET_CONFIG_GROUP_1, base), API_SET_CONFIG_GROUP_1);
+        CHECK_EQ(api_protocol_offset(base + ANALOGX_CAN_API_RANGE - 1, base), ANALOGX_CAN_API_RANGE - 1);
+
+        /* neighbouring units and unrelated traffic */
+        CHECK_EQ(api_protocol_offset(base + ANALOGX_CAN_API_RANGE, base), API_OFFSET_NONE);
+        CHECK_EQ(api_protocol_offset(base - 1, base), API_OFFSET_NONE);
+        CHECK_EQ(api_protocol_offset(0x123, base), API_OFFSET_NONE);
+        CHECK_EQ(api_protocol_offset(0x1FFFFFFF, base), API_OFFSET_NONE);
+}
+
+void test_api_protocol(void)
+{
+        _test_base_id();
+        _test_offset();
+}
@@ -0,0 +1,181 @@
+/*
+ * AnalogX firmware
+ *
+ * Copyright (C) 2017 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "unit_test.h"
+#include "fft_q15.h"
+#include <math.h>
+#include <stdlib.h>
+
+static void _sine_block(int16_t *re, int16_t *im, uint8_t log2n, double cycles, int16_t amplitude)
+{
+        uint16_t n = 1 << log2n;
+        for (uint16_t i = 0; i < n; i++) {
+                re[i] = lround(amplitude * sin(2 * M_PI * cycles * i / n));
+                im[i] = 0;
+        }
+}
+
+static uint16_t _peak_bin(const int16_t *re, const int16_t *im, uint8_t log2n)
+{
+        uint16_t peak = 0;
+        uint64_t peak_power = 0;
+        for (uint16_t k = 0; k < (1 << log2n) / 2; k++) {
+                uint64_t power = fft_q15_energy(re, im, k, k + 1);
+                if (power > peak_power) {
+                        peak_power = power;
+                        peak = k;
+                }
+        }
+        return peak;
+}
+
+static void _test_tone(void)
+{
+        int16_t re[FFT_MAX_POINTS];
+        int16_t im[FFT_MAX_POINTS];
+
+        /* a sine of amplitude A lands as A / 2 in its bin and its mirror */
+        for (uint8_t log2n = FFT_MIN_LOG2; log2n <= FFT_MAX_LOG2; log2n++) {
+                uint16_t n = 1 << log2n;
+                _sine_block(re, im, log2n, n / 8, 16000);
+                fft_q15(re, im, log2n);
+                CHECK_EQ(_peak_bin(re, im, log2n), n / 8);
+                uint32_t magnitude = sqrt(fft_q15_energy(re, im, n / 8, n / 8 + 1));
+                CHECK(abs((int)magnitude - 8000) < 80);
+                CHECK(fft_q15_energy(re, im, n - n / 8, n - n / 8 + 1) > 7900 * 7900);
+                CHECK(fft_q15_energy(re, im, 0, n / 8) < 100);
+        }
+}
+
+static void _test_dc(void)
+{
+        int16_t re[FFT_MAX_POINTS];
+        int16_t im[FFT_MAX_POINTS] = {0};
+
+        for (uint16_t i = 0; i < FFT_MAX_POINTS; i++)
+                re[i] = -12000;
+        fft_q15(re, im, FFT_MAX_LOG2);
+        CHECK_EQ(re[0], -12000);
+        CHECK_EQ(im[0], 0);
+        CHECK(fft_q15_energy(re, im, 1, FFT_MAX_POINTS) < 100);
+}
+
+static void _test_full_scale(void)
+{
+        int16_t re[FFT_MAX_POINTS];
+        int16_t im[FFT_MAX_POINTS] = {0};
+
+        /* alternating full scale input: everything in the Nyquist bin, no overflow */
+        for (uint16_t i = 0; i < FFT_MAX_POINTS; i++)
+                re[i] = i & 1 ? -16384 : 16384;
+        fft_q15(re, im, FFT_MAX_LOG2);
+        CHECK(abs(re[FFT_MAX_POINTS / 2] - 16384) <= 8);
+        CHECK(fft_q15_energy(re, im, 0, FFT_MAX_POINTS / 2) < 100);
+}
+
+static void _test_window(void)
+{
+        int16_t re[FFT_MAX_POINTS];
+        int16_t im[FFT_MAX_POINTS];
+        uint8_t log2n = FFT_MAX_LOG2;
+
+        /* rectangular leaves the samples alone */
+        _sine_block(re, im, log2n, 20.5, 10000);
+        int16_t first = re[1];
+        fft_q15_window(re, log2n, FFT_WINDOW_RECTANGULAR);
+        CHECK_EQ(re[1], first);
+
+        /* Hann tapers to zero at the edges and keeps the middle */
+        for (uint16_t i = 0; i < FFT_MAX_POINTS; i++)
+                re[i] = 10000;
+        fft_q15_window(re, log2n, FFT_WINDOW_HANN);
+        CHECK_EQ(re[0], 0);
+        CHECK(re[FFT_MAX_POINTS / 2] >= 9999);
+
+        /* a tone between bins leaks much less far with Hann */
+        _sine_block(re, im, log2n, 20.5, 10000);
+        fft_q15(re, im, log2n);
+        uint64_t rect_leak = fft_q15_energy(re, im, 40, 128);
+        _sine_block(re, im, log2n, 20.5, 10000);
+        fft_q15_window(re, log2n, FFT_WINDOW_HANN);
+        fft_q15(re, im, log2n);
+        uint64_t hann_leak = fft_q15_energy(re, im, 40, 128);
+        CHECK(hann_leak * 100 < rect_leak);
+        uint16_t peak = _peak_bin(re, im, log2n);
+        CHECK(peak == 20 || peak == 21);
+}
+
+/* The real transform against the complex one of the same samples */
+static void _test_real(void)
+{
+        int16_t re[FFT_MAX_POINTS];
+        int16_t im[FFT_MAX_POINTS];
+        int16_t x[FFT_MAX_POINTS];
+
+        for (uint8_t log2n = FFT_MIN_LOG2; log2n <= FFT_MAX_LOG2; log2n++) {
+                uint16_t n = 1 << log2n;
+                uint16_t half = n / 2;
+                uint32_t seed = log2n;
+                for (uint16_t i = 0; i < n; i++) {
+                        seed = seed * 1103515245 + 12345;
+                        re[i] = lround(9000 * sin(2 * M_PI * 3.3 * i / n)) + (int16_t)(seed >> 16) % 4000 + 1000;
+                        im[i] = 0;
+                        x[i] = re[i];
+                }
+                fft_q15(re, im, log2n);
+                fft_q15_real(x, log2n);
+
+                CHECK(abs(x[0] - re[0]) <= 2);
+                CHECK(abs(x[half] - re[half]) <= 2);
+                for (uint16_t k = 1; k < half; k++) {
+                        CHECK(abs(x[k] - re[k]) <= 3);
+                        CHECK(abs(x[half + k] - im[k]) <= 3);
+                }
+                for (uint16_t k = 0; k <= half; k++) {
+                        double reference = fft_q15_energy(re, im, k, k + 1);
+                        double energy = fft_q15_real_energy(x, log2n, k, k + 1);
+                        CHECK(fabs(sqrt(energy) - sqrt(reference)) <= 4);
+                }
+        }
+
+        /* alternating full scale: all of it in the Nyquist bin, in im[0] */
+        for (uint16_t i = 0; i < FFT_MAX_POINTS; i++)
+                x[i] = i & 1 ? -16384 : 16384;
+        fft_q15_real(x, FFT_MAX_LOG2);
+        CHECK(abs(x[FFT_MAX_POINTS / 2] - 16384) <= 8);
+        CHECK(fft_q15_real_energy(x, FFT_MAX_LOG2, 0, FFT_MAX_POINTS / 2) < 100);
+
+        /* a tone lands in one bin, as with the complex transform */
+        _sine_block(x, im, FFT_MAX_LOG2, 40, 16000);
+        fft_q15_real(x, FFT_MAX_LOG2);
+        uint32_t magnitude = sqrt(fft_q15_real_energy(x, FFT_MAX_LOG2, 40, 41));
+        CHECK(abs((int)magnitude - 8000) < 80);
+        CHECK(fft_q15_real_energy(x, FFT_MAX_LOG2, 0, 40) < 100);
+        CHECK(fft_q15_real_energy(x, FFT_MAX_LOG2, 41, FFT_MAX_POINTS / 2 + 1) < 100);
+}
+
+void test_fft(void)
+{
+        _test_tone();
+        _test_dc();
+        _test_full_scale();
+        _test_window();
+        _test_real();
+}
@@ -0,0 +1,146 @@
+/*
+ * AnalogX firmware
+ *
+ * Copyright (C) 2017 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "unit_test.h"
+#include "cobs.h"
+#include "crc32.h"
+#include <string.h>
+
+/* Reference decoder, as in tools/log_decode.py */
+static size_t _cobs_decode(const uint8_t *src, size_t len, uint8_t *dst)
+{
+        size_t out = 0;
+        size_t i = 0;
+        while (i < len) {
+                uint8_t code = src[i++];
+                for (uint8_t j = 1; j < code && i < len; j++)
+                        dst[out++] = src[i++];
+                if (code != 0xFF && i < len)
+                        dst[out++] = 0;
+        }
+        return out;
+}
+
+static void _test_crc32(void)
+{
+        CHECK_EQ(crc32("123456789", 9), 0xCBF43926);
+        CHECK_EQ(crc32("", 0), 0);
+}
+
+static uint32_t _reflect(uint32_t value, int bits)
+{
+        uint32_t reflected = 0;
+        for (int i = 0; i < bits; i++)
+                reflected |= ((value >> i) & 1) << (bits - 1 - i);
+        return reflected;
+}
+
+/* The STM32 CRC unit: CRC-32 polynomial, MSB first, input reversed per write */
+static uint32_t _crc_unit_write(uint32_t crc, uint32_t data, int bits)
+{
+        crc ^= _reflect(data, bits) << (32 - bits);
+        for (int i = 0; i < bits; i++)
+                crc = crc & 0x80000000 ? (crc << 1) ^ 0x04C11DB7 : crc << 1;
+        return crc;
+}
+
+/* Driven as integrity.c does: bytes to word alignment, words, bytes */
+static uint32_t _crc_unit(const uint8_t *data, size_t len)
+{
+        uint32_t crc = 0xFFFFFFFF;
+        size_t head = -(uintptr_t)data & 3;
+        if (head > len)
+                head = len;
+        size_t i = 0;
+        for (; i < head; i++)
+                crc = _crc_unit_write(crc, data[i], 8);
+        for (; i + 4 <= len; i += 4) {
+                uint32_t word;
+                memcpy(&word, data + i, sizeof(word));
+                crc = _crc_unit_write(crc, word, 32);
+        }
+        for (; i < len; i++)
+                crc = _crc_unit_write(crc, data[i], 8);
+        return ~_reflect(crc, 32);
+}
+
+static void _test_crc_unit(void)
+{
+        static uint32_t words[70];
+        uint8_t *data = (uint8_t *)words;
+        for (size_t i = 0; i < sizeof(words); i++)
+                data[i] = i * 37 + 11;
+
+        for (size_t offset = 0; offset < 4; offset++) {
+                for (size_t len = 0; len < 270; len += 13)
+                        CHECK_EQ(_crc_unit(data + offset, len), crc32(data + offset, len));
+        }
+}
+
+static void _round_trip(const uint8_t *data, size_t len)
+{
+        uint8_t encoded[COBS_ENCODED_MAX(600)];
+        uint8_t in_place[COBS_ENCODED_MAX(600)];
+        uint8_t decoded[600];
+        size_t n = cobs_encode(data, len, encoded);
+        CHECK(n <= COBS_ENCODED_MAX(len));
+        CHECK(memchr(encoded, 0, n) == NULL);
+        CHECK_EQ(_cobs_decode(encoded, n, decoded), len);
+        CHECK(memcmp(decoded, data, len) == 0);
+
+        /* as the telemetry stream does, from the end of the worst case */
+        uint8_t *src = in_place + COBS_ENCODED_MAX(len) - len;
+        memcpy(src, data, len);
+        CHECK_EQ(cobs_encode(src, len, in_place), n);
+        CHECK(memcmp(in_place, encoded, n) == 0);
+}
+
+static void _test_cobs(void)
+{
+        uint8_t data[600];
+        const uint8_t zeros[3] = {0, 0, 0};
+        uint8_t encoded[8];
+
+        CHECK_EQ(cobs_encode(zeros, 3, encoded), 4);
+        CHECK_EQ(encoded[0], 1);
+        CHECK_EQ(encoded[3], 1);
+
+        /* a run of 254 non zero bytes needs an extra code byte */
+        memset(data, 0x11, sizeof(data));
+        _round_trip(data, 254);
+        _round_trip(data, 255);
+        _round_trip(data, sizeof(data));
+
+        uint32_t seed = 1;
+        for (size_t len = 0; len < 300; len += 7) {
+                for (size_t i = 0; i < len; i++) {
+                        seed = seed * 1103515245 + 12345;
+                        data[i] = (seed >> 16) % 4 ? seed >> 8 : 0;
+                }
+                _round_trip(data, len);
+        }
+}
+
+void test_framing(void)
+{
+        _test_crc32();
+        _test_crc_unit();
+        _test_cobs();
+}
@@ -0,0 +1,35 @@
+/*
+ * AnalogX firmware
+ *
+ * Copyright (C) 2017 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "unit_test.h"
+
+unsigned g_test_checks;
+unsigned g_test_failures;
+
+int main(void)
+{
+        test_acquisition();
+        test_api_protocol();
+        test_framing();
+        test_fft();
+
+        printf("%u checks, %u failures\n", g_test_checks, g_test_failures);
+        return g_test_failures ? 1 : 0;
+}
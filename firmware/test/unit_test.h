@@ -0,0 +1,58 @@
+/*
+ * AnalogX firmware
+ *
+ * Copyright (C) 2017 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef UNIT_TEST_H_
+#define UNIT_TEST_H_
+#include <stdio.h>
+#include <stdint.h>
+
+/*
+ * Minimal host test harness: a failed check reports its location and
+ * marks the running test as failed, then the test carries on.
+ */
+extern unsigned g_test_checks;
+extern unsigned g_test_failures;
+
+#define CHECK(cond) do { \
+        g_test_checks++; \
+        if (!(cond)) { \
+                g_test_failures++; \
+                printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+        } \
+} while (0)
+
+#define CHECK_EQ(actual, expected) do { \
+        long long _a = (long long)(actual); \
+        long long _e = (long long)(expected); \
+        g_test_checks++; \
+        if (_a != _e) { \
+                g_test_failures++; \
+                printf("%s:%d: %s == %lld, expected %lld\n", __FILE__, __LINE__, #actual, _a, _e); \
+        } \
+} while (0)
+
+/* Test suites, one per module under test */
+void test_acquisition(void);
+void test_api_protocol(void);
+void test_framing(void);
+void test_fft(void);
+
+#endif /* UNIT_TEST_H_ */
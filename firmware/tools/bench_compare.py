@@ -0,0 +1,74 @@
+#!/usr/bin/env python3
+#
+# AnalogX firmware
+#
+# Copyright (C) 2017 Autosport Labs
+#
+# This file is part of the Race Capture firmware suite
+#
+# This is free software: you can redistribute it and/or modify it
+# under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This software is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+#
+# See the GNU General Public License for more details. You should
+# have received a copy of the GNU General Public License along with
+# this code. If not, see <http://www.gnu.org/licenses/>.
+#
+# Compare two benchmark captures from the bench image (make bench).
+#
+# Usage: bench_compare.py baseline.txt candidate.txt
+#
+# Captures are raw SD2 output; the last complete BENCH,begin..BENCH,end
+# run in each is used. Prints cycles per iteration side by side.
+
+import sys
+
+
+def last_run(path):
+    results = None
+    run = None
+    with open(path, errors='replace') as f:
+        for line in f:
+            fields = line.strip().split(',')
+            if fields[0] != 'BENCH' or len(fields) < 2:
+                continue
+            if fields[1] == 'begin':
+                run = {}
+            elif fields[1] == 'end':
+                if run is not None:
+                    results = run
+                run = None
+            elif run is not None and len(fields) == 5:
+                run[fields[1]] = int(fields[4])
+    if results is None:
+        raise ValueError('%s: no complete benchmark run' % path)
+    return results
+
+
+def main(argv):
+    if len(argv) != 3:
+        sys.stderr.write('usage: %s <baseline> <candidate>\n' % argv[0])
+        return 1
+    baseline = last_run(argv[1])
+    candidate = last_run(argv[2])
+
+    print('%-20s %10s %10s %8s' % ('benchmark', 'baseline', 'candidate', 'change'))
+    for name in list(baseline) + [n for n in candidate if n not in baseline]:
+        old = baseline.get(name)
+        new = candidate.get(name)
+        if old is None or new is None:
+            print('%-20s %10s %10s' % (name, old if old is not None else '-',
+                                       new if new is not None else '-'))
+            continue
+        change = '%+.1f%%' % ((new - old) * 100.0 / old) if old else '-'
+        print('%-20s %10d %10d %8s' % (name, old, new, change))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
@@ -0,0 +1,88 @@
+#!/usr/bin/env python3
+#
+# AnalogX firmware
+#
+# Copyright (C) 2017 Autosport Labs
+#
+# This file is part of the Race Capture firmware suite
+#
+# This is free software: you can redistribute it and/or modify it
+# under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This software is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+#
+# See the GNU General Public License for more details. You should
+# have received a copy of the GNU General Public License along with
+# this code. If not, see <http://www.gnu.org/licenses/>.
+#
+# Decode the CAN stream (API_SET_CAN_STREAM) from a candump log.
+#
+# Usage: can_stream_decode.py [candump.log] [--base 0xE4600]
+#
+# Each stream frame is one scan: sequence (u16), then four 12 bit samples
+# as a little endian bit stream. Scans are printed as CSV, prefixed by
+# their time and sequence number; gaps in the sequence (scans dropped on
+# the device or frames lost on the bus) and the device's statistics
+# frames are reported on stderr.
+
+import argparse
+import re
+import struct
+import sys
+
+API_CAN_STREAM_DATA = 25
+API_CAN_STREAM_STATS = 26
+CHANNELS = 4
+
+CANDUMP = re.compile(r'\(([\d.]+)\)\s+\S+\s+([0-9A-Fa-f]+)#([0-9A-Fa-f]*)')
+
+
+def unpack_scan(data):
+    sequence = struct.unpack_from('<H', data)[0]
+    bits = int.from_bytes(data[2:8], 'little')
+    return sequence, [(bits >> (12 * c)) & 0xFFF for c in range(CHANNELS)]
+
+
+def main(argv):
+    parser = argparse.ArgumentParser(description='Decode the AnalogX CAN stream')
+    parser.add_argument('log', nargs='?', help='candump -L style log, stdin by default')
+    parser.add_argument('--base', type=lambda v: int(v, 0), default=0xE4600,
+                        help='CAN base ID of the device')
+    args = parser.parse_args(argv[1:])
+
+    source = open(args.log) if args.log else sys.stdin
+    next_sequence = None
+    scans = 0
+    missing = 0
+    for line in source:
+        match = CANDUMP.search(line)
+        if not match:
+            continue
+        timestamp = float(match.group(1))
+        can_id = int(match.group(2), 16)
+        data = bytes.fromhex(match.group(3))
+
+        if can_id == args.base + API_CAN_STREAM_DATA and len(data) == 8:
+            sequence, samples = unpack_scan(data)
+            if next_sequence is not None and sequence != next_sequence:
+                gap = (sequence - next_sequence) & 0xFFFF
+                missing += gap
+                sys.stderr.write('%.6f: %d scans missing before %d\n' % (timestamp, gap, sequence))
+            next_sequence = (sequence + 1) & 0xFFFF
+            scans += 1
+            sys.stdout.write('%.6f,%d,%s\n' % (timestamp, sequence, ','.join(str(s) for s in samples)))
+        elif can_id == args.base + API_CAN_STREAM_STATS and len(data) == 8:
+            rate, dropped, lost, peak = struct.unpack('<4H', data)
+            sys.stderr.write('%.6f: %d frames/s, %d dropped, %d lost, queue peak %d\n' %
+                             (timestamp, rate, dropped, lost, peak))
+
+    sys.stderr.write('%d scans, %d missing\n' % (scans, missing))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
@@ -0,0 +1,191 @@
+#!/usr/bin/env python3
+#
+# AnalogX firmware
+#
+# Copyright (C) 2017 Autosport Labs
+#
+# This file is part of the Race Capture firmware suite
+#
+# This is free software: you can redistribute it and/or modify it
+# under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This software is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+#
+# See the GNU General Public License for more details. You should
+# have received a copy of the GNU General Public License along with
+# this code. If not, see <http://www.gnu.org/licenses/>.
+#
+# Per module flash and RAM use from a GNU ld map file (make footprint).
+#
+# Usage: footprint.py build/main.map [--sort flash|ram] [--top N]
+#
+# Every input section is charged to its object file, or to its library
+# for archive members; initialized data counts in both flash and RAM.
+# Space in an output section not taken by any input (alignment fill,
+# the stacks reserved by the linker script) is listed under the section
+# name in brackets. The heap section is the RAM left over and is reported
+# as free; the exit status is 1 when a region is overrun. With LTO the
+# objects are merged before linking, so the map should come from a build
+# without it.
+
+import argparse
+import collections
+import os
+import re
+import sys
+
+HEAP_SECTION = '.heap'
+
+OUTPUT_SECTION = re.compile(r'^(\S+)\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)(?:\s+load address 0x([0-9a-fA-F]+))?\s*$')
+INPUT_SECTION = re.compile(r'^ (\S+)\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)\s+(\S.*?)\s*$')
+REGION = re.compile(r'^(\S+)\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)')
+ARCHIVE_MEMBER = re.compile(r'^(.*\.a)\(.*\)$')
+
+
+def module_name(path):
+    member = ARCHIVE_MEMBER.match(path)
+    if member:
+        return os.path.basename(member.group(1))
+    name = os.path.basename(path)
+    return name[:-2] if name.endswith('.o') else name
+
+
+def join_wrapped(lines):
+    """ld puts the address of a long section name on the next line"""
+    pending = None
+    for line in lines:
+        line = line.rstrip('\r\n')
+        if pending is not None:
+            if line.startswith(' ') and line.strip().startswith('0x'):
+                yield pending + ' ' + line.strip()
+                pending = None
+                continue
+            yield pending
+            pending = None
+        if line.strip() and len(line.split()) == 1 and not line.strip().startswith('0x'):
+            pending = line
+        else:
+            yield line
+    if pending is not None:
+        yield pending
+
+
+def parse(lines):
+    regions = collections.OrderedDict()
+    sections = []
+    state = None
+    for line in join_wrapped(lines):
+        if line.startswith('Memory Configuration'):
+            state = 'memory'
+            continue
+        if line.startswith('Linker script and memory map'):
+            state = 'map'
+            continue
+        if line.startswith('Cross Reference Table'):
+            break
+
+        if state == 'memory':
+            match = REGION.match(line)
+            if match and match.group(1) not in ('Name', '*default*'):
+                length = int(match.group(3), 16)
+                if length:
+                    regions[match.group(1)] = (int(match.group(2), 16), length)
+        elif state == 'map':
+            match = OUTPUT_SECTION.match(line)
+            if match:
+                load = match.group(4)
+                sections.append({'name': match.group(1),
+                                 'address': int(match.group(2), 16),
+                                 'size': int(match.group(3), 16),
+                                 'load': int(load, 16) if load else None,
+                                 'inputs': []})
+                continue
+            match = INPUT_SECTION.match(line)
+            if match and sections and not match.group(1).startswith('*'):
+                size = int(match.group(3), 16)
+                if size:
+                    sections[-1]['inputs'].append((module_name(match.group(4)), size))
+    return regions, sections
+
+
+def region_of(regions, address):
+    for name, (origin, length) in regions.items():
+        if origin <= address < origin + length:
+            return name
+    return None
+
+
+def region_kind(name):
+    if name.startswith('flash'):
+        return 'flash'
+    if name.startswith('ram'):
+        return 'ram'
+    return None
+
+
+def main(argv):
+    parser = argparse.ArgumentParser(description='Per module footprint from a linker map')
+    parser.add_argument('map', help='linker map file')
+    parser.add_argument('--sort', choices=('flash', 'ram'), default='ram',
+                        help='column to sort the modules by')
+    parser.add_argument('--top', type=int, default=0, help='only list the N largest modules')
+    args = parser.parse_args(argv[1:])
+
+    with open(args.map) as source:
+        regions, sections = parse(source)
+    if not regions:
+        sys.stderr.write('%s: no memory configuration found\n' % args.map)
+        return 1
+
+    usage = collections.defaultdict(lambda: {'flash': 0, 'ram': 0})
+    region_used = collections.Counter()
+    for section in sections:
+        region = region_of(regions, section['address'])
+        if region is None or section['size'] == 0:
+            continue
+        load_region = region_of(regions, section['load']) if section['load'] is not None else None
+        if section['name'] == HEAP_SECTION:
+            continue
+
+        region_used[region] += section['size']
+        if load_region and load_region != region:
+            region_used[load_region] += section['size']
+
+        charges = list(section['inputs'])
+        remainder = section['size'] - sum(size for _, size in charges)
+        if remainder > 0:
+            charges.append(('[%s]' % section['name'], remainder))
+        kinds = {region_kind(name) for name in (region, load_region) if name}
+        for module, size in charges:
+            for kind in kinds - {None}:
+                usage[module][kind] += size
+
+    other = 'flash' if args.sort == 'ram' else 'ram'
+    modules = sorted(usage.items(), key=lambda m: (-m[1][args.sort], -m[1][other], m[0]))
+    if args.top:
+        modules = modules[:args.top]
+
+    print('%-28s %8s %8s' % ('module', 'flash', 'ram'))
+    for module, use in modules:
+        print('%-28s %8d %8d' % (module, use['flash'], use['ram']))
+    print('%-28s %8d %8d' % ('total', sum(u['flash'] for u in usage.values()),
+                             sum(u['ram'] for u in usage.values())))
+    print()
+    overrun = []
+    for name, (origin, length) in regions.items():
+        used = region_used[name]
+        print('%-8s %6d of %6d bytes used, %6d free' % (name, used, length, length - used))
+        if used > length:
+            overrun.append(name)
+    if overrun:
+        sys.stderr.write('%s: %s overrun\n' % (args.map, ', '.join(overrun)))
+        return 1
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
@@ -0,0 +1,147 @@
+#!/usr/bin/env python3
+#
+# AnalogX firmware
+#
+# Copyright (C) 2017 Autosport Labs
+#
+# This file is part of the Race Capture firmware suite
+#
+# This is free software: you can redistribute it and/or modify it
+# under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This software is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+#
+# See the GNU General Public License for more details. You should
+# have received a copy of the GNU General Public License along with
+# this code. If not, see <http://www.gnu.org/licenses/>.
+#
+# Decode tokenized log output back into text.
+#
+# Usage: log_decode.py build/main.logdict.json [capture.bin | serial port]
+#
+# Reads raw bytes from the capture file, a serial port (115200 8N1, needs
+# pyserial) or stdin. Each log record is a COBS encoded packet ended by
+# a 0x00 byte: token (u16), timestamp in ms (u32), nargs | flags << 4
+# (u8) then nargs 32 bit arguments, all little endian.
+
+import bisect
+import json
+import os
+import re
+import struct
+import sys
+
+FLAG_TIMESTAMP = 0x01
+FORMAT_SPEC = re.compile(r'%([-+ 0#]*)(\d*)(?:\.(\d+))?[lL]?([diuxXscp%])')
+
+
+def cobs_decode(packet):
+    out = bytearray()
+    i = 0
+    while i < len(packet):
+        code = packet[i]
+        if code == 0 or i + code > len(packet) + 1:
+            raise ValueError('bad COBS packet')
+        out += packet[i + 1:i + code]
+        i += code
+        if code < 0xFF and i < len(packet):
+            out.append(0)
+    return bytes(out)
+
+
+class Decoder:
+    def __init__(self, dictionary):
+        self.tokens = {int(k): v for k, v in dictionary['tokens'].items()}
+        strings = sorted((int(k), v) for k, v in dictionary['strings'].items())
+        self.string_addrs = [addr for addr, _ in strings]
+        self.strings = [text for _, text in strings]
+
+    def resolve_string(self, addr):
+        i = bisect.bisect_right(self.string_addrs, addr) - 1
+        if i >= 0:
+            offset = addr - self.string_addrs[i]
+            if offset < len(self.strings[i]):
+                return self.strings[i][offset:]
+        return '<0x%08X>' % addr
+
+    def format(self, fmt, args):
+        args = list(args)
+
+        def convert(match):
+            flags, width, precision, conv = match.groups()
+            if conv == '%':
+                return '%'
+            value = args.pop(0) if args else 0
+            if conv == 's':
+                value = self.resolve_string(value)
+            elif conv == 'c':
+                value = chr(value & 0xFF)
+            elif conv in 'di':
+                value = value - (1 << 32) if value & 0x80000000 else value
+            elif conv == 'p':
+                return '0x%08X' % value
+            spec = '%' + flags + width
+            if precision is not None:
+                spec += '.' + precision
+            return (spec + ('d' if conv in 'iu' else conv)) % value
+
+        return FORMAT_SPEC.sub(convert, fmt)
+
+    def decode(self, packet):
+        data = cobs_decode(packet)
+        if len(data) < 7:
+            raise ValueError('short packet')
+        token, timestamp, header = struct.unpack_from('<HIB', data)
+        nargs = header & 0x0F
+        flags = header >> 4
+        args = struct.unpack_from('<%dI' % nargs, data, 7)
+        fmt = self.tokens.get(token)
+        if fmt is None:
+            return '<unknown token %d> %s\n' % (token, ' '.join('%08X' % a for a in args))
+        text = self.format(fmt, args).replace('\r\n', '\n')
+        if flags & FLAG_TIMESTAMP:
+            text = '%u %s' % (timestamp, text)
+        return text
+
+
+def open_input(source):
+    if source is None:
+        return sys.stdin.buffer
+    if os.path.isfile(source):
+        return open(source, 'rb')
+    import serial
+    return serial.Serial(source, 115200, timeout=None)
+
+
+def main(argv):
+    if len(argv) not in (2, 3):
+        sys.stderr.write('usage: %s <dictionary.json> [capture | port]\n' % argv[0])
+        return 1
+    with open(argv[1]) as f:
+        decoder = Decoder(json.load(f))
+
+    stream = open_input(argv[2] if len(argv) == 3 else None)
+    pending = b''
+    while True:
+        chunk = stream.read(1)
+        if not chunk:
+            break
+        if chunk != b'\0':
+            pending += chunk
+            continue
+        if pending:
+            try:
+                sys.stdout.write(decoder.decode(pending))
+            except (ValueError, struct.error) as e:
+                sys.stdout.write('<corrupt packet: %s>\n' % e)
+            sys.stdout.flush()
+        pending = b''
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
@@ -0,0 +1,111 @@
+#!/usr/bin/env python3
+#
+# AnalogX firmware
+#
+# Copyright (C) 2017 Autosport Labs
+#
+# This file is part of the Race Capture firmware suite
+#
+# This is free software: you can redistribute it and/or modify it
+# under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This software is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+#
+# See the GNU General Public License for more details. You should
+# have received a copy of the GNU General Public License along with
+# this code. If not, see <http://www.gnu.org/licenses/>.
+#
+# Build the host side dictionary for tokenized logging.
+#
+# Usage: log_dictionary.py build/main.elf build/main.logdict.json
+#
+# Format strings live in the non-loaded .logtokens section; a token is
+# the string's address in that section. Strings referenced by %s
+# arguments are read from the loaded read-only sections so the decoder
+# can resolve the pointers the device sends.
+
+import json
+import struct
+import sys
+
+SHT_PROGBITS = 1
+SHF_WRITE = 0x1
+SHF_ALLOC = 0x2
+TOKEN_SECTION = '.logtokens'
+
+
+def read_sections(elf):
+    if elf[:4] != b'\x7fELF' or elf[4] != 1 or elf[5] != 1:
+        raise ValueError('expected a little endian ELF32 file')
+    shoff, = struct.unpack_from('<I', elf, 0x20)
+    shentsize, shnum, shstrndx = struct.unpack_from('<HHH', elf, 0x2E)
+
+    headers = []
+    for i in range(shnum):
+        headers.append(struct.unpack_from('<IIIIIIIIII', elf, shoff + i * shentsize))
+
+    names = headers[shstrndx]
+    sections = []
+    for name, type_, flags, addr, offset, size, _, _, _, _ in headers:
+        end = elf.index(b'\0', names[4] + name)
+        sections.append({
+            'name': elf[names[4] + name:end].decode(),
+            'type': type_,
+            'flags': flags,
+            'addr': addr,
+            'data': elf[offset:offset + size] if type_ == SHT_PROGBITS else b'',
+        })
+    return sections
+
+
+def split_strings(addr, data, printable_only):
+    """Yield (address, text) for each NUL terminated string in data"""
+    start = 0
+    for i, byte in enumerate(data):
+        if byte != 0:
+            if printable_only and not (32 <= byte < 127 or byte in (9, 10, 13)):
+                start = i + 1
+            continue
+        if i > start:
+            yield addr + start, data[start:i].decode('latin-1')
+        start = i + 1
+
+
+def build_dictionary(elf):
+    tokens = {}
+    strings = {}
+    for section in read_sections(elf):
+        if section['name'] == TOKEN_SECTION:
+            for addr, text in split_strings(section['addr'], section['data'], False):
+                tokens[addr] = text
+        elif section['flags'] & SHF_ALLOC and not section['flags'] & SHF_WRITE:
+            for addr, text in split_strings(section['addr'], section['data'], True):
+                strings[addr] = text
+
+    if not tokens:
+        raise ValueError('no %s section; was the firmware built with USE_LOG_TOKENS=yes?'
+                         % TOKEN_SECTION)
+    return {
+        'tokens': {str(k): v for k, v in sorted(tokens.items())},
+        'strings': {str(k): v for k, v in sorted(strings.items())},
+    }
+
+
+def main(argv):
+    if len(argv) != 3:
+        sys.stderr.write('usage: %s <firmware.elf> <dictionary.json>\n' % argv[0])
+        return 1
+    with open(argv[1], 'rb') as f:
+        dictionary = build_dictionary(f.read())
+    with open(argv[2], 'w') as f:
+        json.dump(dictionary, f, indent=1)
+    print('%s: %d log formats' % (argv[2], len(dictionary['tokens'])))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
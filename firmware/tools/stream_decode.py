@@ -0,0 +1,128 @@
+#!/usr/bin/env python3
+#
+# AnalogX firmware
+#
+# Copyright (C) 2017 Autosport Labs
+#
+# This file is part of the Race Capture firmware suite
+#
+# This is free software: you can redistribute it and/or modify it
+# under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This software is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+#
+# See the GNU General Public License for more details. You should
+# have received a copy of the GNU General Public License along with
+# this code. If not, see <http://www.gnu.org/licenses/>.
+#
+# Decode the binary telemetry stream (make USE_UART_STREAM=yes).
+#
+# Usage: stream_decode.py [capture.bin | serial port]
+#
+# Frames are COBS encoded and end with a 0x00 byte: type (u8), sequence
+# (u16), payload, CRC32 (u32), little endian. Sample frames are printed
+# as CSV, one scan per line; angle frames (make USE_ANGLE_SYNC=yes) the
+# same, prefixed by tooth and step within the tooth, the tooth empty
+# before the index pulse. Log frames are passed through. Bad CRCs and
+# sequence gaps are reported on stderr.
+
+import os
+import struct
+import sys
+import zlib
+
+from log_decode import cobs_decode
+
+FRAME_SAMPLES = 1
+FRAME_LOG = 2
+FRAME_ANGLE = 3
+NOT_SYNCED = 0xFF
+BAUD = 2000000
+
+
+def open_input(source):
+    if source is None:
+        return sys.stdin.buffer
+    if os.path.isfile(source):
+        return open(source, 'rb')
+    import serial
+    return serial.Serial(source, BAUD, timeout=None)
+
+
+class StreamDecoder:
+    def __init__(self, out, err):
+        self.out = out
+        self.err = err
+        self.next_sequence = None
+        self.frames = 0
+        self.lost = 0
+        self.corrupt = 0
+
+    def frame(self, packet):
+        try:
+            data = cobs_decode(packet)
+        except ValueError:
+            data = b''
+        if len(data) < 7 or zlib.crc32(data[:-4]) != struct.unpack_from('<I', data, len(data) - 4)[0]:
+            self.corrupt += 1
+            self.err.write('corrupt frame\n')
+            return
+
+        frame_type, sequence = struct.unpack_from('<BH', data)
+        if self.next_sequence is not None and sequence != self.next_sequence:
+            gap = (sequence - self.next_sequence) & 0xFFFF
+            self.lost += gap
+            self.err.write('lost %d frames before %d\n' % (gap, sequence))
+        self.next_sequence = (sequence + 1) & 0xFFFF
+        self.frames += 1
+
+        payload = data[3:-4]
+        if frame_type == FRAME_SAMPLES:
+            shift, count, channels = struct.unpack_from('<BBB', payload)
+            values = struct.unpack_from('<%dH' % (count * channels), payload, 3)
+            for i in range(count):
+                scan = values[i * channels:(i + 1) * channels]
+                self.out.write('%d,%s\n' % (shift, ','.join(str(v) for v in scan)))
+        elif frame_type == FRAME_ANGLE:
+            first, teeth, steps, count, channels = struct.unpack_from('<BBBBB', payload)
+            values = struct.unpack_from('<%dH' % (count * channels), payload, 5)
+            for i in range(count):
+                scan = values[i * channels:(i + 1) * channels]
+                tooth = '' if first == NOT_SYNCED else (first + i // steps) % teeth
+                self.out.write('%s,%d,%s\n' % (tooth, i % steps, ','.join(str(v) for v in scan)))
+        elif frame_type == FRAME_LOG:
+            self.out.write(payload.decode('latin-1').replace('\r\n', '\n'))
+        else:
+            self.err.write('unknown frame type %d\n' % frame_type)
+
+
+def main(argv):
+    if len(argv) > 2:
+        sys.stderr.write('usage: %s [capture | port]\n' % argv[0])
+        return 1
+    stream = open_input(argv[1] if len(argv) == 2 else None)
+    decoder = StreamDecoder(sys.stdout, sys.stderr)
+    pending = b''
+    try:
+        while True:
+            chunk = stream.read(1)
+            if not chunk:
+                break
+            if chunk != b'\0':
+                pending += chunk
+            elif pending:
+                decoder.frame(pending)
+                pending = b''
+    except KeyboardInterrupt:
+        pass
+    sys.stderr.write('%d frames, %d lost, %d corrupt\n' %
+                     (decoder.frames, decoder.lost, decoder.corrupt))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
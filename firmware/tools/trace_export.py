@@ -0,0 +1,163 @@
+#!/usr/bin/env python3
+#
+# AnalogX firmware
+#
+# Copyright (C) 2017 Autosport Labs
+#
+# This file is part of the Race Capture firmware suite
+#
+# This is free software: you can redistribute it and/or modify it
+# under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This software is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+#
+# See the GNU General Public License for more details. You should
+# have received a copy of the GNU General Public License along with
+# this code. If not, see <http://www.gnu.org/licenses/>.
+#
+# Convert a trace dump (API_TRACE_CONTROL, make USE_TRACE=yes) into the
+# Chrome trace event format, for chrome://tracing or ui.perfetto.dev.
+#
+# Usage: trace_export.py [dump.log] [--base 0xE4600] [-o trace.json]
+#
+# The dump is read from a candump log (API_TRACE_DATA frames) or from the
+# serial log ("TRACE <word0> <word1>" lines), whichever the input holds.
+# Each thread becomes a track of slices between its context switches;
+# interrupt service and the application markers get a track each. When
+# the log holds several dumps, the last one is exported.
+
+import argparse
+import json
+import re
+import struct
+import sys
+
+API_TRACE_DATA = 30
+FORMAT_VERSION = 1
+
+EVENT_SWITCH = 1
+EVENT_ISR = 2
+EVENT_MARK = 3
+EVENT_HEADER = 0x80
+EVENT_LOST = 0x81
+EVENT_NAME = 0x82
+
+ISR_UNIT_CYCLES = 16
+ISR_TRACK = 1
+MARK_TRACK = 2
+
+MARKS = {1: 'adc_done', 2: 'sensor_tx', 3: 'can_rx', 4: 'stream_feed'}
+
+CANDUMP = re.compile(r'\(([\d.]+)\)\s+\S+\s+([0-9A-Fa-f]+)#([0-9A-Fa-f]*)')
+SERIAL = re.compile(r'TRACE ([0-9A-Fa-f]{8}) ([0-9A-Fa-f]{8})')
+
+
+def read_dumps(source, base):
+    """Split the records of the input into dumps, each starting with a header"""
+    dumps = []
+    for line in source:
+        match = CANDUMP.search(line)
+        if match:
+            if int(match.group(2), 16) != base + API_TRACE_DATA:
+                continue
+            data = bytes.fromhex(match.group(3))
+            if len(data) != 8:
+                continue
+        else:
+            match = SERIAL.search(line)
+            if not match:
+                continue
+            data = struct.pack('<II', int(match.group(1), 16), int(match.group(2), 16))
+        record = struct.unpack('<IBBH', data)
+        if record[1] == EVENT_HEADER:
+            dumps.append([])
+        if dumps:
+            dumps[-1].append(record)
+    return dumps
+
+
+def export(records):
+    time, _, version, count = records[0]
+    if version != FORMAT_VERSION:
+        raise ValueError('unknown trace format %d' % version)
+    us_per_cycle = 1e6 / time
+
+    names = {}
+    events = []
+    lost = 0
+    origin = None
+    epoch = 0
+    last = None
+    running = None
+
+    for time, kind, arg, value in records[1:]:
+        if kind == EVENT_LOST:
+            lost = time
+            continue
+        if kind == EVENT_NAME:
+            chars = names.get(value, b'\0' * 12)
+            chars = chars[:arg] + struct.pack('<I', time) + chars[arg + 4:]
+            names[value] = chars
+            continue
+
+        # cycle counts are 32 bits; events come in order, bar an
+        # interrupt burst stamped where it started
+        if last is not None and time < last - (1 << 31):
+            epoch += 1 << 32
+        last = time
+        time += epoch
+        if origin is None:
+            origin = time
+        ts = (time - origin) * us_per_cycle
+
+        if kind == EVENT_SWITCH:
+            if running is not None:
+                tid, start, priority = running
+                events.append({'name': 'running', 'ph': 'X', 'pid': 1, 'tid': tid,
+                               'ts': start, 'dur': ts - start, 'args': {'priority': priority}})
+            running = (value, ts, arg)
+        elif kind == EVENT_ISR:
+            events.append({'name': 'isr', 'ph': 'X', 'pid': 1, 'tid': ISR_TRACK,
+                           'ts': ts, 'dur': value * ISR_UNIT_CYCLES * us_per_cycle})
+        elif kind == EVENT_MARK:
+            events.append({'name': MARKS.get(arg, 'mark %d' % arg), 'ph': 'i', 's': 't',
+                           'pid': 1, 'tid': MARK_TRACK, 'ts': ts, 'args': {'value': value}})
+
+    metadata = [{'name': 'process_name', 'ph': 'M', 'pid': 1, 'args': {'name': 'AnalogX'}},
+                {'name': 'thread_name', 'ph': 'M', 'pid': 1, 'tid': ISR_TRACK, 'args': {'name': 'ISR'}},
+                {'name': 'thread_name', 'ph': 'M', 'pid': 1, 'tid': MARK_TRACK, 'args': {'name': 'markers'}}]
+    for tid, chars in sorted(names.items()):
+        name = chars.split(b'\0')[0].decode('ascii', 'replace')
+        metadata.append({'name': 'thread_name', 'ph': 'M', 'pid': 1, 'tid': tid, 'args': {'name': name}})
+
+    received = sum(1 for r in records if r[1] < EVENT_HEADER)
+    sys.stderr.write('%d of %d events, %d lost, %d threads\n' % (received, count, lost, len(names)))
+    return {'traceEvents': metadata + events, 'displayTimeUnit': 'ns'}
+
+
+def main(argv):
+    parser = argparse.ArgumentParser(description='Export an AnalogX trace dump')
+    parser.add_argument('log', nargs='?', help='candump -L style or serial log, stdin by default')
+    parser.add_argument('--base', type=lambda v: int(v, 0), default=0xE4600,
+                        help='CAN base ID of the device')
+    parser.add_argument('-o', '--output', help='trace file to write, stdout by default')
+    args = parser.parse_args(argv[1:])
+
+    source = open(args.log) if args.log else sys.stdin
+    dumps = read_dumps(source, args.base)
+    if not dumps:
+        sys.stderr.write('no trace dump found\n')
+        return 1
+    trace = export(dumps[-1])
+
+    output = open(args.output, 'w') if args.output else sys.stdout
+    json.dump(trace, output)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
@@ -0,0 +1,175 @@
+/*
+ * AnalogX firmware
+ *
+ * Copyright (C) 2017 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Integrators and totalizers, such as litres from a flow meter or amp
+ * hours from a current shunt.
+ *
+ * While any channel integrates, the ADC worker acquires continuously and
+ * every block of scans is added to the totals here, so the totals do not
+ * depend on the broadcast rate or on frames reaching the host. Time comes
+ * from the kernel timer, which runs from the crystal; the ADC's own HSI14
+ * clock is only good to a percent or so.
+ *
+ * Totals are broadcast every TOTALIZER_REPORT_INTERVAL_MS and saved with
+ * the configuration every TOTALIZER_SAVE_INTERVAL_S, as the CAN bus goes
+ * quiet (usually the ignition going off) and when preset. A power loss
+ * loses at most what accrued since the last save.
+ */
+
+#include "totalizer.h"
+#include "acquisition.h"
+#include "analogx_api.h"
+#include "logging.h"
+#include "power.h"
+#include "settings.h"
+#include "supply_monitor.h"
+#include "system_CAN.h"
+#include <string.h>
+
+#define _LOG_PFX "TOTAL:       "
+
+static int64_t g_totals[ADC_CHANNELS];
+static systime_t g_last_block;
+static systime_t g_last_report;
+static systime_t g_last_save;
+static bool g_can_was_asleep;
+
+void totalizer_init(void)
+{
+        memcpy(g_totals, get_saved_totals(), sizeof(g_totals));
+        g_last_block = g_last_report = g_last_save = chVTGetSystemTime();
+}
+
+bool totalizer_active(void)
+{
+        const struct TotalizerChannel *channels = get_totalizer_config();
+        for (size_t c = 0; c < ADC_CHANNELS; c++) {
+                if (channels[c].enabled)
+                        return true;
+        }
+        return false;
+}
+
+/*
+ * Add a block of 12 bit scans in ascending conversion order, taken since
+ * the previous block. A gap of over TOTALIZER_MAX_GAP_MS means acquisition
+ * stopped; it is left out rather than filled with one block's mean.
+ */
+void totalizer_integrate(const adcsample_t *buffer, size_t depth)
+{
+        systime_t now = chVTGetSystemTimeX();
+        systime_t ticks = now - g_last_block;
+        g_last_block = now;
+        if (ticks > MS2ST(TOTALIZER_MAX_GAP_MS))
+                return;
+
+        int64_t totals[ADC_CHANNELS] = {0};
+        acquisition_integrate(buffer, depth, ticks, get_totalizer_config(), totals);
+        uint32_t ratio = supply_monitor_ratio();
+
+        chSysLock();
+        for (size_t c = 0; c < ADC_CHANNELS; c++)
+                g_totals[c] += acquisition_correct_total(totals[c], ratio);
+        chSysUnlock();
+}
+
+static void _copy_totals(int64_t *totals)
+{
+        chSysLock();
+        memcpy(totals, g_totals, sizeof(g_totals));
+        chSysUnlock();
+}
+
+static void _save(void)
+{
+        int64_t totals[ADC_CHANNELS];
+        _copy_totals(totals);
+        api_save_totals(totals);
+        g_last_save = chVTGetSystemTime();
+}
+
+/*
+ * Preset a total from CAN: data8[0] is the channel (0..3) and data32[1]
+ * the new total in whole units; without it the total is reset to 0.
+ */
+void totalizer_preset(CANRxFrame *rx_msg)
+{
+        uint8_t channel = rx_msg->data8[0];
+        int32_t whole = rx_msg->DLC >= 8 ? (int32_t)rx_msg->data32[1] : 0;
+
+        if (channel >= ADC_CHANNELS) {
+                log_info(_LOG_PFX "Invalid params for set total\r\n");
+                return;
+        }
+        int64_t total = acquisition_total_preset(whole, CH_CFG_ST_FREQUENCY);
+        chSysLock();
+        g_totals[channel] = total;
+        chSysUnlock();
+        _save();
+        log_info(_LOG_PFX "channel %u preset to %d\r\n", channel + 1, whole);
+}
+
+/*
+ * Broadcast the totals of the integrating channels on API_TOTALS, one
+ * frame each: data8[0] channel, data16[1] the fraction in 1/65536ths and
+ * data32[1] the whole units, rounded down and saturated.
+ */
+static void _report(void)
+{
+        const struct TotalizerChannel *channels = get_totalizer_config();
+        int64_t totals[ADC_CHANNELS];
+        _copy_totals(totals);
+
+        for (size_t c = 0; c < ADC_CHANNELS; c++) {
+                if (!channels[c].enabled)
+                        continue;
+                int32_t whole;
+                uint16_t fraction;
+                acquisition_total_split(totals[c], CH_CFG_ST_FREQUENCY, &whole, &fraction);
+
+                CANTxFrame frame;
+                prepare_can_tx_message(&frame, CAN_IDE_EXT, get_can_base_id() + API_TOTALS);
+                frame.data8[0] = c;
+                frame.data8[1] = 0;
+                frame.data16[1] = fraction;
+                frame.data32[1] = whole;
+                canTransmit(&CAND1, CAN_ANY_MAILBOX, &frame, MS2ST(CAN_TRANSMIT_TIMEOUT));
+        }
+}
+
+/* Called periodically from the main thread */
+void totalizer_check(void)
+{
+        if (!totalizer_active())
+                return;
+
+        bool can_asleep = power_can_asleep();
+        if ((can_asleep && !g_can_was_asleep) ||
+            chVTTimeElapsedSinceX(g_last_save) >= S2ST(TOTALIZER_SAVE_INTERVAL_S))
+                _save();
+        g_can_was_asleep = can_asleep;
+
+        if (!can_asleep && chVTTimeElapsedSinceX(g_last_report) >= MS2ST(TOTALIZER_REPORT_INTERVAL_MS)) {
+                g_last_report = chVTGetSystemTime();
+                _report();
+        }
+}
@@ -0,0 +1,303 @@
+/*
+ * AnalogX firmware
+ *
+ * Copyright (C) 2017 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Kernel and application trace: context switches, interrupt service and
+ * application markers recorded into a RAM buffer, stamped with the
+ * SysTick cycle counter extended to 32 bits.
+ *
+ * Context switches come from the kernel hook in chconf.h. ChibiOS has no
+ * IRQ hooks on ARMv6-M, so interrupt service is seen the way the runtime
+ * statistics see it, as gaps in the idle loop (one event per burst of
+ * interrupts taken while idle); interrupts of interest also set markers.
+ *
+ * Capture is one-shot, stopping when the buffer is full, or a ring
+ * keeping the latest events. A dump freezes the buffer and sends it from
+ * the main loop, a batch per wake, as API_TRACE_DATA frames or as log
+ * lines "TRACE <word0> <word1>"; each record is 8 bytes:
+ *
+ *   word0   time in cycles
+ *   word1   type | arg << 8 | value << 16
+ *
+ * The dump starts with a header (time: cycles per second, arg: format
+ * version, value: events that follow the names), the count of events lost
+ * in a lost record, then the thread names, 4 characters per record with
+ * the thread id as value and the character offset as arg. Decode with
+ * tools/trace_export.py.
+ */
+
+#include "trace.h"
+#include "analogx_api.h"
+#include "logging.h"
+#include "settings.h"
+#include "system_CAN.h"
+#include "system_timer.h"
+#include <string.h>
+
+#define _LOG_PFX "TRACE:       "
+
+#define TRACE_FORMAT_VERSION    1
+
+#define TRACE_EVENT_SWITCH      1       /* arg: priority, value: thread id */
+#define TRACE_EVENT_ISR         2       /* value: duration in 16 cycle units */
+#define TRACE_EVENT_MARK        3       /* arg: marker id, value: marker value */
+#define TRACE_EVENT_HEADER      0x80
+#define TRACE_EVENT_LOST        0x81    /* time: events lost */
+#define TRACE_EVENT_NAME        0x82    /* time: 4 name characters */
+
+#define TRACE_ISR_UNIT_SHIFT    4
+#define TRACE_NAME_RECORDS      3
+#define TRACE_BUFFER_MASK       (TRACE_BUFFER_EVENTS - 1)
+
+#define TRACE_COMMAND_STOP              0
+#define TRACE_COMMAND_START             1
+#define TRACE_COMMAND_START_RING        2
+#define TRACE_COMMAND_DUMP_CAN          3
+#define TRACE_COMMAND_DUMP_SERIAL       4
+
+/* Records sent per main loop wake; serial lines also stop at the free
+ * log records */
+#define TRACE_DUMP_BATCH_CAN    32
+#define TRACE_DUMP_BATCH_SERIAL 8
+
+#define TRACE_MODE_OFF          0
+#define TRACE_MODE_ONE_SHOT     1
+#define TRACE_MODE_RING         2
+
+struct TraceEvent {
+        uint32_t time;
+        uint8_t type;
+        uint8_t arg;
+        uint16_t value;
+};
+
+/* Recording state, changed with the kernel locked */
+static struct TraceEvent g_events[TRACE_BUFFER_EVENTS];
+static uint32_t g_head;
+static uint32_t g_lost;
+static uint8_t g_mode;
+static uint32_t g_time;
+static uint32_t g_last_cycles;
+
+/* Dump in progress, driven by trace_check() */
+static uint8_t g_dump;
+static uint32_t g_dump_index;
+
+/* Extend the 24 bit cycle count; while recording, context switches come
+ * far more often than the counter wraps */
+static uint32_t _time_at(uint32_t cycles)
+{
+        uint32_t now = system_timer_cycles();
+        g_time += (now - g_last_cycles) & SYSTEM_TIMER_MASK;
+        g_last_cycles = now;
+        return g_time - ((now - cycles) & SYSTEM_TIMER_MASK);
+}
+
+/* Called with the kernel locked */
+static void _record(uint8_t type, uint8_t arg, uint16_t value, uint32_t cycles)
+{
+        if (g_mode == TRACE_MODE_OFF)
+                return;
+        if (g_mode == TRACE_MODE_ONE_SHOT && g_head == TRACE_BUFFER_EVENTS) {
+                g_lost++;
+                return;
+        }
+        struct TraceEvent *event = &g_events[g_head & TRACE_BUFFER_MASK];
+        event->time = _time_at(cycles);
+        event->type = type;
+        event->arg = arg;
+        event->value = value;
+        g_head++;
+}
+
+static uint16_t _thread_id(thread_t *tp)
+{
+        return (uint16_t)(uintptr_t)tp;
+}
+
+/* From the context switch hook, kernel locked */
+void trace_context_switch(thread_t *ntp, uint32_t cycles)
+{
+        _record(TRACE_EVENT_SWITCH, ntp->p_prio, _thread_id(ntp), cycles);
+}
+
+void trace_isr(uint32_t start_cycles, uint32_t cycles)
+{
+        uint32_t units = cycles >> TRACE_ISR_UNIT_SHIFT;
+        syssts_t sts = chSysGetStatusAndLockX();
+        _record(TRACE_EVENT_ISR, 0, units > UINT16_MAX ? UINT16_MAX : units, start_cycles);
+        chSysRestoreStatusX(sts);
+}
+
+/* Callable from any context */
+void trace_mark(uint8_t id, uint16_t value)
+{
+        syssts_t sts = chSysGetStatusAndLockX();
+        _record(TRACE_EVENT_MARK, id, value, system_timer_cycles());
+        chSysRestoreStatusX(sts);
+}
+
+static void _start(uint8_t mode)
+{
+        chSysLock();
+        g_head = 0;
+        g_lost = 0;
+        g_time = 0;
+        g_last_cycles = system_timer_cycles();
+        g_dump = 0;
+        g_mode = mode;
+        chSysUnlock();
+}
+
+static void _stop(void)
+{
+        chSysLock();
+        g_mode = TRACE_MODE_OFF;
+        chSysUnlock();
+}
+
+static uint32_t _event_count(void)
+{
+        return g_head < TRACE_BUFFER_EVENTS ? g_head : TRACE_BUFFER_EVENTS;
+}
+
+static uint32_t _lost_count(void)
+{
+        return g_head > TRACE_BUFFER_EVENTS ? g_head - TRACE_BUFFER_EVENTS : g_lost;
+}
+
+/* The registry is walked to its end each time, so no reference is held */
+static thread_t * _thread_at(uint32_t index, uint32_t *count)
+{
+        thread_t *found = NULL;
+        uint32_t n = 0;
+        thread_t *tp = chRegFirstThread();
+        while (tp) {
+                if (n++ == index)
+                        found = tp;
+                tp = chRegNextThread(tp);
+        }
+        *count = n;
+        return found;
+}
+
+/* Fill the dump record at index; false past the end */
+static bool _dump_record(uint32_t index, struct TraceEvent *record)
+{
+        record->arg = 0;
+        record->value = 0;
+        if (index == 0) {
+                record->type = TRACE_EVENT_HEADER;
+                record->time = STM32_HCLK;
+                record->arg = TRACE_FORMAT_VERSION;
+                record->value = _event_count();
+                return true;
+        }
+        if (index == 1) {
+                record->type = TRACE_EVENT_LOST;
+                record->time = _lost_count();
+                return true;
+        }
+        index -= 2;
+
+        uint32_t thread_count;
+        thread_t *tp = _thread_at(index / TRACE_NAME_RECORDS, &thread_count);
+        if (tp) {
+                uint8_t offset = (index % TRACE_NAME_RECORDS) * sizeof(record->time);
+                const char *name = tp->p_name ? tp->p_name : "";
+                size_t length = strlen(name);
+                uint8_t chars[sizeof(record->time)] = {0};
+                for (size_t i = 0; i < sizeof(chars) && offset + i < length; i++)
+                        chars[i] = name[offset + i];
+                memcpy(&record->time, chars, sizeof(chars));
+                record->type = TRACE_EVENT_NAME;
+                record->arg = offset;
+                record->value = _thread_id(tp);
+                return true;
+        }
+        index -= thread_count * TRACE_NAME_RECORDS;
+
+        if (index >= _event_count())
+                return false;
+        *record = g_events[(g_head - _event_count() + index) & TRACE_BUFFER_MASK];
+        return true;
+}
+
+/* Send the next batch of an ongoing dump, from the main loop */
+void trace_check(void)
+{
+        if (!g_dump)
+                return;
+
+        size_t batch = TRACE_DUMP_BATCH_CAN;
+        if (g_dump == TRACE_COMMAND_DUMP_SERIAL) {
+                uint32_t free = get_logging_free();
+                batch = free < TRACE_DUMP_BATCH_SERIAL ? free : TRACE_DUMP_BATCH_SERIAL;
+        }
+        for (size_t i = 0; i < batch; i++) {
+                struct TraceEvent record;
+                if (!_dump_record(g_dump_index, &record)) {
+                        log_info(_LOG_PFX "Dump done, %u records\r\n", g_dump_index);
+                        g_dump = 0;
+                        return;
+                }
+                uint32_t word1 = record.type | record.arg << 8 | (uint32_t)record.value << 16;
+                if (g_dump == TRACE_COMMAND_DUMP_CAN) {
+                        CANTxFrame frame;
+                        prepare_can_tx_message(&frame, CAN_IDE_EXT, get_can_base_id() + API_TRACE_DATA);
+                        frame.data32[0] = record.time;
+                        frame.data32[1] = word1;
+                        if (canTransmit(&CAND1, CAN_ANY_MAILBOX, &frame, MS2ST(CAN_TRANSMIT_TIMEOUT)) != MSG_OK)
+                                return;
+                } else if (!log_enqueue(0, _LOG_FORMAT("TRACE %08x %08x\r\n"), 2, record.time, word1)) {
+                        /* the ring filled up meanwhile; resend it next wake */
+                        return;
+                }
+                g_dump_index++;
+        }
+}
+
+void trace_control(CANRxFrame *rx_msg)
+{
+        uint8_t command = rx_msg->data8[0];
+        switch (command) {
+        case TRACE_COMMAND_STOP:
+                _stop();
+                break;
+        case TRACE_COMMAND_START:
+                _start(TRACE_MODE_ONE_SHOT);
+                break;
+        case TRACE_COMMAND_START_RING:
+                _start(TRACE_MODE_RING);
+                break;
+        case TRACE_COMMAND_DUMP_CAN:
+        case TRACE_COMMAND_DUMP_SERIAL:
+                _stop();
+                g_dump_index = 0;
+                g_dump = command;
+                log_info(_LOG_PFX "Dump %u events, %u lost\r\n", _event_count(), _lost_count());
+                return;
+        default:
+                log_info(_LOG_PFX "Invalid trace command %u\r\n", command);
+                return;
+        }
+        log_info(_LOG_PFX "Command %u\r\n", command);
+}
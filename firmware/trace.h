@@ -0,0 +1,49 @@
+/*
+ * AnalogX firmware
+ *
+ * Copyright (C) 2017 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TRACE_H_
+#define TRACE_H_
+#include "ch.h"
+#include "hal.h"
+
+/* Application markers, see trace_mark() */
+#define TRACE_MARK_ADC_DONE     1       /* conversion complete callback */
+#define TRACE_MARK_SENSOR_TX    2       /* sensor frame queued; value: result */
+#define TRACE_MARK_CAN_RX       3       /* frame dispatched; value: low ID bits */
+#define TRACE_MARK_STREAM_FEED  4       /* CAN stream mailboxes refilled; value: queued scans */
+
+/*
+ * Kernel and application trace (make USE_TRACE=yes), see trace.c. In
+ * other builds the hooks compile to nothing.
+ */
+#if TRACE_ENABLED
+void trace_context_switch(thread_t *ntp, uint32_t cycles);
+void trace_isr(uint32_t start_cycles, uint32_t cycles);
+void trace_mark(uint8_t id, uint16_t value);
+void trace_control(CANRxFrame *rx_msg);
+void trace_check(void);
+#else
+#define trace_context_switch(ntp, cycles)       ((void)(ntp), (void)(cycles))
+#define trace_isr(start_cycles, cycles)         ((void)(start_cycles), (void)(cycles))
+#define trace_mark(id, value)                   ((void)(id), (void)(value))
+#endif
+
+#endif /* TRACE_H_ */
@@ -0,0 +1,42 @@
+/*
+ * AnalogX firmware
+ *
+ * Copyright (C) 2017 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "cobs.h"
+
+size_t cobs_encode(const uint8_t *src, size_t len, uint8_t *dst)
+{
+        size_t code_index = 0;
+        size_t out = 1;
+        uint8_t code = 1;
+
+        for (size_t i = 0; i < len; i++) {
+                if (src[i] != 0) {
+                        dst[out++] = src[i];
+                        code++;
+                }
+                if (src[i] == 0 || code == 0xFF) {
+                        dst[code_index] = code;
+                        code = 1;
+                        code_index = out++;
+                }
+        }
+        dst[code_index] = code;
+        return out;
+}
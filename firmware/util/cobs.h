@@ -0,0 +1,38 @@
+/*
+ * AnalogX firmware
+ *
+ * Copyright (C) 2017 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef COBS_H_
+#define COBS_H_
+#include <stdint.h>
+#include <stddef.h>
+
+/* Worst case encoded size of len bytes, excluding the 0x00 delimiter */
+#define COBS_ENCODED_MAX(len) ((len) + (len) / 254 + 1)
+
+/*
+ * Consistent Overhead Byte Stuffing; the encoded output contains no 0x00
+ * bytes so a single 0x00 can delimit packets. Returns the encoded length.
+ * Encoding in place is safe with src at least COBS_ENCODED_MAX(len) - len
+ * bytes into dst: no byte is written before it has been read.
+ */
+size_t cobs_encode(const uint8_t *src, size_t len, uint8_t *dst);
+
+#endif /* COBS_H_ */
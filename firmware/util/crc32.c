@@ -0,0 +1,42 @@
+/*
+ * AnalogX firmware
+ *
+ * Copyright (C) 2017 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "crc32.h"
+
+/* Nibble-wise lookup table; keeps flash usage small on the F042 */
+static const uint32_t crc32_nibble_table[16] = {
+        0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC,
+        0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+        0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C,
+        0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+};
+
+uint32_t crc32(const void *data, size_t len)
+{
+        const uint8_t *bytes = data;
+        uint32_t crc = 0xFFFFFFFF;
+
+        while (len--) {
+                crc ^= *bytes++;
+                crc = (crc >> 4) ^ crc32_nibble_table[crc & 0x0F];
+                crc = (crc >> 4) ^ crc32_nibble_table[crc & 0x0F];
+        }
+        return crc ^ 0xFFFFFFFF;
+}
@@ -0,0 +1,199 @@
+/*
+ * AnalogX firmware
+ *
+ * Copyright (C) 2017 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "fft_q15.h"
+
+/* sin(2 pi k / FFT_MAX_POINTS) for the first quarter wave, Q15 */
+static const int16_t fft_sine_table[FFT_MAX_POINTS / 4 + 1] = {
+            0,   804,  1608,  2411,  3212,  4011,  4808,  5602,
+         6393,  7180,  7962,  8740,  9512, 10279, 11039, 11793,
+        12540, 13279, 14010, 14733, 15447, 16151, 16846, 17531,
+        18205, 18868, 19520, 20160, 20788, 21403, 22006, 22595,
+        23170, 23732, 24279, 24812, 25330, 25833, 26320, 26791,
+        27246, 27684, 28106, 28511, 28899, 29269, 29622, 29957,
+        30274, 30572, 30853, 31114, 31357, 31581, 31786, 31972,
+        32138, 32286, 32413, 32522, 32610, 32679, 32729, 32758,
+        32767
+};
+
+/* sin(2 pi k / FFT_MAX_POINTS) over the whole circle */
+static int16_t _sine(uint16_t k)
+{
+        k &= FFT_MAX_POINTS - 1;
+        if (k <= FFT_MAX_POINTS / 4)
+                return fft_sine_table[k];
+        if (k <= FFT_MAX_POINTS / 2)
+                return fft_sine_table[FFT_MAX_POINTS / 2 - k];
+        if (k <= 3 * FFT_MAX_POINTS / 4)
+                return -fft_sine_table[k - FFT_MAX_POINTS / 2];
+        return -fft_sine_table[FFT_MAX_POINTS - k];
+}
+
+static int16_t _cosine(uint16_t k)
+{
+        return _sine(k + FFT_MAX_POINTS / 4);
+}
+
+void fft_q15_window(int16_t *x, uint8_t log2n, uint8_t window)
+{
+        uint16_t n = 1 << log2n;
+        uint16_t step = FFT_MAX_POINTS >> log2n;
+
+        if (window != FFT_WINDOW_HANN)
+                return;
+
+        /* 0.5 - 0.5 cos(2 pi i / n) */
+        for (uint16_t i = 0; i < n; i++) {
+                int32_t w = (32768 - _cosine(i * step)) / 2;
+                x[i] = ((int32_t)x[i] * w) >> 15;
+        }
+}
+
+static void _bit_reverse(int16_t *re, int16_t *im, uint8_t log2n)
+{
+        uint16_t n = 1 << log2n;
+
+        for (uint16_t i = 0; i < n; i++) {
+                uint16_t j = 0;
+                for (uint8_t b = 0; b < log2n; b++)
+                        j |= ((i >> b) & 1) << (log2n - 1 - b);
+                if (j > i) {
+                        int16_t t = re[i];
+                        re[i] = re[j];
+                        re[j] = t;
+                        t = im[i];
+                        im[i] = im[j];
+                        im[j] = t;
+                }
+        }
+}
+
+void fft_q15(int16_t *re, int16_t *im, uint8_t log2n)
+{
+        uint16_t n = 1 << log2n;
+
+        _bit_reverse(re, im, log2n);
+
+        for (uint16_t size = 2; size <= n; size <<= 1) {
+                uint16_t half = size / 2;
+                uint16_t step = FFT_MAX_POINTS / size;
+                for (uint16_t k = 0; k < half; k++) {
+                        /* twiddle e^(-j 2 pi k / size) */
+                        int32_t wr = _cosine(k * step);
+                        int32_t wi = -_sine(k * step);
+                        for (uint16_t i = k; i < n; i += size) {
+                                uint16_t j = i + half;
+                                int32_t tr = (wr * re[j] - wi * im[j]) >> 15;
+                                int32_t ti = (wr * im[j] + wi * re[j]) >> 15;
+                                re[j] = (re[i] - tr) >> 1;
+                                im[j] = (im[i] - ti) >> 1;
+                                re[i] = (re[i] + tr) >> 1;
+                                im[i] = (im[i] + ti) >> 1;
+                        }
+                }
+        }
+}
+
+/* Move the even samples to the first half and the odd ones to the second,
+ * in place: each pass merges pairs of sorted blocks by swapping the odd
+ * samples of the first with the even samples of the second */
+static void _deinterleave(int16_t *x, uint8_t log2n)
+{
+        uint16_t n = 1 << log2n;
+
+        for (uint16_t size = 4; size <= n; size <<= 1) {
+                uint16_t quarter = size / 4;
+                for (uint16_t block = 0; block < n; block += size) {
+                        int16_t *a = x + block + quarter;
+                        int16_t *b = a + quarter;
+                        for (uint16_t i = 0; i < quarter; i++) {
+                                int16_t t = a[i];
+                                a[i] = b[i];
+                                b[i] = t;
+                        }
+                }
+        }
+}
+
+void fft_q15_real(int16_t *x, uint8_t log2n)
+{
+        uint16_t n = 1 << log2n;
+        uint16_t half = n / 2;
+        uint16_t step = FFT_MAX_POINTS >> log2n;
+        int16_t *re = x;
+        int16_t *im = x + half;
+
+        /* z[m] = x[2m] + j x[2m + 1], transformed at half the points */
+        _deinterleave(x, log2n);
+        fft_q15(re, im, log2n - 1);
+
+        /* Z is the DFT of z / (n / 2); split it into the even and odd
+         * sample spectra E and O and halve X = E + W^k O back to the DFT
+         * of x / n. Bins k and n/2 - k come from the same pair of Z */
+        int32_t dc = re[0];
+        re[0] = (dc + im[0]) >> 1;
+        im[0] = (dc - im[0]) >> 1;
+        for (uint16_t k = 1; k <= half / 2; k++) {
+                uint16_t m = half - k;
+                int32_t even_re = (re[k] + re[m]) >> 1;
+                int32_t even_im = (im[k] - im[m]) >> 1;
+                int32_t odd_re = (im[k] + im[m]) >> 1;
+                int32_t odd_im = (re[m] - re[k]) >> 1;
+                /* W^k = e^(-j 2 pi k / n) */
+                int32_t c = _cosine(k * step);
+                int32_t s = _sine(k * step);
+                int32_t wr = (c * odd_re + s * odd_im) >> 15;
+                int32_t wi = (c * odd_im - s * odd_re) >> 15;
+                re[k] = (even_re + wr) >> 1;
+                im[k] = (even_im + wi) >> 1;
+                re[m] = (even_re - wr) >> 1;
+                im[m] = (wi - even_im) >> 1;
+        }
+}
+
+uint64_t fft_q15_energy(const int16_t *re, const int16_t *im, uint16_t first, uint16_t last)
+{
+        uint64_t energy = 0;
+
+        for (uint16_t k = first; k < last; k++)
+                energy += (int32_t)re[k] * re[k] + (int32_t)im[k] * im[k];
+        return energy;
+}
+
+uint64_t fft_q15_real_energy(const int16_t *x, uint8_t log2n, uint16_t first, uint16_t last)
+{
+        uint16_t half = 1 << (log2n - 1);
+        const int16_t *re = x;
+        const int16_t *im = x + half;
+        uint64_t energy = 0;
+
+        /* bin 0 and the Nyquist bin are real, the latter kept in im[0] */
+        if (first == 0 && last > 0) {
+                energy += (int32_t)re[0] * re[0];
+                first = 1;
+        }
+        if (last > half) {
+                energy += (int32_t)im[0] * im[0];
+                last = half;
+        }
+        if (first < last)
+                energy += fft_q15_energy(re, im, first, last);
+        return energy;
+}
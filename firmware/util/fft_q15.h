@@ -0,0 +1,61 @@
+/*
+ * AnalogX firmware
+ *
+ * Copyright (C) 2017 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FFT_Q15_H_
+#define FFT_Q15_H_
+#include <stdint.h>
+
+/* Largest transform; 256 points of re + im take 1KB of RAM */
+#define FFT_MAX_LOG2            8
+#define FFT_MAX_POINTS          (1 << FFT_MAX_LOG2)
+#define FFT_MIN_LOG2            4
+
+#define FFT_WINDOW_RECTANGULAR  0
+#define FFT_WINDOW_HANN         1
+#define FFT_WINDOWS             2
+
+/* Multiply a block of samples by a window */
+void fft_q15_window(int16_t *x, uint8_t log2n, uint8_t window);
+
+/*
+ * In place radix-2 transform of 1 << log2n points. Every stage halves
+ * its output so the result is the DFT divided by the number of points and
+ * cannot overflow as long as the inputs stay within +/-16384.
+ */
+void fft_q15(int16_t *re, int16_t *im, uint8_t log2n);
+
+/*
+ * In place transform of 1 << log2n real samples: a complex transform of
+ * half the points, then the split into the real spectrum, scaled as
+ * fft_q15(). On return x holds re then im of bins 0 to n/2 - 1, n/2 values
+ * each; both ends of the spectrum are real, so the Nyquist bin n/2 takes
+ * the place of im[0].
+ */
+void fft_q15_real(int16_t *x, uint8_t log2n);
+
+/* Sum of re^2 + im^2 over bins [first, last) */
+uint64_t fft_q15_energy(const int16_t *re, const int16_t *im, uint16_t first, uint16_t last);
+
+/* The same over bins [first, last) of an fft_q15_real() spectrum, last at
+ * most n/2 + 1 */
+uint64_t fft_q15_real_energy(const int16_t *x, uint8_t log2n, uint16_t first, uint16_t last);
+
+#endif /* FFT_Q15_H_ */
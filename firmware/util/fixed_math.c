@@ -0,0 +1,60 @@
+/*
+ * AnalogX firmware
+ *
+ * Copyright (C) 2017 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "fixed_math.h"
+
+uint32_t fixed_isqrt(uint64_t value)
+{
+        uint64_t root = 0;
+        uint64_t bit = (uint64_t)1 << 62;
+
+        while (bit > value)
+                bit >>= 2;
+        while (bit) {
+                if (value >= root + bit) {
+                        value -= root + bit;
+                        root = (root >> 1) + bit;
+                } else {
+                        root >>= 1;
+                }
+                bit >>= 2;
+        }
+        return root;
+}
+
+/* the integer part by counting bits, the fraction by repeated squaring */
+uint32_t fixed_log2_q8(uint64_t value)
+{
+        uint32_t result = 0;
+        for (uint64_t v = value; v > 1; v >>= 1)
+                result++;
+
+        /* the mantissa in [1, 2) as Q30 */
+        uint64_t m = result > 30 ? value >> (result - 30) : value << (30 - result);
+        result <<= 8;
+        for (uint32_t bit = 0x80; bit; bit >>= 1) {
+                m = (m * m) >> 30;
+                if (m >= (UINT64_C(2) << 30)) {
+                        m >>= 1;
+                        result |= bit;
+                }
+        }
+        return result;
+}
@@ -0,0 +1,32 @@
+/*
+ * AnalogX firmware
+ *
+ * Copyright (C) 2017 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FIXED_MATH_H_
+#define FIXED_MATH_H_
+#include <stdint.h>
+
+/* Integer square root, rounded down */
+uint32_t fixed_isqrt(uint64_t value);
+
+/* log2 of a non zero value in 1/256ths */
+uint32_t fixed_log2_q8(uint64_t value);
+
+#endif /* FIXED_MATH_H_ */